@@ -1,7 +1,7 @@
 #!/usr/bin/env bash
 set -xue
 
-# Nothing relevant to test
-true
+# Render system tests (no display needed)
+QT_QPA_PLATFORM=offscreen make check
 
 set +xue
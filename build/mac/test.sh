@@ -1,7 +1,7 @@
 #!/usr/bin/env bash
 set -xue
 
-# Nothing relevant to test
-true
+# Render system tests
+make check
 
 set +xue
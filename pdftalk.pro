@@ -6,23 +6,47 @@ CONFIG += c++11
 INCLUDEPATH += src/
 CONFIG(release, debug|release): DEFINES += QT_NO_DEBUG_OUTPUT
 
-QT += core widgets
+QT += core network widgets
 HEADERS += \
 	src/action.h \
+	src/background_tasks.h \
+	src/benchmark.h \
 	src/controller.h \
 	src/document.h \
+	src/frame_sink.h \
+	src/memory_budget.h \
+	src/overlay.h \
+	src/remote_control.h \
 	src/render.h \
+	src/render_backend.h \
+	src/render_cache.h \
 	src/render_internal.h \
+	src/search.h \
+	src/slab_allocator.h \
+	src/streaming.h \
+	src/transition.h \
 	src/utils.h \
 	src/views.h \
 	src/window.h
 SOURCES += \
 	src/action.cpp \
+	src/background_tasks.cpp \
+	src/benchmark.cpp \
 	src/controller.cpp \
 	src/document.cpp \
+	src/frame_sink.cpp \
 	src/main.cpp \
+	src/memory_budget.cpp \
+	src/overlay.cpp \
 	src/prefetch_strategies.cpp \
+	src/remote_control.cpp \
 	src/render.cpp \
+	src/render_backend.cpp \
+	src/render_cache.cpp \
+	src/search.cpp \
+	src/slab_allocator.cpp \
+	src/streaming.cpp \
+	src/transition.cpp \
 	src/views.cpp
 
 # Poppler
@@ -33,6 +57,15 @@ macx: { # Mac
 CONFIG += link_pkgconfig
 PKGCONFIG += poppler-qt5
 
+### Tests ###
+
+# "make check" builds and runs the render system tests (test/render), with synthetic renders
+render_tests.target = check
+render_tests.commands = \
+	$(MKDIR) $$OUT_PWD/test/render && cd $$OUT_PWD/test/render && \
+	$$QMAKE_QMAKE $$PWD/test/render/render.pro && $(MAKE) check
+QMAKE_EXTRA_TARGETS += render_tests
+
 ### Misc information ###
 
 VERSION = 0.2
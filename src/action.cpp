@@ -13,6 +13,11 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <utility>
+
 #include <QApplication>
 #include <QDesktopServices>
 #include <QUrl>
@@ -21,25 +26,97 @@
 #include "controller.h"
 
 namespace Action {
-void Quit::execute (Controller &) const {
-	QApplication::quit ();
+// Link
+
+Link Link::page_index (int index) {
+	Link link (Kind::PageIndex);
+	link.page_index_ = index;
+	return link;
 }
-void Browser::execute (Controller &) const {
-	QDesktopServices::openUrl (QUrl (url_));
+Link Link::browser (const QString & url) {
+	Link link (Kind::Browser);
+	link.url_ = url;
+	return link;
 }
-void PageNext::execute (Controller & controller) const {
-	controller.go_to_next_page ();
+
+void Link::execute (Controller & controller) const {
+	switch (kind_) {
+	case Kind::Quit:
+		QApplication::quit ();
+		break;
+	case Kind::Browser:
+		QDesktopServices::openUrl (QUrl (url_));
+		break;
+	case Kind::PageNext:
+		controller.go_to_next_page ();
+		break;
+	case Kind::PagePrevious:
+		controller.go_to_previous_page ();
+		break;
+	case Kind::PageFirst:
+		controller.go_to_first_page ();
+		break;
+	case Kind::PageLast:
+		controller.go_to_last_page ();
+		break;
+	case Kind::PageIndex:
+		controller.go_to_page_index (page_index_);
+		break;
+	}
 }
-void PagePrevious::execute (Controller & controller) const {
-	controller.go_to_previous_page ();
+
+// LinkSet
+
+void LinkSet::add (const QRectF & rect, Link link) {
+	rects_.emplace_back (rect);
+	links_.emplace_back (std::move (link));
 }
-void PageFirst::execute (Controller & controller) const {
-	controller.go_to_first_page ();
+
+void LinkSet::build_index () {
+	// About one link per cell, with a bounded grid size
+	static constexpr int max_grid_size = 32;
+	const auto nb_links = static_cast<int> (links_.size ());
+	grid_size_ = std::max (1, std::min (max_grid_size, static_cast<int> (std::ceil (
+	                                                       std::sqrt (static_cast<qreal> (nb_links))))));
+	const int nb_cells = grid_size_ * grid_size_;
+
+	// Iterate over cells covered by a link rect
+	auto for_each_cell = [this](const QRectF & rect, const std::function<void(int)> & f) {
+		const int x_min = cell_coordinate (rect.left ());
+		const int x_max = cell_coordinate (rect.right ());
+		const int y_min = cell_coordinate (rect.top ());
+		const int y_max = cell_coordinate (rect.bottom ());
+		for (int y = y_min; y <= y_max; ++y)
+			for (int x = x_min; x <= x_max; ++x)
+				f (y * grid_size_ + x);
+	};
+
+	// Count links per cell, then fill in link order (keeps the first added first)
+	cell_offsets_.assign (nb_cells + 1, 0);
+	for (const auto & rect : rects_)
+		for_each_cell (rect, [this](int cell) { ++cell_offsets_[cell + 1]; });
+	for (int cell = 0; cell < nb_cells; ++cell)
+		cell_offsets_[cell + 1] += cell_offsets_[cell];
+
+	cell_links_.resize (cell_offsets_[nb_cells]);
+	std::vector<int> fill_position (cell_offsets_.begin (), cell_offsets_.end () - 1);
+	for (int i = 0; i < nb_links; ++i)
+		for_each_cell (rects_[i], [&](int cell) { cell_links_[fill_position[cell]++] = i; });
 }
-void PageLast::execute (Controller & controller) const {
-	controller.go_to_last_page ();
+
+const Link * LinkSet::at (const QPointF & point) const {
+	if (grid_size_ == 0 || !(0 <= point.x () && point.x () <= 1 && 0 <= point.y () && point.y () <= 1))
+		return nullptr;
+	const int cell = cell_coordinate (point.y ()) * grid_size_ + cell_coordinate (point.x ());
+	for (int i = cell_offsets_[cell]; i < cell_offsets_[cell + 1]; ++i) {
+		const int link = cell_links_[i];
+		if (rects_[link].contains (point))
+			return &links_[link];
+	}
+	return nullptr;
 }
-void PageIndex::execute (Controller & controller) const {
-	controller.go_to_page_index (index_);
+
+int LinkSet::cell_coordinate (qreal v) const {
+	return std::max (0, std::min (grid_size_ - 1, static_cast<int> (v * grid_size_)));
 }
 } // namespace Action
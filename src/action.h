@@ -16,70 +16,75 @@
  */
 #pragma once
 
-#include <QRect>
+#include <vector>
+
+#include <QPointF>
+#include <QRectF>
 #include <QString>
 
 class Controller;
 
 namespace Action {
-/* All clickable actions derive from Base.
- * Base provides a common rect field to identify the clickable rectangle.
- * Sub-classes can then overload execute, which is called on a click.
- *
- * Actions will always use the Controller API to change the presentation status.
+/* Clickable actions (pdf links).
+ * A Link is a small value: a kind, and its argument if any (page index or url).
+ * Links will always use the Controller API to change the presentation status.
  *
- * Actions are extracted from the document in document.cpp.
+ * Links are extracted from the document in document.cpp.
  */
-class Base {
-private:
-	QRectF rect_; // In relative [0,1] coordinates
-public:
-	virtual ~Base () = default;
-	virtual void execute (Controller & controller) const = 0;
-
-	void set_rect (const QRectF & rect) { rect_ = rect; }
-	bool activated (const QPointF & point) const { return rect_.contains (point); }
-};
-
-// Quit the application
-class Quit : public Base {
-public:
-	void execute (Controller &) const Q_DECL_FINAL;
+enum class Kind : unsigned char {
+	Quit,         // Quit the application
+	Browser,      // Open an url in a Browser
+	PageNext,     // Navigation
+	PagePrevious, //
+	PageFirst,    //
+	PageLast,     //
+	PageIndex     // page_index in [0, nb_pages[
 };
 
-// Open an url in a Browser
-class Browser : public Base {
+class Link {
 private:
+	Kind kind_;
+	int page_index_{-1};
 	QString url_;
 
 public:
-	Browser (const QString & url) : url_ (url) {}
-	void execute (Controller &) const Q_DECL_FINAL;
-};
+	explicit Link (Kind kind) : kind_ (kind) {}
+	static Link page_index (int index);
+	static Link browser (const QString & url);
 
-// Navigation
-class PageNext : public Base {
-public:
-	void execute (Controller & controller) const Q_DECL_FINAL;
-};
-class PagePrevious : public Base {
-public:
-	void execute (Controller & controller) const Q_DECL_FINAL;
+	Kind kind () const noexcept { return kind_; }
+	void execute (Controller & controller) const;
 };
-class PageFirst : public Base {
-public:
-	void execute (Controller & controller) const Q_DECL_FINAL;
-};
-class PageLast : public Base {
-public:
-	void execute (Controller & controller) const Q_DECL_FINAL;
-};
-class PageIndex : public Base {
+
+/* Links of a page, with a spatial index for hit-testing.
+ *
+ * Link rects (relative [0,1] coordinates) and links are stored in two contiguous arrays.
+ * After all links are added, build_index() creates a uniform grid over [0,1]x[0,1].
+ * Each grid cell lists the links overlapping it, in a flat array (cell_offsets_ into cell_links_).
+ * A lookup only tests links in the cell containing the point.
+ * This is cheap enough to be done on each mouse move, even on pages with hundreds of links.
+ * If links overlap, the first added wins.
+ */
+class LinkSet {
 private:
-	int index_; // [0, nb_pages[
+	std::vector<QRectF> rects_;
+	std::vector<Link> links_;
+
+	int grid_size_{0};              // Grid is grid_size_ x grid_size_ cells
+	std::vector<int> cell_offsets_; // Links of cell c: cell_links_[cell_offsets_[c], cell_offsets_[c+1][
+	std::vector<int> cell_links_;
 
 public:
-	PageIndex (int index) : index_ (index) {}
-	void execute (Controller & controller) const Q_DECL_FINAL;
+	void add (const QRectF & rect, Link link);
+	void build_index ();
+
+	bool empty () const noexcept { return links_.empty (); }
+	std::size_t size () const noexcept { return links_.size (); }
+
+	// Link at relative [0,1]x[0,1] coords, or nullptr
+	const Link * at (const QPointF & point) const;
+
+private:
+	int cell_coordinate (qreal v) const;
 };
 } // namespace Action
@@ -0,0 +1,55 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QRunnable>
+#include <QThread>
+
+#include "background_tasks.h"
+
+namespace {
+// Lowers the priority of the pool thread before running the task
+class IdleTask : public QRunnable {
+private:
+	QRunnable * task_;
+
+public:
+	explicit IdleTask (QRunnable * task) : task_ (task) {}
+
+	void run () Q_DECL_FINAL {
+		QThread::currentThread ()->setPriority (QThread::IdlePriority);
+		task_->run ();
+		if (task_->autoDelete ())
+			delete task_;
+	}
+};
+} // namespace
+
+BackgroundTasks::BackgroundTasks () : cancelled_ (std::make_shared<std::atomic<bool>> (false)) {
+	pool_.setMaxThreadCount (1);
+}
+BackgroundTasks::~BackgroundTasks () {
+	cancel ();
+}
+
+void BackgroundTasks::start (QRunnable * task) {
+	pool_.start (new IdleTask (task));
+}
+
+void BackgroundTasks::cancel () {
+	*cancelled_ = true;
+	pool_.waitForDone ();
+	cancelled_ = std::make_shared<std::atomic<bool>> (false);
+}
@@ -0,0 +1,46 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include <QThreadPool>
+
+class QRunnable;
+
+/* Background tasks of a widget (slide thumbnails, search index): slow, and never urgent.
+ *
+ * Tasks run one at a time, in a dedicated pool: they do not delay page renders in the global pool.
+ * Their thread runs at idle priority, the only priority below normal applied on Linux (SCHED_IDLE).
+ * Tasks check the cancel flag between steps of their work (a page, a thumbnail).
+ * cancel () stops the running task and waits for it: the data it used can then be released.
+ * Tasks started after cancel () get a new flag. Destruction cancels the tasks.
+ */
+class BackgroundTasks {
+private:
+	QThreadPool pool_;
+	std::shared_ptr<std::atomic<bool>> cancelled_;
+
+public:
+	BackgroundTasks ();
+	~BackgroundTasks ();
+
+	std::shared_ptr<const std::atomic<bool>> cancel_flag () const { return cancelled_; }
+	void start (QRunnable * task); // Ownership is taken as by QThreadPool
+	void cancel ();
+};
@@ -0,0 +1,563 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QColor>
+#include <QImage>
+#include <QLocalSocket>
+#include <QPainter>
+#include <QPixmap>
+#include <QPointF>
+#include <QSet>
+#include <QSize>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+
+#include "benchmark.h"
+#include "controller.h"
+#include "document.h"
+#include "remote_control.h"
+#include "render.h"
+#include "render_backend.h"
+#include "transition.h"
+
+namespace {
+QString tr (const char * str) {
+	return qApp->translate ("benchmark", str);
+}
+
+/* Document structure loading, without any rendering.
+ * Compares sequential discovery with parallel discovery (ideal thread count).
+ * Each configuration is run a few times, the best time is kept.
+ */
+int benchmark_structure (const QString & filename) {
+	QTextStream out (stdout);
+	const int nb_runs = 3;
+	const int ideal_threads = QThread::idealThreadCount ();
+
+	auto best_time_ms = [&](int nb_threads) -> qint64 {
+		qint64 best = std::numeric_limits<qint64>::max ();
+		for (int run = 0; run < nb_runs; ++run) {
+			QElapsedTimer timer;
+			timer.start ();
+			auto document = Document::open (filename, QString (), nb_threads);
+			auto elapsed = timer.elapsed ();
+			if (!document)
+				return -1;
+			if (run == 0)
+				out << tr ("%1 pages, %2 slides\n").arg (document->nb_pages ()).arg (document->nb_slides ());
+			best = std::min (best, elapsed);
+		}
+		return best;
+	};
+
+	auto sequential_ms = best_time_ms (1);
+	if (sequential_ms < 0)
+		return EXIT_FAILURE;
+	auto parallel_ms = best_time_ms (ideal_threads);
+	if (parallel_ms < 0)
+		return EXIT_FAILURE;
+
+	out << tr ("structure: 1 thread: %1 ms\n").arg (sequential_ms);
+	out << tr ("structure: %1 threads: %2 ms\n").arg (ideal_threads).arg (parallel_ms);
+	if (parallel_ms > 0)
+		out << tr ("structure: speedup: %1\n")
+		           .arg (static_cast<double> (sequential_ms) / static_cast<double> (parallel_ms), 0,
+		                 'f', 2);
+	return EXIT_SUCCESS;
+}
+
+/* Rasterization backends, page by page.
+ * Each page is rendered at full quality in a 1920x1080 box, with each backend (best of a few runs).
+ * The QPainter backend is measured with renderToImage, and with the direct paint path.
+ * The fastest backend is reported for each page, and for the whole document.
+ */
+int benchmark_backends (const QString & filename) {
+	QTextStream out (stdout);
+	const int nb_runs = 3;
+	const QSize box{1920, 1080};
+	const RenderSettings settings{RenderHints::Antialiased, false, 0.};
+
+	auto splash = Document::open (filename, QString (), 0, RenderBackend::Splash);
+	auto qpainter = Document::open (filename, QString (), 0, RenderBackend::QPainter);
+	if (!splash || !qpainter)
+		return EXIT_FAILURE;
+
+	auto best_time_ns = [nb_runs](const std::function<void()> & render) -> qint64 {
+		qint64 best = std::numeric_limits<qint64>::max ();
+		for (int run = 0; run < nb_runs; ++run) {
+			QElapsedTimer timer;
+			timer.start ();
+			render ();
+			best = std::min (best, timer.nsecsElapsed ());
+		}
+		return best;
+	};
+	auto ms = [](qint64 ns) { return QString::number (static_cast<double> (ns) / 1000000., 'f', 2); };
+
+	QImage buffer;
+	qint64 splash_total_ns = 0;
+	qint64 qpainter_total_ns = 0;
+	qint64 direct_total_ns = 0;
+	int splash_wins = 0;
+	for (int i = 0; i < splash->nb_pages (); ++i) {
+		const auto * splash_page = splash->page (i);
+		const auto * qpainter_page = qpainter->page (i);
+		auto splash_ns = best_time_ns ([&] { splash_page->render (box, settings); });
+		auto qpainter_ns = best_time_ns ([&] { qpainter_page->render (box, settings); });
+		auto direct_ns = best_time_ns ([&] { qpainter_page->render_into (buffer, box, settings); });
+		splash_total_ns += splash_ns;
+		qpainter_total_ns += qpainter_ns;
+		direct_total_ns += direct_ns;
+
+		bool splash_faster = splash_ns <= std::min (qpainter_ns, direct_ns);
+		if (splash_faster)
+			++splash_wins;
+		out << tr ("page %1: splash %2 ms, qpainter %3 ms, qpainter direct %4 ms -> %5\n")
+		           .arg (i + 1)
+		           .arg (ms (splash_ns), ms (qpainter_ns), ms (direct_ns),
+		                 splash_faster ? "splash" : "qpainter");
+	}
+
+	out << tr ("backends: splash: %1 ms total, faster on %2 pages\n")
+	           .arg (ms (splash_total_ns))
+	           .arg (splash_wins);
+	out << tr ("backends: qpainter: %1 ms total (direct: %2 ms), faster on %3 pages\n")
+	           .arg (ms (qpainter_total_ns), ms (direct_total_ns))
+	           .arg (splash->nb_pages () - splash_wins);
+	out << tr ("backends: fastest for this document: --backend %1\n")
+	           .arg (splash_total_ns <= std::min (qpainter_total_ns, direct_total_ns) ? "splash"
+	                                                                                  : "qpainter");
+	return EXIT_SUCCESS;
+}
+
+/* Control socket latency, without a real clicker.
+ * A client connects to the control socket, and alternates "next" and "previous" commands.
+ * The latency is measured from the command write to the reception of the "page" event.
+ * It covers the socket transfers, command parsing, and Controller::current_page_changed.
+ */
+int benchmark_control_latency (const QString & filename) {
+	QTextStream out (stdout);
+	const int nb_commands = 1000;
+
+	auto document = Document::open (filename, QString ());
+	if (!document)
+		return EXIT_FAILURE;
+	if (document->nb_pages () < 2) {
+		QTextStream (stderr) << tr ("Error: control-latency needs a document with 2 pages or more\n");
+		return EXIT_FAILURE;
+	}
+	Controller controller (*document);
+	controller.reset ();
+	RemoteControl remote (controller);
+	const auto name = QString ("pdftalk-benchmark-%1").arg (QCoreApplication::applicationPid ());
+	if (!remote.listen (name))
+		return EXIT_FAILURE;
+
+	QLocalSocket client;
+	client.connectToServer (name);
+	if (!client.waitForConnected (1000)) {
+		QTextStream (stderr) << tr ("Error: unable to connect to the control socket: %1\n")
+		                            .arg (client.errorString ());
+		return EXIT_FAILURE;
+	}
+
+	std::vector<qint64> latencies_ns;
+	latencies_ns.reserve (nb_commands);
+	for (int i = 0; i < nb_commands; ++i) {
+		QElapsedTimer timer;
+		timer.start ();
+		client.write (i % 2 == 0 ? "next\n" : "previous\n");
+		client.flush ();
+		bool page_changed = false;
+		while (!page_changed) {
+			QCoreApplication::processEvents (QEventLoop::WaitForMoreEvents);
+			while (client.canReadLine ()) {
+				if (client.readLine ().startsWith ("page "))
+					page_changed = true; // Other events (timer) are ignored
+			}
+		}
+		latencies_ns.push_back (timer.nsecsElapsed ());
+	}
+
+	std::sort (latencies_ns.begin (), latencies_ns.end ());
+	auto us = [](qint64 ns) { return QString::number (static_cast<double> (ns) / 1000., 'f', 1); };
+	out << tr ("control-latency: %1 commands\n").arg (nb_commands);
+	out << tr ("control-latency: min %1 us, median %2 us, p99 %3 us, max %4 us\n")
+	           .arg (us (latencies_ns.front ()), us (latencies_ns[latencies_ns.size () / 2]),
+	                 us (latencies_ns[latencies_ns.size () * 99 / 100]), us (latencies_ns.back ()));
+	return EXIT_SUCCESS;
+}
+
+/* Render scheduler stress test, without Poppler: synthetic document and backend.
+ * The document argument is not used.
+ *
+ * Thousands of flips are simulated: mostly forward, some backward, jumps and resizes.
+ * Each flip sends the requests of all views, like the real views.
+ * One flip out of 4 waits for its renders. Others are rapid: requested renders, prefetch renders
+ * and cache hits of consecutive flips interleave.
+ *
+ * Measured: GUI thread time per request (request submission and batch processing), flip latency.
+ * Checked: waited requests are answered at the right size. When the cache holds everything,
+ * nothing may be rendered twice (deduplication of requests, and of running renders).
+ * Eviction scenarios have a small cache and incompressible renders: re-renders are expected.
+ * They are run with each cache policy: renders made again after their eviction are compared.
+ *
+ * The navigation is a random walk, or replays a recorded presentation (see benchmark_replay).
+ */
+struct Flip {
+	int page_index; // Unchanged for resizes
+	RedrawCause cause;
+};
+
+std::vector<Flip> random_navigation (int nb_flips, int nb_pages) {
+	std::mt19937 random (42);
+	std::vector<Flip> flips;
+	flips.reserve (nb_flips);
+	int page_index = 0;
+	for (int flip = 0; flip < nb_flips; ++flip) {
+		auto cause = RedrawCause::ForwardMove;
+		auto draw = random () % 100;
+		if (draw < 80) {
+			page_index = (page_index + 1) % nb_pages;
+		} else if (draw < 92) {
+			cause = RedrawCause::BackwardMove;
+			page_index = (page_index + nb_pages - 1) % nb_pages;
+		} else if (draw < 97) {
+			cause = RedrawCause::RandomMove;
+			page_index = static_cast<int> (random () % nb_pages);
+		} else {
+			cause = RedrawCause::Resize;
+		}
+		flips.push_back (Flip{page_index, cause});
+	}
+	return flips;
+}
+
+struct SchedulerScenario {
+	const char * name;
+	Render::SyntheticBackend::Content content;
+	int latency_us;
+	qint64 cache_size_bytes;
+	qreal box_scale;
+	Render::CachePolicy cache_policy;
+	bool expect_no_duplicates;
+};
+
+bool run_scheduler_scenario (QTextStream & out, const SchedulerScenario & scenario,
+                             const std::vector<Flip> & flips, int nb_pages, int pages_per_slide) {
+	const int wait_timeout_ms = 10000;
+	auto document = Document::make_synthetic (nb_pages, pages_per_slide, QSizeF (364., 273.));
+	auto backend =
+	    std::make_shared<Render::SyntheticBackend> (scenario.latency_us, scenario.content);
+	Render::System renderer (scenario.cache_size_bytes, Render::default_prefetch_strategy (),
+	                         backend);
+	renderer.set_cache_policy (scenario.cache_policy);
+
+	// Answers to waited requests
+	QSet<Render::Info> waited_renders;
+	int nb_answers = 0;
+	int nb_wrong_answers = 0;
+	QObject::connect (&renderer, &Render::System::new_render,
+	                  [&](const Render::Info & render_info, QPixmap pixmap) {
+		                  ++nb_answers;
+		                  if (pixmap.size () != render_info.size ())
+			                  ++nb_wrong_answers;
+		                  waited_renders.remove (render_info);
+	                  });
+
+	// Views: public screen, presenter screen with previews
+	const std::array<QSize, nb_view_roles> full_boxes{{QSize (1920, 1080), QSize (1280, 720),
+	                                                   QSize (640, 360), QSize (320, 180),
+	                                                   QSize (320, 180)}};
+	qreal resize_factor = 1.;
+
+	int nb_requests = 0;
+	qint64 gui_ns = 0;
+	std::vector<qint64> latencies_ns;
+	for (std::size_t flip = 0; flip < flips.size (); ++flip) {
+		const auto * current_page = document->page (flips[flip].page_index);
+		const auto cause = flips[flip].cause;
+		if (cause == RedrawCause::Resize)
+			resize_factor = resize_factor == 1. ? 0.75 : 1.;
+		const bool wait = flip % 4 == 0;
+
+		QElapsedTimer timer;
+		timer.start ();
+		waited_renders.clear ();
+		for (int role = 0; role < nb_view_roles; ++role) {
+			const auto view_role = static_cast<ViewRole> (role);
+			Render::Request request{current_page,
+			                        full_boxes[role] * (scenario.box_scale * resize_factor), view_role,
+			                        cause, Render::default_profile_for_role (view_role)};
+			auto render_info = request.requested_render ();
+			if (wait && !render_info.isNull ())
+				waited_renders.insert (render_info);
+			renderer.request_render (request);
+			++nb_requests;
+		}
+		QCoreApplication::processEvents (); // Batch processing
+		gui_ns += timer.nsecsElapsed ();
+
+		if (wait) {
+			while (!waited_renders.isEmpty () && timer.elapsed () < wait_timeout_ms)
+				QCoreApplication::processEvents (QEventLoop::WaitForMoreEvents, 100);
+			if (!waited_renders.isEmpty ()) {
+				QTextStream (stderr) << tr ("Error: scheduler: %1: requests not answered after %2 ms\n")
+				                            .arg (scenario.name)
+				                            .arg (wait_timeout_ms);
+				return false;
+			}
+			latencies_ns.push_back (timer.nsecsElapsed ());
+		}
+	}
+	// Let prefetch renders finish
+	do {
+		QThreadPool::globalInstance ()->waitForDone ();
+		QCoreApplication::processEvents ();
+	} while (QThreadPool::globalInstance ()->activeThreadCount () > 0);
+
+	const auto stats = backend->statistics ();
+	std::sort (latencies_ns.begin (), latencies_ns.end ());
+	auto us = [](qint64 ns) { return QString::number (static_cast<double> (ns) / 1000., 'f', 1); };
+	auto ms = [](qint64 ns) { return QString::number (static_cast<double> (ns) / 1000000., 'f', 2); };
+	out << tr ("scheduler: %1: %2 flips, %3 requests, %4 answers\n")
+	           .arg (scenario.name)
+	           .arg (flips.size ())
+	           .arg (nb_requests)
+	           .arg (nb_answers);
+	out << tr ("scheduler: %1: GUI thread: %2 us per request\n")
+	           .arg (scenario.name, us (gui_ns / std::max (1, nb_requests)));
+	if (!latencies_ns.empty ())
+		out << tr ("scheduler: %1: flip latency: min %2 ms, median %3 ms, p99 %4 ms, max %5 ms\n")
+		           .arg (scenario.name, ms (latencies_ns.front ()),
+		                 ms (latencies_ns[latencies_ns.size () / 2]),
+		                 ms (latencies_ns[latencies_ns.size () * 99 / 100]), ms (latencies_ns.back ()));
+	out << tr ("scheduler: %1: backend: %2 renders, %3 duplicates\n")
+	           .arg (scenario.name)
+	           .arg (stats.renders)
+	           .arg (stats.duplicate_renders);
+	const auto cache_stats = renderer.cache_statistics ();
+	out << tr ("scheduler: %1: cache: %2 evictions, made again: %3 requested, %4 prefetch\n")
+	           .arg (scenario.name)
+	           .arg (cache_stats.capacity_evictions)
+	           .arg (cache_stats.requested_after_eviction)
+	           .arg (cache_stats.prefetched_after_eviction);
+
+	if (nb_wrong_answers > 0) {
+		QTextStream (stderr) << tr ("Error: scheduler: %1: %2 renders have a wrong size\n")
+		                            .arg (scenario.name)
+		                            .arg (nb_wrong_answers);
+		return false;
+	}
+	if (scenario.expect_no_duplicates && stats.duplicate_renders > 0) {
+		QTextStream (stderr) << tr ("Error: scheduler: %1: renders were duplicated\n")
+		                            .arg (scenario.name);
+		return false;
+	}
+	return true;
+}
+
+// Eviction scenarios: small cache, incompressible renders
+const SchedulerScenario eviction_scenarios[] = {
+    {"eviction-lru", Render::SyntheticBackend::Content::Noise, 2000, 16 * 1024 * 1024, 0.25,
+     Render::CachePolicy::Lru, false},
+    {"eviction-distance", Render::SyntheticBackend::Content::Noise, 2000, 16 * 1024 * 1024, 0.25,
+     Render::CachePolicy::Distance, false},
+};
+
+int benchmark_scheduler (const QString &) {
+	QTextStream out (stdout);
+	const int nb_pages = 120;
+	const int pages_per_slide = 3;
+	const SchedulerScenario no_eviction{"no-eviction", Render::SyntheticBackend::Content::Flat,
+	                                    2000, 1024 * 1024 * 1024, 1., Render::CachePolicy::Distance,
+	                                    true};
+	if (!run_scheduler_scenario (out, no_eviction, random_navigation (4000, nb_pages), nb_pages,
+	                             pages_per_slide))
+		return EXIT_FAILURE;
+	out.flush ();
+	const auto flips = random_navigation (500, nb_pages);
+	for (const auto & scenario : eviction_scenarios) {
+		if (!run_scheduler_scenario (out, scenario, flips, nb_pages, pages_per_slide))
+			return EXIT_FAILURE;
+		out.flush ();
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Eviction scenarios replaying a recorded presentation: a CSV timing log (--timing-log).
+ * The file argument is the timing log, not a document.
+ * Page changes of the log are replayed on a synthetic document with as many pages.
+ * Moves to the next (previous) page are forward (backward) moves, others are jumps.
+ */
+int benchmark_replay (const QString & filename) {
+	QTextStream out (stdout);
+	QFile file (filename);
+	if (!file.open (QFile::ReadOnly | QFile::Text)) {
+		QTextStream (stderr) << tr ("Error: unable to open timing log \"%1\"\n").arg (filename);
+		return EXIT_FAILURE;
+	}
+	// Lines are "slide,page,start_ms,duration_ms", after a header line. Pages count from 1.
+	std::vector<Flip> flips;
+	int nb_pages = 1;
+	int previous_index = 0;
+	QTextStream stream (&file);
+	stream.readLine ();
+	QString line;
+	while (!(line = stream.readLine ()).isNull ()) {
+		auto fields = line.split (',');
+		bool ok = false;
+		const int page_index = fields.size () >= 2 ? fields[1].toInt (&ok) - 1 : -1;
+		if (!ok || page_index < 0) {
+			QTextStream (stderr) << tr ("Error: malformed timing log line \"%1\"\n").arg (line);
+			return EXIT_FAILURE;
+		}
+		auto cause = RedrawCause::RandomMove;
+		if (page_index == previous_index + 1)
+			cause = RedrawCause::ForwardMove;
+		else if (page_index == previous_index - 1)
+			cause = RedrawCause::BackwardMove;
+		flips.push_back (Flip{page_index, cause});
+		nb_pages = std::max (nb_pages, page_index + 1);
+		previous_index = page_index;
+	}
+	if (flips.empty ()) {
+		QTextStream (stderr) << tr ("Error: no page change in timing log \"%1\"\n").arg (filename);
+		return EXIT_FAILURE;
+	}
+	for (const auto & scenario : eviction_scenarios) {
+		if (!run_scheduler_scenario (out, scenario, flips, nb_pages, 1))
+			return EXIT_FAILURE;
+		out.flush ();
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Compositing time of page transitions (TransitionCompositor) for a 3840x2160 view.
+ * Renders are synthetic: the document is not used.
+ * Each transition is played once to warm up (fade buffer allocation), then measured.
+ * Fails if a frame takes longer than the frame budget (60 Hz).
+ */
+int benchmark_transitions (const QString &) {
+	QTextStream out (stdout);
+	const QSize size (3840, 2160);
+	QImage from (size, QImage::Format_ARGB32_Premultiplied);
+	from.fill (QColor (200, 40, 40));
+	QImage to (size, QImage::Format_ARGB32_Premultiplied);
+	to.fill (QColor (40, 40, 200));
+	QImage screen (size, QImage::Format_ARGB32_Premultiplied);
+
+	struct NamedTransition {
+		const char * name;
+		PageTransition::Type type;
+		int angle;
+	};
+	const NamedTransition transitions[] = {
+	    {"fade", PageTransition::Type::Fade, 0},
+	    {"wipe-horizontal", PageTransition::Type::Wipe, 0},
+	    {"wipe-vertical", PageTransition::Type::Wipe, 90},
+	};
+	auto ms = [](qint64 ns) { return QString::number (static_cast<double> (ns) / 1000000., 'f', 2); };
+
+	int total_missed = 0;
+	for (const auto & named : transitions) {
+		PageTransition transition;
+		transition.type = named.type;
+		transition.duration_s = 0.5;
+		transition.angle = named.angle;
+		TransitionCompositor compositor;
+		std::vector<qint64> frames_ns;
+		for (int run = 0; run < 2; ++run) {
+			frames_ns.clear ();
+			if (!compositor.start (transition, from, to)) {
+				QTextStream (stderr) << tr ("Error: transitions: %1 cannot be played\n").arg (named.name);
+				return EXIT_FAILURE;
+			}
+			QPainter painter (&screen);
+			while (compositor.is_running ()) {
+				QElapsedTimer timer;
+				timer.start ();
+				compositor.paint (painter, QPointF (0., 0.));
+				frames_ns.push_back (timer.nsecsElapsed ());
+			}
+		}
+		std::sort (frames_ns.begin (), frames_ns.end ());
+		const auto missed = std::count_if (frames_ns.begin (), frames_ns.end (), [](qint64 ns) {
+			return ns > TransitionCompositor::frame_budget_ns;
+		});
+		out << tr ("transitions: %1: %2 frames, median %3 ms, max %4 ms, %5 over %6 ms\n")
+		           .arg (named.name)
+		           .arg (frames_ns.size ())
+		           .arg (ms (frames_ns[frames_ns.size () / 2]), ms (frames_ns.back ()))
+		           .arg (missed)
+		           .arg (ms (TransitionCompositor::frame_budget_ns));
+		total_missed += static_cast<int> (missed);
+	}
+	if (total_missed > 0) {
+		QTextStream (stderr) << tr ("Error: transitions: %1 frames over the frame budget\n")
+		                            .arg (total_missed);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+struct NamedBenchmark {
+	const char * name;
+	int (*function) (const QString & filename);
+};
+const NamedBenchmark defined_benchmarks[] = {
+    {"structure", benchmark_structure},
+    {"backends", benchmark_backends},
+    {"control-latency", benchmark_control_latency},
+    {"scheduler", benchmark_scheduler},
+    {"replay", benchmark_replay},
+    {"transitions", benchmark_transitions},
+};
+} // namespace
+
+QStringList list_of_benchmark_names () {
+	QStringList names;
+	for (const auto & benchmark : defined_benchmarks) {
+		names << benchmark.name;
+	}
+	return names;
+}
+
+int run_benchmark (const QString & name, const QString & filename) {
+	for (const auto & benchmark : defined_benchmarks) {
+		if (name.trimmed () == benchmark.name) {
+			return benchmark.function (filename);
+		}
+	}
+	QTextStream (stderr) << tr ("Error: unknown benchmark \"%1\" (%2)\n")
+	                            .arg (name)
+	                            .arg (list_of_benchmark_names ().join (','));
+	return EXIT_FAILURE;
+}
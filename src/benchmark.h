@@ -0,0 +1,29 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <QString>
+#include <QStringList>
+
+/* Benchmarks, selected by name from the command line.
+ * A benchmark runs instead of the presentation, and prints its results to stdout.
+ * Each benchmark measures one subsystem in isolation (no window is created).
+ *
+ * run_benchmark returns the program exit code (failure if the name is unknown).
+ */
+QStringList list_of_benchmark_names ();
+int run_benchmark (const QString & name, const QString & filename);
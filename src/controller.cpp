@@ -14,7 +14,19 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+
+#include <cstdio>
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
 #include <QShortcut>
+#include <QTextStream>
+#include <QTime>
 #include <QtDebug>
 
 #include "action.h"
@@ -23,14 +35,22 @@
 
 // Timer
 
+qint64 Timing::elapsed_ms () const {
+	auto total = accumulated_ms_;
+	if (is_running ())
+		total += running_since_.elapsed ();
+	return total;
+}
+
 void Timing::start () {
-	if (!timer_.isActive ())
+	if (!is_running ())
 		start_or_resume_timing ();
 }
 void Timing::toggle_pause () {
-	if (timer_.isActive ()) {
+	if (is_running ()) {
 		timer_.stop ();
-		accumulated_ = accumulated_.addMSecs (last_resume_.elapsed ());
+		accumulated_ms_ += running_since_.elapsed ();
+		running_since_.invalidate ();
 		emit_update ();
 	} else {
 		start_or_resume_timing ();
@@ -38,24 +58,90 @@ void Timing::toggle_pause () {
 }
 void Timing::reset () {
 	timer_.stop ();
-	accumulated_ = QTime{0, 0, 0};
+	running_since_.invalidate ();
+	accumulated_ms_ = 0;
 	emit_update (); // Everything changed
 }
 
 void Timing::emit_update () {
-	QTime total = accumulated_;
-	if (timer_.isActive ())
-		total = total.addMSecs (last_resume_.elapsed ());
-	emit update (!timer_.isActive (), total.toString (tr ("HH:mm:ss")));
+	auto text = QTime (0, 0).addMSecs (elapsed_ms ()).toString (tr ("HH:mm:ss"));
+	emit update (!is_running (), text);
 }
 void Timing::timerEvent (QTimerEvent *) {
 	emit_update ();
+	schedule_next_tick ();
 }
 void Timing::start_or_resume_timing () {
-	timer_.start (1000, this); // FIXME can cause misticks if too small...
-	last_resume_.start ();
+	running_since_.start ();
+	schedule_next_tick ();
 	emit_update (); // Pause status changed
 }
+void Timing::schedule_next_tick () {
+	// Fire when the displayed second changes. Restarting a QBasicTimer replaces the old one.
+	const auto ms_until_next_second = 1000 - static_cast<int> (elapsed_ms () % 1000);
+	timer_.start (ms_until_next_second, Qt::PreciseTimer, this);
+}
+
+// TimingLog
+
+TimingLog::TimingLog () {
+	// Avoid reallocations on the flip path for any reasonable presentation
+	entries_.reserve (4096);
+}
+
+void TimingLog::record (qint64 time_ms, const PageInfo * page) {
+	entries_.push_back (Entry{time_ms, page->index (), page->slide ()->index ()});
+}
+
+bool TimingLog::write_to_file (const QString & filename, qint64 end_time_ms) const {
+	auto tr = [](const char * str) { return qApp->translate ("TimingLog", str); };
+	QFile file (filename);
+	if (!file.open (QFile::WriteOnly | QFile::Truncate | QFile::Text)) {
+		QTextStream (stderr) << tr ("Error: unable to open timing log file \"%1\"\n").arg (filename);
+		return false;
+	}
+
+	// Visit durations
+	auto duration_ms = [&](std::size_t i) {
+		auto end = i + 1 < entries_.size () ? entries_[i + 1].time_ms : end_time_ms;
+		return end - entries_[i].time_ms;
+	};
+
+	if (filename.endsWith (".json", Qt::CaseInsensitive)) {
+		QJsonArray visits;
+		QMap<int, qint64> slide_durations_ms;
+		for (std::size_t i = 0; i < entries_.size (); ++i) {
+			const auto & e = entries_[i];
+			QJsonObject visit;
+			visit["slide"] = e.slide_index + 1;
+			visit["page"] = e.page_index + 1;
+			visit["start_ms"] = static_cast<double> (e.time_ms);
+			visit["duration_ms"] = static_cast<double> (duration_ms (i));
+			visits.append (visit);
+			slide_durations_ms[e.slide_index] += duration_ms (i);
+		}
+		QJsonArray slides;
+		for (auto it = slide_durations_ms.begin (); it != slide_durations_ms.end (); ++it) {
+			QJsonObject slide;
+			slide["slide"] = it.key () + 1;
+			slide["duration_ms"] = static_cast<double> (it.value ());
+			slides.append (slide);
+		}
+		QJsonObject root;
+		root["visits"] = visits;
+		root["slides"] = slides;
+		file.write (QJsonDocument (root).toJson ());
+	} else {
+		QTextStream stream (&file);
+		stream << "slide,page,start_ms,duration_ms\n";
+		for (std::size_t i = 0; i < entries_.size (); ++i) {
+			const auto & e = entries_[i];
+			stream << e.slide_index + 1 << ',' << e.page_index + 1 << ',' << e.time_ms << ','
+			       << duration_ms (i) << '\n';
+		}
+	}
+	return true;
+}
 
 // ViewRole
 
@@ -131,7 +217,7 @@ QDebug operator<< (QDebug d, RedrawCause cause) {
 
 // Controller
 
-Controller::Controller (const Document & document) : document_ (document) {
+Controller::Controller (const Document & document) : document_ (&document) {
 	connect (&timer_, &Timing::update, this, &Controller::time_changed);
 }
 
@@ -148,10 +234,20 @@ void Controller::go_to_first_page () {
 	go_to_page_index (0);
 }
 void Controller::go_to_last_page () {
-	go_to_page_index (document_.nb_pages () - 1);
+	go_to_page_index (document_->nb_pages () - 1);
 }
 
-void Controller::execute_action (const Action::Base * action) {
+bool Controller::write_timing_log (const QString & filename) const {
+	return timing_log_.write_to_file (filename, timer_.elapsed_ms ());
+}
+
+void Controller::timer_reset () {
+	timer_.reset ();
+	timing_log_.clear ();
+	timing_log_.record (0, document_->page (current_page_));
+}
+
+void Controller::execute_action (const Action::Link * action) {
 	action->execute (*this);
 }
 
@@ -159,17 +255,37 @@ void Controller::reset () {
 	// Does not start timer !
 	current_page_ = 0;
 	qDebug () << "### reset ###";
-	emit current_page_changed (document_.page (current_page_), RedrawCause::RandomMove);
+	emit document_changed (document_);
+	emit current_page_changed (document_->page (current_page_), RedrawCause::RandomMove);
 	timer_reset ();
 }
 
+void Controller::set_document (const Document * document) {
+	Q_ASSERT (document != nullptr);
+	// Keep the same slide, and the same page offset in the slide, if possible
+	auto * old_page = document_->page (current_page_);
+	auto * old_slide = old_page->slide ();
+	int slide_index = old_slide->index ();
+	int page_offset_in_slide = old_page->index () - old_slide->first_page ()->index ();
+
+	document_ = document;
+	auto * slide = document_->slide (std::min (slide_index, document_->nb_slides () - 1));
+	current_page_ = std::min (slide->first_page ()->index () + page_offset_in_slide,
+	                          slide->last_page ()->index ());
+	qDebug () << "### document changed ###";
+	emit document_changed (document_);
+	emit current_page_changed (document_->page (current_page_), RedrawCause::RandomMove);
+	timing_log_.record (timer_.elapsed_ms (), document_->page (current_page_));
+}
+
 void Controller::navigation_change_page (int index, RedrawCause cause) {
-	if (0 <= index && index < document_.nb_pages () && current_page_ != index) {
+	if (0 <= index && index < document_->nb_pages () && current_page_ != index) {
 		current_page_ = index;
-		auto * page = document_.page (current_page_);
+		auto * page = document_->page (current_page_);
 		qDebug () << "# current  " << page;
 		emit current_page_changed (page, cause);
 		timer_start ();
+		timing_log_.record (timer_.elapsed_ms (), page);
 	}
 }
 
@@ -189,7 +305,7 @@ void add_shortcuts_to_widget (Controller & c, QWidget * widget) {
 		auto sc = new QShortcut (QKeySequence (QObject::tr ("Space", "next_page key")), widget);
 		QObject::connect (sc, &QShortcut::activated, &c, &Controller::go_to_next_page);
 	}
-	// 'g' for goto page prompt TODO
+	// 'g' (go to slide prompt) is handled by the presenter view
 
 	// Timer control
 	{
@@ -16,30 +16,40 @@
  */
 #pragma once
 
+#include <vector>
+
 #include <QBasicTimer>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QPixmap>
-#include <QTime>
+#include <QString>
 class QWidget;
 
 class Document;
 class PageInfo;
 namespace Action {
-class Base;
+class Link;
 }
 
 /* Timer for a presentation.
  * Can be paused, restarted, resetted.
  * Tracks the time spent in the presentation between pauses.
  * Emits periodic signals to update the gui.
+ *
+ * Time is measured with a monotonic clock, and accumulated in milliseconds: no drift.
+ * The periodic timer is rescheduled at each tick to fire on the next second boundary.
  */
 class Timing : public QObject {
 	Q_OBJECT
 
 private:
 	QBasicTimer timer_;
-	QTime accumulated_; // Accumulated time until last pause
-	QTime last_resume_; // Time of last resume
+	QElapsedTimer running_since_; // Time since last resume, invalid if paused
+	qint64 accumulated_ms_{0};    // Accumulated time until last pause
+
+public:
+	bool is_running () const { return running_since_.isValid (); }
+	qint64 elapsed_ms () const; // Total presentation time
 
 signals:
 	// Periodically fires to indicate timer status (time in text format)
@@ -55,6 +65,32 @@ private:
 	void emit_update ();
 	void timerEvent (QTimerEvent *) Q_DECL_FINAL;
 	void start_or_resume_timing ();
+	void schedule_next_tick ();
+};
+
+/* Log of time spent on each slide.
+ * Records page changes with their presentation time (pauses excluded).
+ * Recording only appends to a vector with reserved capacity: cheap on the page flip path.
+ * Durations are computed at export, to a CSV or JSON file (selected by the file extension).
+ * Slide and page numbers are exported counting from 1, as shown to the user.
+ */
+class TimingLog {
+private:
+	struct Entry {
+		qint64 time_ms;
+		int page_index;
+		int slide_index;
+	};
+	std::vector<Entry> entries_;
+
+public:
+	TimingLog ();
+
+	void record (qint64 time_ms, const PageInfo * page);
+	void clear () { entries_.clear (); }
+
+	// end_time_ms is the end of the last entry. Returns false on error.
+	bool write_to_file (const QString & filename, qint64 end_time_ms) const;
 };
 
 /* View role.
@@ -71,7 +107,9 @@ enum class ViewRole {
 	PrevTransition,
 	Unknown
 };
+constexpr int nb_view_roles = static_cast<int> (ViewRole::Unknown); // Roles except Unknown
 QDebug operator<< (QDebug d, ViewRole role);
+Q_DECLARE_METATYPE (ViewRole);
 
 /* Page to show in the given role for the given current page.
  * nullptr indicates no page.
@@ -89,19 +127,28 @@ QDebug operator<< (QDebug d, RedrawCause cause);
 /* Manage a presentation state (which slide/page is currently viewed).
  * Sends signals to indicate changes in timer, current page.
  * Views will decide what to show from the current_page and their selected roles.
+ *
+ * The document can be replaced during the presentation (end of background loading, reload).
+ * The current slide and position in the slide are kept if possible, and the timer is not changed.
+ * The old document must still be alive during set_document.
  */
 class Controller : public QObject {
 	Q_OBJECT
 
 private:
-	const Document & document_;
+	const Document * document_;
 	int current_page_{0}; // Main iterator over document
 	Timing timer_;
+	TimingLog timing_log_; // Restarted when the timer is reset
 
 public:
 	explicit Controller (const Document & document);
 
+	// Returns false on error
+	bool write_timing_log (const QString & filename) const;
+
 signals:
+	void document_changed (const Document * new_document);
 	void current_page_changed (const PageInfo * new_current_page, RedrawCause cause);
 	void time_changed (bool paused, QString new_time_text);
 
@@ -116,14 +163,17 @@ public slots:
 	// Timer control
 	void timer_start () { timer_.start (); }
 	void timer_toggle_pause () { timer_.toggle_pause (); }
-	void timer_reset () { timer_.reset (); }
+	void timer_reset ();
 
 	// Action
-	void execute_action (const Action::Base * action);
+	void execute_action (const Action::Link * action);
 
 	// Full reset, also used for init
 	void reset ();
 
+	// Switch to a new document, keeping position if possible
+	void set_document (const Document * document);
+
 private:
 	void navigation_change_page (int new_page_index, RedrawCause cause);
 };
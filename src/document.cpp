@@ -15,14 +15,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <functional>
+#include <limits>
 
 #include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDebugStateSaver>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QImage>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QRunnable>
 #include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
 #include <poppler-qt5.h>
+#include <poppler-version.h>
 
 #include "action.h"
 #include "document.h"
@@ -34,20 +46,63 @@ template <typename T> void set_pointer_once (const T *& ptr, const T * value) {
 	ptr = value;
 }
 
+// Runs a function in a QThreadPool
+class FunctionTask : public QRunnable {
+private:
+	std::function<void()> function_;
+
+public:
+	explicit FunctionTask (std::function<void()> function) : function_ (std::move (function)) {}
+	void run () Q_DECL_FINAL { function_ (); }
+};
+
+// RenderBackend
+
+namespace {
+struct NamedRenderBackend {
+	const char * name;
+	RenderBackend backend;
+};
+const NamedRenderBackend defined_render_backends[] = {
+    {"splash", RenderBackend::Splash}, {"qpainter", RenderBackend::QPainter},
+};
+} // namespace
+
+QStringList list_of_render_backend_names () {
+	QStringList names;
+	for (const auto & b : defined_render_backends) {
+		names << b.name;
+	}
+	return names;
+}
+bool select_render_backend_by_name (const QString & name, RenderBackend & backend) {
+	for (const auto & b : defined_render_backends) {
+		if (name.trimmed () == b.name) {
+			backend = b.backend;
+			return true;
+		}
+	}
+	return false;
+}
+
 // PageInfo
 
-void add_page_actions (std::vector<std::unique_ptr<Action::Base>> & actions,
-                       const Poppler::Page & page) {
+void add_page_links (Action::LinkSet & links, const Poppler::Page & page) {
 	for (const auto * link : page.links ()) {
-		std::unique_ptr<Action::Base> new_action{nullptr};
-		// Build an action if it matches the supported types
+		using Action::Kind;
+		using Action::Link;
+		// Build a link action if it matches the supported types
+		bool supported = true;
+		Link new_link{Kind::Quit};
 		using PL = Poppler::Link;
 		switch (link->linkType ()) {
 		case PL::Goto: {
 			auto * p = dynamic_cast<const Poppler::LinkGoto *> (link);
 			if (!p->isExternal ()) {
 				auto page_index = p->destination ().pageNumber () - 1;
-				new_action = make_unique<Action::PageIndex> (page_index);
+				new_link = Link::page_index (page_index);
+			} else {
+				supported = false;
 			}
 		} break;
 		case PL::Action: {
@@ -57,38 +112,39 @@ void add_page_actions (std::vector<std::unique_ptr<Action::Base>> & actions,
 			case PA::Quit:
 			case PA::EndPresentation:
 			case PA::Close:
-				new_action = make_unique<Action::Quit> ();
+				new_link = Link{Kind::Quit};
 				break;
 			case PA::PageNext:
-				new_action = make_unique<Action::PageNext> ();
+				new_link = Link{Kind::PageNext};
 				break;
 			case PA::PagePrev:
-				new_action = make_unique<Action::PagePrevious> ();
+				new_link = Link{Kind::PagePrevious};
 				break;
 			case PA::PageFirst:
-				new_action = make_unique<Action::PageFirst> ();
+				new_link = Link{Kind::PageFirst};
 				break;
 			case PA::PageLast:
-				new_action = make_unique<Action::PageLast> ();
+				new_link = Link{Kind::PageLast};
 				break;
 			default:
 				// Not handled: History{Forward/Back}, GoToPage, Find, Print
 				// TODO handle gotopage ? (with a hotkey as well)
+				supported = false;
 				break;
 			}
 		} break;
 		case PL::Browse: {
 			auto * p = dynamic_cast<const Poppler::LinkBrowse *> (link);
-			new_action = make_unique<Action::Browser> (p->url ());
+			new_link = Link::browser (p->url ());
 		} break;
 		default:
 			// Not handled: Execute, Sound, Movie, Rendition, JavaScript
+			supported = false;
 			break;
 		}
-		// If we build one, add it to list
-		if (new_action) {
-			new_action->set_rect (link->linkArea ().normalized ());
-			actions.emplace_back (std::move (new_action));
+		// If supported, add it to list
+		if (supported) {
+			links.add (link->linkArea ().normalized (), std::move (new_link));
 		}
 		/* Documentation of links() does not say that we get ownership of the Link* objects.
 		 * Testing with valgrind show memory leaks if not deleted.
@@ -96,51 +152,166 @@ void add_page_actions (std::vector<std::unique_ptr<Action::Base>> & actions,
 		 */
 		delete link;
 	}
+	links.build_index ();
+}
+
+static PageTransition page_transition (const Poppler::Page & page) {
+	PageTransition transition;
+	const auto * poppler_transition = page.transition (); // Owned by the page, nullptr if none
+	if (poppler_transition == nullptr)
+		return transition;
+	using PT = Poppler::PageTransition;
+	switch (poppler_transition->type ()) {
+	case PT::Replace:
+		return transition;
+	case PT::Wipe:
+		transition.type = PageTransition::Type::Wipe;
+		transition.angle = ((poppler_transition->angle () % 360) + 360) % 360;
+		break;
+	default:
+		// Fade, Dissolve, and the geometric styles (Split, Blinds, Box, Glitter, Fly, Push, Cover...)
+		transition.type = PageTransition::Type::Fade;
+		break;
+	}
+	if (poppler_transition->durationReal () > 0.)
+		transition.duration_s = poppler_transition->durationReal ();
+	return transition;
+}
+
+static QByteArray make_content_hash (const Poppler::Page & page, const QSizeF & size_dots) {
+	/* Only what changes the rendered pixels is used: page size, text, and a low resolution render.
+	 * Text catches small textual changes that the low resolution render could miss.
+	 */
+	static constexpr qreal render_dpi = 36.0;
+	QCryptographicHash hash (QCryptographicHash::Sha1);
+	{
+		QByteArray size_data;
+		QDataStream stream (&size_data, QIODevice::WriteOnly);
+		stream << size_dots;
+		hash.addData (size_data);
+	}
+	hash.addData (page.text (QRectF ()).toUtf8 ());
+	auto image = page.renderToImage (render_dpi, render_dpi);
+	for (int y = 0; y < image.height (); ++y) {
+		hash.addData (reinterpret_cast<const char *> (image.constScanLine (y)),
+		              image.width () * image.depth () / 8);
+	}
+	return hash.result ();
 }
 
-PageInfo::PageInfo (std::unique_ptr<Poppler::Page> page, int index)
-    : poppler_page_ (std::move (page)), index_ (index) {
-	// precompute height_for_width_ratio
-	auto page_size_dots = poppler_page_->pageSizeF ();
-	if (!page_size_dots.isEmpty ())
-		height_for_width_ratio_ = page_size_dots.height () / page_size_dots.width ();
+PageInfo::PageInfo (std::unique_ptr<Poppler::Page> page_ptr,
+                    const Poppler::Document * aliased_document, int index, RenderBackend backend)
+    : poppler_page_ (std::move (page_ptr)),
+      aliased_document_ (aliased_document),
+      backend_ (backend),
+      index_ (index) {
+	// Extract all page level info now, as each call to poppler is costly
+	const auto & page = *poppler_page_;
+	size_dots_ = page.pageSizeF ();
+	if (!size_dots_.isEmpty ())
+		height_for_width_ratio_ = size_dots_.height () / size_dots_.width ();
+
+	label_ = page.label ();
+
+	add_page_links (links_, page);
+	transition_ = page_transition (page);
+}
 
-	add_page_actions (actions_, *poppler_page_);
+PageInfo::PageInfo (const QSizeF & size_dots, const QString & label, int index)
+    : backend_ (RenderBackend::Splash),
+      size_dots_ (size_dots),
+      label_ (label),
+      content_hash_ (QByteArray::number (index)),
+      content_hash_ready_ (true),
+      index_ (index) {
+	if (!size_dots_.isEmpty ())
+		height_for_width_ratio_ = size_dots_.height () / size_dots_.width ();
 }
 
-QString PageInfo::label () const {
-	return poppler_page_->label ();
+void PageInfo::compute_content_hash () const {
+	if (content_hash_ready_ || !poppler_page_)
+		return;
+	content_hash_ = make_content_hash (*poppler_page_, size_dots_);
+	content_hash_ready_ = true; // Publishes content_hash_
 }
 
 QSize PageInfo::render_size (const QSize & box) const {
 	// Computes the size we can render page in the given box
-	const auto page_size_dots = poppler_page_->pageSizeF ();
-	if (page_size_dots.isEmpty ())
+	if (size_dots_.isEmpty ())
 		return QSize ();
 	const qreal pix_dots_ratio =
-	    std::min (static_cast<qreal> (box.width ()) / page_size_dots.width (),
-	              static_cast<qreal> (box.height ()) / page_size_dots.height ());
-	return (page_size_dots * pix_dots_ratio).toSize ();
+	    std::min (static_cast<qreal> (box.width ()) / size_dots_.width (),
+	              static_cast<qreal> (box.height ()) / size_dots_.height ());
+	return (size_dots_ * pix_dots_ratio).toSize ();
 }
 
-QImage PageInfo::render (const QSize & box) const {
+QImage PageInfo::render (const QSize & box, const RenderSettings & settings) const {
 	// Render the page in the box
-	const auto page_size_dots = poppler_page_->pageSizeF ();
-	if (page_size_dots.isEmpty ())
-		return QImage ();
+	if (size_dots_.isEmpty () || !poppler_page_)
+		return QImage (); // Synthetic pages have no content
 	const qreal pix_dots_ratio =
-	    std::min (static_cast<qreal> (box.width ()) / page_size_dots.width (),
-	              static_cast<qreal> (box.height ()) / page_size_dots.height ());
+	    std::min (static_cast<qreal> (box.width ()) / size_dots_.width (),
+	              static_cast<qreal> (box.height ()) / size_dots_.height ());
 	const qreal dpi = pix_dots_ratio * 72.0;
-	return poppler_page_->renderToImage (dpi, dpi);
+	const auto & page = *poppler_page (settings.hints);
+
+	QImage image;
+	if (settings.max_dpi > 0 && dpi > settings.max_dpi) {
+		// Scaling a small render is much cheaper than rasterizing at full resolution
+		image = page.renderToImage (settings.max_dpi, settings.max_dpi)
+		            .scaled (render_size (box), Qt::IgnoreAspectRatio, Qt::FastTransformation);
+	} else {
+		image = page.renderToImage (dpi, dpi);
+	}
+	if (settings.grayscale)
+		image = image.convertToFormat (QImage::Format_Grayscale8);
+	return image;
+}
+
+bool PageInfo::can_render_into (const RenderSettings & settings) const {
+	// Scaling and grayscale conversion need an intermediate image anyway
+	return backend_ == RenderBackend::QPainter && settings.max_dpi <= 0 && !settings.grayscale &&
+	       poppler_page_;
 }
 
-const Action::Base * PageInfo::on_click (const QPointF & coord) const {
-	for (const auto & action : actions_) {
-		if (action->activated (coord))
-			return action.get ();
+void PageInfo::render_into (QImage & buffer, const QSize & box,
+                            const RenderSettings & settings) const {
+	Q_ASSERT (can_render_into (settings));
+	const auto size = render_size (box);
+	if (size.isEmpty ()) {
+		buffer = QImage ();
+		return;
 	}
-	return nullptr;
+	const qreal pix_dots_ratio =
+	    std::min (static_cast<qreal> (box.width ()) / size_dots_.width (),
+	              static_cast<qreal> (box.height ()) / size_dots_.height ());
+	const qreal dpi = pix_dots_ratio * 72.0;
+
+	if (buffer.size () != size || buffer.format () != QImage::Format_ARGB32_Premultiplied)
+		buffer = QImage (size, QImage::Format_ARGB32_Premultiplied);
+	buffer.fill (Qt::white); // Paper color, like renderToImage
+	QPainter painter (&buffer);
+	poppler_page (settings.hints)->renderToPainter (&painter, dpi, dpi);
+}
+
+QString PageInfo::extract_text () const {
+	return poppler_page_ ? poppler_page_->text (QRectF ()) : QString ();
+}
+
+const Poppler::Page * PageInfo::poppler_page (RenderHints hints) const {
+	if (hints == RenderHints::Antialiased || aliased_document_ == nullptr)
+		return poppler_page_.get ();
+	QMutexLocker lock (&aliased_page_mutex_);
+	if (!aliased_page_loaded_) {
+		aliased_page_.reset (aliased_document_->page (index_));
+		aliased_page_loaded_ = true;
+	}
+	// If the page cannot be loaded, render with the antialiased page rather than nothing
+	return aliased_page_ ? aliased_page_.get () : poppler_page_.get ();
+}
+
+const Action::Link * PageInfo::link_at (const QPointF & coord) const {
+	return links_.at (coord);
 }
 
 void PageInfo::set_slide (const SlideInfo * slide) {
@@ -188,12 +359,14 @@ void SlideInfo::set_previous_slide (const SlideInfo * slide) {
 
 // Document
 
-Document::Document (const QString & filename, std::unique_ptr<Poppler::Document> document)
-    : filename_ (filename), document_ (std::move (document)) {}
+Document::Document (const QString & filename,
+                    std::array<std::unique_ptr<Poppler::Document>, nb_render_hints> documents,
+                    RenderBackend backend)
+    : filename_ (filename), documents_ (std::move (documents)), backend_ (backend) {}
 Document::~Document () = default;
 
-std::unique_ptr<const Document> Document::open (const QString & filename,
-                                                const QString & pdfpc_filename) {
+static std::unique_ptr<Poppler::Document>
+open_poppler_document (const QString & filename, RenderHints hints, RenderBackend backend) {
 	auto tr = [](const char * str) { return qApp->translate ("Document::open", str); };
 
 	auto poppler_doc = std::unique_ptr<Poppler::Document> (Poppler::Document::load (filename));
@@ -208,45 +381,158 @@ std::unique_ptr<const Document> Document::open (const QString & filename,
 		return nullptr;
 	}
 
-	// Enable antialiasing, it is better looking
-	poppler_doc->setRenderHint (Poppler::Document::Antialiasing, true);
-	poppler_doc->setRenderHint (Poppler::Document::TextAntialiasing, true);
+	switch (backend) {
+	case RenderBackend::Splash:
+		poppler_doc->setRenderBackend (Poppler::Document::SplashBackend);
+		break;
+	case RenderBackend::QPainter:
+#if POPPLER_VERSION_MAJOR > 0 || POPPLER_VERSION_MINOR >= 89
+		poppler_doc->setRenderBackend (Poppler::Document::QPainterBackend);
+#else
+		poppler_doc->setRenderBackend (Poppler::Document::ArthurBackend); // Renamed in 0.89
+#endif
+		break;
+	}
+	switch (hints) {
+	case RenderHints::Antialiased:
+		// Enable antialiasing, it is better looking
+		poppler_doc->setRenderHint (Poppler::Document::Antialiasing, true);
+		poppler_doc->setRenderHint (Poppler::Document::TextAntialiasing, true);
+		break;
+	case RenderHints::Aliased:
+		// Faster, thin lines must stay visible without antialiasing
+		poppler_doc->setRenderHint (Poppler::Document::ThinLineSolid, true);
+		break;
+	}
+	return poppler_doc;
+}
+
+// Open one Poppler document for each RenderHints. Returns false on error.
+static bool open_poppler_documents (
+    std::array<std::unique_ptr<Poppler::Document>, nb_render_hints> & documents,
+    const QString & filename, RenderBackend backend) {
+	for (int hints = 0; hints < nb_render_hints; ++hints) {
+		documents[hints] = open_poppler_document (filename, static_cast<RenderHints> (hints), backend);
+		if (!documents[hints])
+			return false;
+	}
+	return true;
+}
+
+std::unique_ptr<const Document> Document::open (const QString & filename,
+                                                const QString & pdfpc_filename, int nb_threads,
+                                                RenderBackend backend) {
+	std::array<std::unique_ptr<Poppler::Document>, nb_render_hints> poppler_docs;
+	if (!open_poppler_documents (poppler_docs, filename, backend))
+		return nullptr;
 
 	// Document creation and staged init
-	auto document = std::unique_ptr<Document>{new Document (filename, std::move (poppler_doc))};
+	auto document =
+	    std::unique_ptr<Document>{new Document (filename, std::move (poppler_docs), backend)};
 
-	if (!document->discover_document_structure ()) {
+	QElapsedTimer structure_timer;
+	structure_timer.start ();
+	if (!document->discover_document_structure (nb_threads, std::numeric_limits<int>::max ())) {
 		return nullptr;
 	}
+	qDebug () << QString ("Document structure: %1 pages, %2 slides, in %3 ms")
+	                 .arg (document->nb_pages ())
+	                 .arg (document->nb_slides ())
+	                 .arg (structure_timer.elapsed ());
 
-	document->read_annotations_from_file (pdfpc_filename);
+	if (!pdfpc_filename.isNull ())
+		document->read_annotations_from_file (pdfpc_filename);
 
 	return std::move (document);
 }
 
-bool Document::discover_document_structure () {
+std::unique_ptr<const Document> Document::open_first_page (const QString & filename,
+                                                           RenderBackend backend) {
+	std::array<std::unique_ptr<Poppler::Document>, nb_render_hints> poppler_docs;
+	if (!open_poppler_documents (poppler_docs, filename, backend))
+		return nullptr;
+
+	auto document =
+	    std::unique_ptr<Document>{new Document (filename, std::move (poppler_docs), backend)};
+	if (!document->discover_document_structure (1, 1)) {
+		return nullptr;
+	}
+	document->partial_ = true;
+	return std::move (document);
+}
+
+std::unique_ptr<const Document>
+Document::make_synthetic (int nb_pages, int pages_per_slide, const QSizeF & size_dots) {
+	Q_ASSERT (nb_pages > 0);
+	Q_ASSERT (pages_per_slide > 0);
+	auto document = std::unique_ptr<Document>{new Document (QString (), {}, RenderBackend::Splash)};
+	document->pages_.reserve (nb_pages);
+	for (int i = 0; i < nb_pages; ++i) {
+		// Pages of a slide share their label, as in beamer documents
+		auto label = QString::number (i / pages_per_slide + 1);
+		document->pages_.emplace_back (make_unique<PageInfo> (size_dots, label, i));
+	}
+	document->link_pages_and_slides ();
+	return std::move (document);
+}
+
+bool Document::discover_document_structure (int nb_threads, int max_nb_pages) {
 	auto tr = [](const char * str) { return qApp->translate ("discover_document_structure", str); };
 
-	const auto nb_pages = static_cast<int> (document_->numPages ());
+	const auto nb_pages = std::min (static_cast<int> (documents_[0]->numPages ()), max_nb_pages);
 	if (nb_pages <= 0) {
 		QTextStream (stderr)
 		    << tr ("Error: Poppler: no pages in the PDF document \"%1\"").arg (filename_);
 		return false;
 	}
 
-	// Create uninitialized PageInfo structs
-	pages_.reserve (nb_pages);
+	/* Create uninitialized PageInfo structs.
+	 * Page level data (size, label, links) is independent for each page.
+	 * It is extracted from the Antialiased document only: pages of the others load on first render.
+	 * It is extracted in parallel: workers pick the next page index from a shared counter.
+	 * The calling thread also participates, so nb_threads == 1 is purely sequential.
+	 * Poppler is used concurrently on different pages, like in the render system.
+	 */
+	pages_.resize (nb_pages);
+	{
+		std::atomic<int> next_page_index{0};
+		const auto & document = *documents_[static_cast<int> (RenderHints::Antialiased)];
+		const auto * aliased_document = documents_[static_cast<int> (RenderHints::Aliased)].get ();
+		auto load_pages = [&]() {
+			int i;
+			while ((i = next_page_index++) < nb_pages) {
+				auto page = std::unique_ptr<Poppler::Page> (document.page (i));
+				if (page)
+					pages_[i] = make_unique<PageInfo> (std::move (page), aliased_document, i, backend_);
+			}
+		};
+
+		if (nb_threads <= 0)
+			nb_threads = QThread::idealThreadCount ();
+		nb_threads = std::max (1, std::min (nb_threads, nb_pages));
+
+		QThreadPool pool;
+		pool.setMaxThreadCount (nb_threads - 1);
+		for (int t = 1; t < nb_threads; ++t)
+			pool.start (new FunctionTask (load_pages));
+		load_pages ();
+		pool.waitForDone ();
+	}
 	for (int i = 0; i < nb_pages; ++i) {
-		auto p = std::unique_ptr<Poppler::Page>{document_->page (i)};
-		if (!p) {
+		if (!pages_[i]) {
 			QTextStream (stderr) << tr ("Error: Poppler: unable to load page %1 in document \"%2\"")
 			                            .arg (i)
 			                            .arg (filename_);
 			return false;
 		}
-		pages_.emplace_back (make_unique<PageInfo> (std::move (p), i));
 	}
 
+	link_pages_and_slides ();
+	return true;
+}
+
+void Document::link_pages_and_slides () {
+	const auto nb_pages = static_cast<int> (pages_.size ());
 	// Chain PageInfo structs (setup next/prev pointers)
 	for (int page_index = 1; page_index < nb_pages; ++page_index) {
 		auto * current = pages_[page_index].get ();
@@ -260,6 +546,7 @@ bool Document::discover_document_structure () {
 	 * This label appears to be the slide number from 1, as a string.
 	 *
 	 * Here, create a SlideInfo structure for each sequence of pages sharing the same label.
+	 * This is a fast sequential pass, as labels have already been extracted.
 	 * Set the slide field of PageInfo traversed.
 	 * Set the first / last page fields of SlideInfo structures.
 	 * Set the next / prev fields of SlideInfo structures.
@@ -277,7 +564,7 @@ bool Document::discover_document_structure () {
 			auto * current_page = pages_[page_index].get ();
 
 			// If label changed since last page, this is the first page of a new slide
-			auto label = current_page->label ();
+			const auto & label = current_page->label ();
 			if (label != current_slide_label) {
 				// Finish the current slide
 				auto prev_slide = std::move (current_slide);
@@ -304,7 +591,44 @@ bool Document::discover_document_structure () {
 		current_slide->set_last_page (pages_.back ().get ());
 		slides_.emplace_back (std::move (current_slide));
 	}
-	return true;
+}
+
+const SlideInfo * Document::find_slide (const QString & text) const {
+	const auto trimmed = text.trimmed ();
+	if (trimmed.isEmpty ())
+		return nullptr;
+	for (const auto & slide : slides_) {
+		if (slide->first_page ()->label () == trimmed)
+			return slide.get ();
+	}
+	bool ok = false;
+	const int number = trimmed.toInt (&ok);
+	if (ok && 1 <= number && number <= nb_slides ())
+		return slides_[number - 1].get ();
+	return nullptr;
+}
+
+QHash<const PageInfo *, const PageInfo *>
+Document::unchanged_pages (const Document & old_document, const Document & new_document) {
+	QMultiHash<QByteArray, const PageInfo *> new_pages_by_hash;
+	for (const auto & page : new_document.pages_) {
+		if (!page->content_hash ().isEmpty ())
+			new_pages_by_hash.insert (page->content_hash (), page.get ());
+	}
+
+	QHash<const PageInfo *, const PageInfo *> mapping;
+	for (const auto & old_page : old_document.pages_) {
+		if (old_page->content_hash ().isEmpty ())
+			continue;
+		const PageInfo * match = nullptr;
+		for (const auto * candidate : new_pages_by_hash.values (old_page->content_hash ())) {
+			if (match == nullptr || candidate->index () == old_page->index ())
+				match = candidate;
+		}
+		if (match != nullptr)
+			mapping.insert (old_page.get (), match);
+	}
+	return mapping;
 }
 
 bool Document::read_annotations_from_file (const QString & pdfpc_filename) {
@@ -356,3 +680,151 @@ bool Document::read_annotations_from_file (const QString & pdfpc_filename) {
 	}
 	return true;
 }
+
+// ContentHashTask
+
+void ContentHashTask::run () {
+	QElapsedTimer timer;
+	timer.start ();
+	for (int i = 0; i < document_->nb_pages (); ++i) {
+		if (*cancelled_)
+			return;
+		document_->page (i)->compute_content_hash ();
+	}
+	qDebug () << QString ("Document: content hashes of %1 pages in %2 ms")
+	                 .arg (document_->nb_pages ())
+	                 .arg (timer.elapsed ());
+	emit finished_hashing (document_);
+}
+
+// DocumentLoader
+
+DocumentLoader::DocumentLoader (const QString & filename, const QString & pdfpc_filename,
+                                bool watch, RenderBackend backend)
+    : filename_ (filename), pdfpc_filename_ (pdfpc_filename), watch_ (watch), backend_ (backend) {
+	reload_timer_.setSingleShot (true);
+	reload_timer_.setInterval (reload_delay_ms);
+	connect (&reload_timer_, &QTimer::timeout, this, &DocumentLoader::start_reload);
+	connect (&watcher_, &QFileSystemWatcher::fileChanged, this, &DocumentLoader::file_changed);
+	hash_wait_timer_.setSingleShot (true);
+	hash_wait_timer_.setInterval (max_hash_wait_ms);
+	connect (&hash_wait_timer_, &QTimer::timeout, this, &DocumentLoader::finish_reload);
+}
+DocumentLoader::~DocumentLoader () {
+	// Background tasks may still reference retired documents
+	QThreadPool::globalInstance ()->waitForDone ();
+}
+
+bool DocumentLoader::load () {
+	document_ = Document::open (filename_, pdfpc_filename_, 0, backend_);
+	if (!document_)
+		return false;
+	full_document_loaded_ = true;
+	start_content_hashing (document_.get ());
+	update_watched_files ();
+	return true;
+}
+
+bool DocumentLoader::load_progressively () {
+	document_ = Document::open_first_page (filename_, backend_);
+	if (!document_)
+		return false;
+	start_background_loading ();
+	return true;
+}
+
+void DocumentLoader::release_retired_documents () {
+	retired_documents_.clear ();
+}
+
+void DocumentLoader::background_loading_finished (const Document * document) {
+	auto tr = [](const char * str) { return qApp->translate ("DocumentLoader", str); };
+	loading_ = false;
+	if (document != nullptr && !full_document_loaded_) {
+		// First full document: no previous page to match
+		full_document_loaded_ = true;
+		replace_document (std::unique_ptr<const Document>{document});
+		start_content_hashing (document_.get ());
+	} else if (document != nullptr) {
+		/* Reload: shown once its hashes are ready, to match unchanged pages.
+		 * The previous hashing (current or older reloaded document) is stopped and waited for.
+		 * Pages of the current document it did not reach are considered changed.
+		 */
+		start_content_hashing (document);
+		reloaded_document_.reset (document); // Drops an older reloaded document, never shown
+		hash_wait_timer_.start ();
+	} else if (!full_document_loaded_) {
+		emit loading_failed ();
+		return;
+	} else {
+		QTextStream (stderr) << tr ("Warning: reload of \"%1\" failed, keeping current version\n")
+		                            .arg (filename_);
+	}
+	update_watched_files ();
+	if (reload_pending_) {
+		reload_pending_ = false;
+		start_background_loading ();
+	}
+}
+
+void DocumentLoader::file_changed () {
+	// Restarts the timer: wait until files are stable
+	reload_timer_.start ();
+}
+
+void DocumentLoader::start_reload () {
+	if (loading_) {
+		reload_pending_ = true;
+	} else {
+		start_background_loading ();
+	}
+}
+
+void DocumentLoader::content_hashing_finished (const Document * document) {
+	if (document == reloaded_document_.get ())
+		finish_reload ();
+}
+
+void DocumentLoader::finish_reload () {
+	if (!reloaded_document_)
+		return;
+	hash_wait_timer_.stop ();
+	// Hashing may continue on the new current document: the retired one is not used anymore
+	replace_document (std::move (reloaded_document_));
+}
+
+void DocumentLoader::start_content_hashing (const Document * document) {
+	// Only needed to match pages on reload
+	if (!watch_)
+		return;
+	content_hash_task_.cancel ();
+	auto * task = new ContentHashTask (document, content_hash_task_.cancel_flag ());
+	connect (task, &ContentHashTask::finished_hashing, this,
+	         &DocumentLoader::content_hashing_finished);
+	content_hash_task_.start (task);
+}
+
+void DocumentLoader::start_background_loading () {
+	qDebug () << "Document: background loading of" << filename_;
+	loading_ = true;
+	auto * task = new DocumentLoadTask (filename_, pdfpc_filename_, backend_);
+	connect (task, &DocumentLoadTask::finished_loading, this,
+	         &DocumentLoader::background_loading_finished);
+	QThreadPool::globalInstance ()->start (task);
+}
+
+void DocumentLoader::replace_document (std::unique_ptr<const Document> document) {
+	retired_documents_.emplace_back (std::move (document_));
+	document_ = std::move (document);
+	emit document_changed (document_.get (), retired_documents_.back ().get ());
+}
+
+void DocumentLoader::update_watched_files () {
+	// Files replaced by a new version (rename) are removed from the watcher: add them again
+	if (!watch_)
+		return;
+	for (const auto & path : {filename_, pdfpc_filename_}) {
+		if (!watcher_.files ().contains (path) && QFile::exists (path))
+			watcher_.addPath (path);
+	}
+}
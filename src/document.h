@@ -16,15 +16,25 @@
  */
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <memory>
 #include <vector>
 
+#include <QByteArray>
 #include <QDebug>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QRunnable>
+#include <QSizeF>
 #include <QString>
+#include <QStringList>
+#include <QTimer>
 
-namespace Action {
-class Base;
-}
+#include "action.h"
+#include "background_tasks.h"
 namespace Poppler {
 class Document;
 class Page;
@@ -32,6 +42,48 @@ class Page;
 class PageInfo;
 class SlideInfo;
 
+/* Poppler rasterization backend, selected for the whole document.
+ * Splash is the Poppler default.
+ * QPainter can paint directly into an existing image (see PageInfo::render_into).
+ * Which one is faster depends on the document: see the "backends" benchmark.
+ */
+enum class RenderBackend { Splash, QPainter };
+QStringList list_of_render_backend_names ();
+bool select_render_backend_by_name (const QString & name, RenderBackend & backend); // false if unknown
+
+/* Render settings, to trade render quality for speed.
+ *
+ * Poppler render hints (antialiasing, thin line mode) are set at the Poppler document level.
+ * Thus each hint set has its own Poppler document, and PageInfo uses a Poppler page from each.
+ * Rendering different hint sets concurrently is then safe.
+ * Only the Antialiased pages are loaded with the document: Aliased pages are loaded on first use.
+ *
+ * max_dpi caps the rasterization resolution: the render is then scaled to the requested size.
+ * grayscale converts the render, which also divides the size of the cached render by 4.
+ */
+enum class RenderHints {
+	Antialiased, // Antialiasing for graphics and text
+	Aliased      // No antialiasing, thin lines drawn solid
+};
+constexpr int nb_render_hints = 2;
+
+struct RenderSettings {
+	RenderHints hints;
+	bool grayscale;
+	qreal max_dpi; // 0 for no cap
+};
+
+/* Transition played when a page is shown (PDF /Trans entry of the incoming page).
+ * Only fades and wipes are composited: other PDF styles are approximated by a fade.
+ * Replace (the PDF default) is an instant change.
+ */
+struct PageTransition {
+	enum class Type { Replace, Fade, Wipe };
+	Type type{Type::Replace};
+	qreal duration_s{1.}; // PDF default
+	int angle{0};         // Wipe direction: 0 = left to right, 90 = bottom to top, 180, 270
+};
+
 /* A presentation (in beamer at least) is a pdf document.
  * A pdf document is flat and composed of pages (vector images).
  * The presentation is however composed of slides, which can each contain one or more pages.
@@ -45,7 +97,9 @@ class SlideInfo;
  * Some navigation links may not be defined (nullptr).
  *
  * PageInfo describes a pdf page.
- * It can perform rendering, stores sizing information, label, and actions.
+ * It can perform rendering (with RenderSettings), stores sizing information, label, and link actions.
+ * Sizing, label, actions and transition are extracted once at creation, independently per page.
+ * Thus PageInfo structs can be created in parallel (see discover_document_structure).
  *
  * SlideInfo describes a slide (sequence of pages).
  * It stores slide-level annotations.
@@ -59,6 +113,17 @@ class SlideInfo;
  * - must be stored in a text file, pdfpc format
  * - per slide (not page), stored in Document::SlideInfo
  *
+ * Pages can store a content hash (size, text, low resolution render).
+ * Pages of two versions of a document can then be matched, to detect unchanged pages.
+ * Hashes are slow to compute (a render each): they are computed in the background after loading
+ * (see ContentHashTask), and are empty until then.
+ *
+ * A Document can also be opened partially (only the first page, as a single slide).
+ * This is used to show something while the full document is loaded in the background.
+ *
+ * Synthetic documents have no PDF file: pages have a size and a label, but no content.
+ * They are used to test the render system without Poppler (see Render::SyntheticBackend).
+ *
  * Annotations internal to the PDF were tried:
  * - was only per page
  * - no way to generate them without a visual element (icon) -> broke slide layout
@@ -66,9 +131,20 @@ class SlideInfo;
  */
 class PageInfo {
 private:
-	std::unique_ptr<Poppler::Page> poppler_page_;
+	std::unique_ptr<Poppler::Page> poppler_page_; // Antialiased hints, loaded with the document
+	const Poppler::Document * aliased_document_{nullptr}; // Owned by Document
+	mutable QMutex aliased_page_mutex_;                   // Renders may load it concurrently
+	mutable std::unique_ptr<Poppler::Page> aliased_page_; // Loaded on first Aliased render
+	mutable bool aliased_page_loaded_{false};
+	RenderBackend backend_;
+	QSizeF size_dots_;                // Page size in points (1/72 inch)
 	qreal height_for_width_ratio_{0}; // Page aspect ratio, used by GUI
-	std::vector<std::unique_ptr<Action::Base>> actions_;
+	QString label_;
+	// Identifies the page visual content. Written once by compute_content_hash, then read only.
+	mutable QByteArray content_hash_;
+	mutable std::atomic<bool> content_hash_ready_{false};
+	Action::LinkSet links_;
+	PageTransition transition_;
 
 	// Navigation (always defined)
 	int index_;                        // PDF document page index (from 0)
@@ -78,7 +154,12 @@ private:
 	const PageInfo * previous_page_{nullptr};
 
 public:
-	PageInfo (std::unique_ptr<Poppler::Page> page, int index);
+	PageInfo (std::unique_ptr<Poppler::Page> page, const Poppler::Document * aliased_document,
+	          int index, RenderBackend backend);
+	/* Synthetic page: renders are null images.
+	 * Synthetic content only depends on the index (see SyntheticBackend), which is its hash.
+	 */
+	PageInfo (const QSizeF & size_dots, const QString & label, int index);
 
 	// Non copiable / movable, to safely take references on them
 	PageInfo (const PageInfo &) = delete;
@@ -91,19 +172,38 @@ public:
 	const PageInfo * next_page () const noexcept { return next_page_; }
 	const PageInfo * previous_page () const noexcept { return previous_page_; }
 
-	QString label () const;
+	const QString & label () const noexcept { return label_; }
+	// Empty until computed
+	QByteArray content_hash () const { return content_hash_ready_ ? content_hash_ : QByteArray (); }
+	// Slow (renders the page). Called by one thread only, concurrently with renders and readers.
+	void compute_content_hash () const;
+	const PageTransition & transition () const noexcept { return transition_; }
 
 	qreal height_for_width_ratio () const noexcept { return height_for_width_ratio_; }
 	QSize render_size (const QSize & box) const; // Which render size can fit in box
-	QImage render (const QSize & box) const;     // Make render in box
+	QImage render (const QSize & box, const RenderSettings & settings) const; // Make render in box
 
-	// Which action is triggered by a click at relative [0,1]x[0,1] coords ?
-	const Action::Base * on_click (const QPointF & coord) const;
+	/* Direct paint path: make render in box, painted into buffer (no intermediate image).
+	 * buffer is only reallocated if it does not match the render size, so it can be reused.
+	 * Only available with the QPainter backend, for full resolution color renders.
+	 */
+	bool can_render_into (const RenderSettings & settings) const;
+	void render_into (QImage & buffer, const QSize & box, const RenderSettings & settings) const;
+
+	// Text of the page, extracted by Poppler at each call (slow). Empty for synthetic pages.
+	QString extract_text () const;
+
+	// Which link is at relative [0,1]x[0,1] coords (click, hover) ? nullptr if none.
+	const Action::Link * link_at (const QPointF & coord) const;
 
 	// Navigation link setup by document
 	void set_slide (const SlideInfo * slide);
 	void set_next_page (const PageInfo * page);
 	void set_previous_page (const PageInfo * page);
+
+private:
+	// Poppler page rendering with these hints (loaded if needed), nullptr for synthetic pages
+	const Poppler::Page * poppler_page (RenderHints hints) const;
 };
 
 QDebug operator<< (QDebug d, const PageInfo * page);
@@ -147,14 +247,27 @@ public:
 class Document {
 private:
 	QString filename_;
-	std::unique_ptr<Poppler::Document> document_;
+	std::array<std::unique_ptr<Poppler::Document>, nb_render_hints> documents_; // By RenderHints
+	RenderBackend backend_;
 	std::vector<std::unique_ptr<PageInfo>> pages_;
 	std::vector<std::unique_ptr<SlideInfo>> slides_;
+	bool partial_{false}; // Only the first page has been loaded
 
 public:
-	// Returns nullptr on error, and prints messages to stderr
+	/* Returns nullptr on error, and prints messages to stderr.
+	 * A null pdfpc_filename skips annotation loading.
+	 * Page level structure discovery uses nb_threads threads (0 = ideal thread count).
+	 * Page content hashes are not computed (see ContentHashTask).
+	 */
 	static std::unique_ptr<const Document> open (const QString & filename,
-	                                             const QString & pdfpc_filename);
+	                                             const QString & pdfpc_filename, int nb_threads = 0,
+	                                             RenderBackend backend = RenderBackend::Splash);
+	// Partial document with only the first page, without annotations. Fast even on large documents.
+	static std::unique_ptr<const Document>
+	open_first_page (const QString & filename, RenderBackend backend = RenderBackend::Splash);
+	// Synthetic document: nb_pages pages of size_dots, grouped in slides of pages_per_slide pages
+	static std::unique_ptr<const Document> make_synthetic (int nb_pages, int pages_per_slide,
+	                                                       const QSizeF & size_dots);
 
 	~Document ();
 
@@ -164,10 +277,147 @@ public:
 	int nb_slides () const { return slides_.size (); }
 	const SlideInfo * slide (int slide_index) const { return slides_.at (slide_index).get (); }
 
+	bool is_partial () const { return partial_; }
+
+	/* Slide matching user input: a page label, or a slide number (counting from 1).
+	 * Labels are tried first (appendix slides may be labelled differently). nullptr if no match.
+	 */
+	const SlideInfo * find_slide (const QString & text) const;
+
+	/* Map pages of old_document to pages of new_document with the same content hash.
+	 * Pages with the same index are preferred. Changed pages are not in the map.
+	 * Pages without a content hash yet (on either side) are considered changed.
+	 */
+	static QHash<const PageInfo *, const PageInfo *>
+	unchanged_pages (const Document & old_document, const Document & new_document);
+
 private:
-	explicit Document (const QString & filename, std::unique_ptr<Poppler::Document> document);
+	explicit Document (const QString & filename,
+	                   std::array<std::unique_ptr<Poppler::Document>, nb_render_hints> documents,
+	                   RenderBackend backend);
 
 	// Init: returns false if failed
-	bool discover_document_structure ();
+	bool discover_document_structure (int nb_threads, int max_nb_pages);
+	void link_pages_and_slides (); // Navigation links and slides, from page labels
 	bool read_annotations_from_file (const QString & pdfpc_filename);
 };
+Q_DECLARE_METATYPE (const Document *);
+
+// "Load a document" task for QThreadPool. The Document is transmitted as an owning raw pointer.
+class DocumentLoadTask : public QObject, public QRunnable {
+	Q_OBJECT
+
+private:
+	const QString filename_;
+	const QString pdfpc_filename_;
+	const RenderBackend backend_;
+
+public:
+	DocumentLoadTask (const QString & filename, const QString & pdfpc_filename, RenderBackend backend)
+	    : filename_ (filename), pdfpc_filename_ (pdfpc_filename), backend_ (backend) {}
+
+signals:
+	void finished_loading (const Document * document); // nullptr on error
+
+public:
+	void run () Q_DECL_FINAL {
+		auto document = Document::open (filename_, pdfpc_filename_, 0, backend_);
+		emit finished_loading (document.release ());
+	}
+};
+
+/* "Compute page content hashes" task for BackgroundTasks, in page order.
+ * Can be cancelled between pages (finished_hashing is then not emitted).
+ */
+class ContentHashTask : public QObject, public QRunnable {
+	Q_OBJECT
+
+private:
+	const Document * document_;
+	const std::shared_ptr<const std::atomic<bool>> cancelled_;
+
+public:
+	ContentHashTask (const Document * document, std::shared_ptr<const std::atomic<bool>> cancelled)
+	    : document_ (document), cancelled_ (std::move (cancelled)) {}
+
+signals:
+	void finished_hashing (const Document * document);
+
+public:
+	void run () Q_DECL_FINAL;
+};
+
+/* Owns the presented Document, and manages its loading.
+ *
+ * load() opens the full document, blocking.
+ * load_progressively() only opens the first page (blocking), and loads the rest in background.
+ * When the full document is available, document_changed is emitted.
+ * If background loading fails, loading_failed is emitted.
+ *
+ * If watching is enabled, the pdf and pdfpc files are watched for changes.
+ * On change (debounced, as LaTeX writes in multiple steps), the document is reloaded in background.
+ * Reload failures (partially written file) keep the current document, and wait for a new change.
+ * Pages have content hashes in this mode, to let users of the document keep unchanged pages.
+ * Hashes are computed in the background, not by the loading task (see ContentHashTask).
+ * A reloaded document replaces the current one when its hashes are ready, or after
+ * max_hash_wait_ms: pages without a hash then are considered changed.
+ *
+ * Replaced documents are kept alive, as renders or views may still reference their pages.
+ * They are destroyed by release_retired_documents(), when nothing references them anymore.
+ */
+class DocumentLoader : public QObject {
+	Q_OBJECT
+
+private:
+	static constexpr int reload_delay_ms = 500;
+	static constexpr int max_hash_wait_ms = 1000;
+
+	const QString filename_;
+	const QString pdfpc_filename_;
+	const bool watch_;
+	const RenderBackend backend_;
+	std::unique_ptr<const Document> document_;
+	std::vector<std::unique_ptr<const Document>> retired_documents_;
+	std::unique_ptr<const Document> reloaded_document_; // Waiting for its content hashes
+	// After the documents: destroyed (cancelled) first
+	BackgroundTasks content_hash_task_;
+	QTimer hash_wait_timer_;
+
+	bool full_document_loaded_{false};
+	bool loading_{false};        // A background load is running
+	bool reload_pending_{false}; // Files changed during a background load
+	QFileSystemWatcher watcher_;
+	QTimer reload_timer_;
+
+public:
+	DocumentLoader (const QString & filename, const QString & pdfpc_filename, bool watch,
+	                RenderBackend backend);
+	~DocumentLoader ();
+
+	const Document * document () const noexcept { return document_.get (); }
+
+	// Return false on error
+	bool load ();
+	bool load_progressively ();
+
+signals:
+	// old_document stays alive at least until the end of the signal handling
+	void document_changed (const Document * new_document, const Document * old_document);
+	void loading_failed ();
+
+public slots:
+	void release_retired_documents ();
+
+private slots:
+	void background_loading_finished (const Document * document);
+	void file_changed ();
+	void start_reload ();
+	void content_hashing_finished (const Document * document);
+	void finish_reload ();
+
+private:
+	void start_background_loading ();
+	void start_content_hashing (const Document * document);
+	void replace_document (std::unique_ptr<const Document> document);
+	void update_watched_files ();
+};
@@ -0,0 +1,171 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <deque>
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QThread>
+#include <QWaitCondition>
+#include <QtDebug>
+
+#include "frame_sink.h"
+
+namespace {
+constexpr std::size_t max_queued_frames = 8;
+const char frame_magic[4] = {'P', 'T', 'F', 'R'};
+
+struct Frame {
+	QImage image;
+	qint64 timestamp_us;
+};
+
+bool write_frame (QFile & file, const Frame & frame) {
+	const auto & image = frame.image;
+	QByteArray header;
+	{
+		QDataStream stream (&header, QIODevice::WriteOnly);
+		stream.setByteOrder (QDataStream::LittleEndian);
+		stream.writeRawData (frame_magic, sizeof (frame_magic));
+		stream << static_cast<quint32> (image.width ()) << static_cast<quint32> (image.height ())
+		       << static_cast<quint32> (image.bytesPerLine ()) << static_cast<quint32> (image.format ())
+		       << frame.timestamp_us;
+	}
+	if (file.write (header) != header.size ())
+		return false;
+	const auto size = static_cast<qint64> (image.bytesPerLine ()) * image.height ();
+	return file.write (reinterpret_cast<const char *> (image.constBits ()), size) == size;
+}
+} // namespace
+
+/* Writer thread.
+ * Opening a named pipe blocks until a reader opens it: this is done in the thread too.
+ * If the pipe is still not opened at stop, it is opened for reading to unblock the thread.
+ * A failed or short write means the sink is closed (reader gone, EPIPE): the thread stops, and
+ * later frames are dropped without being queued.
+ */
+class FrameSink::Writer : public QThread {
+private:
+	const QString filename_;
+	QElapsedTimer clock_;
+	std::atomic<bool> opened_{false};
+
+	QMutex mutex_; // Protects fields below
+	QWaitCondition frame_available_;
+	std::deque<Frame> queue_;
+	bool stopping_{false};
+	bool closed_{false};
+	int dropped_frames_{0};
+
+public:
+	explicit Writer (const QString & filename) : filename_ (filename) { clock_.start (); }
+
+	void push (QImage image) {
+		Frame frame{std::move (image), clock_.nsecsElapsed () / 1000};
+		QMutexLocker lock (&mutex_);
+		if (closed_)
+			return;
+		if (queue_.size () >= max_queued_frames) {
+			queue_.pop_front ();
+			++dropped_frames_;
+		}
+		queue_.push_back (std::move (frame));
+		frame_available_.wakeOne ();
+	}
+
+	void stop () {
+		{
+			QMutexLocker lock (&mutex_);
+			stopping_ = true;
+			frame_available_.wakeOne ();
+		}
+		if (!opened_) {
+			QFile unblock (filename_);
+			unblock.open (QFile::ReadOnly);
+		}
+		wait ();
+	}
+
+private:
+	void run () Q_DECL_FINAL {
+		auto tr = [](const char * str) { return qApp->translate ("FrameSink", str); };
+		QFile file (filename_);
+		bool ok = file.open (QFile::WriteOnly | QFile::Unbuffered);
+		opened_ = true;
+		if (!ok) {
+			QTextStream (stderr) << tr ("Warning: unable to open \"%1\" for recording: %2\n")
+			                            .arg (filename_, file.errorString ());
+			close_sink ();
+			return;
+		}
+		int written_frames = 0;
+		for (;;) {
+			Frame frame;
+			{
+				QMutexLocker lock (&mutex_);
+				while (queue_.empty () && !stopping_)
+					frame_available_.wait (&mutex_);
+				if (queue_.empty ())
+					break; // Stopping, and all frames written
+				frame = std::move (queue_.front ());
+				queue_.pop_front ();
+			}
+			if (!write_frame (file, frame)) {
+				QTextStream (stderr) << tr ("Warning: recording to \"%1\" stopped, sink closed: %2\n")
+				                            .arg (filename_, file.errorString ());
+				close_sink ();
+				break;
+			}
+			++written_frames;
+		}
+		QMutexLocker lock (&mutex_);
+		qDebug () << QString ("Frame sink: %1 frames written, %2 dropped")
+		                 .arg (written_frames)
+		                 .arg (dropped_frames_);
+	}
+
+	void close_sink () {
+		QMutexLocker lock (&mutex_);
+		closed_ = true;
+		dropped_frames_ += static_cast<int> (queue_.size ());
+		queue_.clear ();
+	}
+};
+
+FrameSink::FrameSink (const QString & filename) : writer_ (new Writer (filename)) {
+#ifdef SIGPIPE
+	// A reader closing the pipe must not kill the presentation: writes fail with EPIPE instead
+	std::signal (SIGPIPE, SIG_IGN);
+#endif
+	writer_->start ();
+}
+FrameSink::~FrameSink () {
+	writer_->stop ();
+}
+
+void FrameSink::push_frame (const QPixmap & pixmap) {
+	// For raster pixmaps, toImage () shares the pixel data (no copy)
+	writer_->push (pixmap.toImage ());
+}
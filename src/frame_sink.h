@@ -0,0 +1,53 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <memory>
+
+#include <QObject>
+#include <QPixmap>
+#include <QString>
+
+/* Records the frames shown by a view into a file or a named pipe, for an external encoder.
+ *
+ * A frame is written when the view shows a new pixmap: frame durations are variable.
+ * Each frame is a header followed by the raw pixel data (bytes per line x height bytes).
+ * Header, little endian:
+ * - "PTFR" magic (4 bytes),
+ * - width, height, bytes per line, QImage::Format value of the pixel data (4 x uint32),
+ * - timestamp in microseconds since the start of the recording (int64).
+ *
+ * Writing is done by a dedicated thread: a pipe reader (encoder) can be slow, or not started yet.
+ * Frames are queued without copy (the image of a pixmap shares its pixel data).
+ * The queue is bounded: when full, the oldest waiting frame is dropped, the view is never blocked.
+ * At destruction, queued frames are written before returning.
+ * Recording stops at the first failed write, such as the reader closing the pipe.
+ */
+class FrameSink : public QObject {
+	Q_OBJECT
+
+private:
+	class Writer;
+	std::unique_ptr<Writer> writer_;
+
+public:
+	explicit FrameSink (const QString & filename);
+	~FrameSink ();
+
+public slots:
+	void push_frame (const QPixmap & pixmap);
+};
@@ -14,25 +14,41 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <cstdio>
+#include <memory>
 
 #include <QApplication>
 #include <QCommandLineOption>
 #include <QCommandLineParser>
+#include <QGuiApplication>
+#include <QHostAddress>
+#include <QScreen>
 #include <QStringList>
 #include <QTextStream>
 #include <QTimer>
 
 #include "action.h"
+#include "benchmark.h"
 #include "controller.h"
 #include "document.h"
+#include "frame_sink.h"
+#include "memory_budget.h"
+#include "overlay.h"
+#include "remote_control.h"
 #include "render.h"
+#include "render_backend.h"
+#include "search.h"
+#include "streaming.h"
+#include "utils.h"
 #include "views.h"
 #include "window.h"
 
 /* Main components of PDFTalk:
  *
  * Document: stores the PDF information (pages, organization, rendering with poppler).
+ * DocumentLoader: owns the Document, can finish loading it in background (--progressive).
+ *   It can also reload the Document on file changes (--watch).
  * PageViewer widgets: show a single image (one rendered PDF page).
  * PresentationView/PresenterView: composed of PageViewers, provide the window layouts.
  * WindowShifter: create OS windows, contains PresentationView/PresenterView widgets.
@@ -70,8 +86,13 @@ int main (int argc, char * argv[]) {
 	// Type registration (once before use in connect)
 	qRegisterMetaType<Render::Info> ();
 	qRegisterMetaType<Render::Request> ();
+	qRegisterMetaType<Render::Compressed> ();
+	qRegisterMetaType<ViewRole> ();
+	qRegisterMetaType<const Document *> ();
+	qRegisterMetaType<NotesLayout> ();
+	qRegisterMetaType<SearchIndex *> ();
 
-	int render_cache_size = 10 * (1 << 20); // 10MB default
+	qint64 render_cache_size = -1; // Automatic by default
 	auto * prefetch_strategy = Render::default_prefetch_strategy ();
 
 	// Command line parsing
@@ -82,7 +103,7 @@ int main (int argc, char * argv[]) {
 	QCommandLineOption render_cache_size_option (
 	    QStringList () << "c"
 	                   << "cache",
-	    tr ("Render cache size (default = %1)").arg (size_in_bytes_to_string (render_cache_size)),
+	    tr ("Render cache size, or 'auto' to adapt to screens, document and memory (default)"),
 	    tr ("size"));
 	parser.addOption (render_cache_size_option);
 	QCommandLineOption pdfpc_filename_option (QStringList () << "a"
@@ -96,8 +117,77 @@ int main (int argc, char * argv[]) {
 	    tr ("Prefetch strategy (%1)").arg (Render::list_of_prefetch_strategy_names ().join (',')),
 	    tr ("name"));
 	parser.addOption (prefetch_strategy_option);
+	QCommandLineOption cache_policy_option (
+	    QStringList () << "cache-policy",
+	    tr ("Render cache eviction policy (%1, default distance)")
+	        .arg (Render::list_of_cache_policy_names ().join (',')),
+	    tr ("name"));
+	parser.addOption (cache_policy_option);
+	QCommandLineOption progressive_option (
+	    QStringList () << "progressive",
+	    tr ("Show the first page immediately, and load the rest of the document in background"));
+	parser.addOption (progressive_option);
+	QCommandLineOption watch_option (
+	    QStringList () << "w"
+	                   << "watch",
+	    tr ("Reload the document when the pdf or pdfpc files change"));
+	parser.addOption (watch_option);
+	QCommandLineOption backend_option (
+	    QStringList () << "backend",
+	    tr ("Poppler rasterization backend (%1, default splash)")
+	        .arg (list_of_render_backend_names ().join (',')),
+	    tr ("name"));
+	parser.addOption (backend_option);
+	QCommandLineOption quality_previews_option (
+	    QStringList () << "quality-previews",
+	    tr ("Render presenter previews at full quality (faster profiles are used by default)"));
+	parser.addOption (quality_previews_option);
+	QCommandLineOption no_transitions_option (
+	    QStringList () << "no-transitions",
+	    tr ("Change pages instantly, ignoring the PDF page transitions (fade, wipe)"));
+	parser.addOption (no_transitions_option);
+	QCommandLineOption timing_log_option (
+	    QStringList () << "t"
+	                   << "timing-log",
+	    tr ("At exit, write time spent per slide to a file (.json for JSON, CSV otherwise)"),
+	    tr ("file"));
+	parser.addOption (timing_log_option);
+	QCommandLineOption control_option (
+	    QStringList () << "control",
+	    tr ("Accept commands on a local socket (see remote_control.h for the protocol)"),
+	    tr ("name"));
+	parser.addOption (control_option);
+	QCommandLineOption record_option (
+	    QStringList () << "record",
+	    tr ("Write frames shown by the presentation screen to a file or named pipe (raw, timestamped)"),
+	    tr ("path"));
+	parser.addOption (record_option);
+	QCommandLineOption lead_option (
+	    QStringList () << "lead",
+	    tr ("Stream the presentation screen to follower instances connecting on a TCP port"),
+	    tr ("port"));
+	parser.addOption (lead_option);
+	QCommandLineOption lead_address_option (
+	    QStringList () << "lead-address",
+	    tr ("Network interface address the leader listens on (default 127.0.0.1, any for all)"),
+	    tr ("address"));
+	parser.addOption (lead_address_option);
+	QCommandLineOption follow_option (
+	    QStringList () << "follow",
+	    tr ("Show the presentation screen streamed by a leader instance (no document needed)"),
+	    tr ("host:port"));
+	parser.addOption (follow_option);
+	QCommandLineOption benchmark_option (
+	    QStringList () << "benchmark",
+	    tr ("Run a benchmark on the document and exit (%1)").arg (list_of_benchmark_names ().join (',')),
+	    tr ("name"));
+	parser.addOption (benchmark_option);
 	parser.process (app);
 
+	if (parser.isSet (follow_option)) {
+		return Streaming::run_follower (parser.value (follow_option));
+	}
+
 	auto arguments = parser.positionalArguments ();
 	if (arguments.size () != 1) {
 		parser.showHelp (EXIT_FAILURE);
@@ -105,9 +195,14 @@ int main (int argc, char * argv[]) {
 	}
 	QString filename = arguments[0];
 
-	if (parser.isSet (render_cache_size_option)) {
+	if (parser.isSet (benchmark_option)) {
+		return run_benchmark (parser.value (benchmark_option), filename);
+	}
+
+	if (parser.isSet (render_cache_size_option) &&
+	    parser.value (render_cache_size_option).trimmed () != "auto") {
 		auto size_str = parser.value (render_cache_size_option);
-		int size = string_to_size_in_bytes (size_str);
+		auto size = string_to_size_in_bytes (size_str);
 		if (size >= 0) {
 			render_cache_size = size;
 		} else {
@@ -134,25 +229,113 @@ int main (int argc, char * argv[]) {
 		}
 	}
 
-	auto document = Document::open (filename, pdfpc_filename);
-	if (!document) {
+	auto cache_policy = Render::CachePolicy::Distance;
+	if (parser.isSet (cache_policy_option)) {
+		auto name = parser.value (cache_policy_option);
+		if (!Render::select_cache_policy_by_name (name, cache_policy)) {
+			QTextStream (stderr)
+			    << tr ("Warning: cache policy \"%1\" not found, falling back to distance\n").arg (name);
+		}
+	}
+
+	auto render_backend = RenderBackend::Splash;
+	if (parser.isSet (backend_option)) {
+		auto name = parser.value (backend_option);
+		if (!select_render_backend_by_name (name, render_backend)) {
+			QTextStream (stderr)
+			    << tr ("Warning: render backend \"%1\" not found, falling back to splash\n").arg (name);
+		}
+	}
+
+	DocumentLoader loader (filename, pdfpc_filename, parser.isSet (watch_option), render_backend);
+	bool loaded = parser.isSet (progressive_option) ? loader.load_progressively () : loader.load ();
+	if (!loaded) {
 		return EXIT_FAILURE;
 	}
+	QObject::connect (&loader, &DocumentLoader::loading_failed,
+	                  []() { QApplication::exit (EXIT_FAILURE); });
+
+	Controller control (*loader.document ());
+
+	/* Automatic render cache size.
+	 * Views of one page cover about all screens (public view, presenter views).
+	 * If there is only one screen, both windows share it: count it twice.
+	 */
+	std::unique_ptr<MemoryPressureMonitor> memory_monitor;
+	if (render_cache_size < 0) {
+		qint64 screens_pixels = 0;
+		qint64 largest_screen_pixels = 0;
+		for (const auto * screen : QGuiApplication::screens ()) {
+			const auto size = screen->size () * screen->devicePixelRatio ();
+			const auto pixels = static_cast<qint64> (size.width ()) * size.height ();
+			screens_pixels += pixels;
+			largest_screen_pixels = std::max (largest_screen_pixels, pixels);
+		}
+		memory_monitor = make_unique<MemoryPressureMonitor> (
+		    std::max (screens_pixels, 2 * largest_screen_pixels), loader.document ()->nb_pages ());
+		render_cache_size = memory_monitor->budget ();
+	}
+	auto poppler_backend = std::make_shared<Render::PopplerBackend> ();
+	Render::System renderer (render_cache_size, prefetch_strategy, poppler_backend);
+	renderer.set_cache_policy (cache_policy);
+	if (memory_monitor) {
+		QObject::connect (memory_monitor.get (), &MemoryPressureMonitor::cache_budget_changed,
+		                  &renderer, &Render::System::set_cache_size);
+		QObject::connect (&control, &Controller::document_changed, memory_monitor.get (),
+		                  &MemoryPressureMonitor::change_document);
+	}
+
+	// Laser and ink, drawn in the presenter current page, mirrored on the presentation screen
+	Overlay overlay;
 
-	Controller control (*document);
-	Render::System renderer (render_cache_size, prefetch_strategy);
+	/* Document replacement.
+	 * The render cache must be updated before the controller triggers new render requests.
+	 * The overlay must move its ink before the controller gives the new current page.
+	 * Old documents are released later, when no render is using them anymore.
+	 */
+	QObject::connect (&loader, &DocumentLoader::document_changed, &renderer,
+	                  &Render::System::change_document);
+	QObject::connect (&loader, &DocumentLoader::document_changed, &overlay,
+	                  &Overlay::change_document);
+	QObject::connect (&loader, &DocumentLoader::document_changed, &control,
+	                  &Controller::set_document);
+	QObject::connect (&renderer, &Render::System::all_renders_finished, &loader,
+	                  &DocumentLoader::release_retired_documents, Qt::QueuedConnection);
 
 	// Setup windows
 	auto presentation_view = new PresentationView;
-	auto presenter_view = new PresenterView (document->nb_slides ());
+	auto presenter_view = new PresenterView;
+	if (parser.isSet (no_transitions_option))
+		presentation_view->set_transitions_enabled (false);
 	add_shortcuts_to_widget (control, presentation_view);
 	add_shortcuts_to_widget (control, presenter_view);
+	presenter_view->slide_overview ()->set_render_backend (poppler_backend);
+
+	// Overlay: tool shortcuts in both windows, current page from the controller
+	add_overlay_shortcuts_to_widget (overlay, presentation_view);
+	add_overlay_shortcuts_to_widget (overlay, presenter_view);
+	presentation_view->set_overlay (&overlay, false);
+	presenter_view->current_page_viewer ()->set_overlay (&overlay, true);
+	QObject::connect (&control, &Controller::current_page_changed, &overlay,
+	                  &Overlay::change_current_page);
 
 	// Link non slide widgets to controller.
+	QObject::connect (&control, &Controller::document_changed, presenter_view,
+	                  &PresenterView::change_document);
 	QObject::connect (&control, &Controller::current_page_changed, presenter_view,
 	                  &PresenterView::change_slide_info);
 	QObject::connect (&control, &Controller::time_changed, presenter_view,
 	                  &PresenterView::change_time);
+	QObject::connect (presenter_view->slide_overview (), &SlideOverview::page_activated, &control,
+	                  &Controller::go_to_page_index);
+	QObject::connect (presenter_view->go_to_prompt (), &GoToPrompt::page_activated, &control,
+	                  &Controller::go_to_page_index);
+	QObject::connect (presenter_view->go_to_prompt (), &GoToPrompt::candidate_changed, &renderer,
+	                  &Render::System::prefetch_current_page);
+	QObject::connect (presenter_view->search_prompt (), &SearchPrompt::page_activated, &control,
+	                  &Controller::go_to_page_index);
+	QObject::connect (presenter_view->search_prompt (), &SearchPrompt::candidate_changed, &renderer,
+	                  &Render::System::prefetch_current_page);
 
 	// Link slide viewers to controller, actions, caching system
 	auto viewers =
@@ -161,6 +344,9 @@ int main (int argc, char * argv[]) {
 	                                        presenter_view->next_transition_page_viewer (),
 	                                        presenter_view->previous_transition_page_viewer ()};
 	for (auto v : viewers) {
+		if (parser.isSet (quality_previews_option))
+			v->set_render_profile (Render::Profile::Quality);
+
 		QObject::connect (&control, &Controller::current_page_changed, v,
 		                  &PageViewer::change_current_page);
 
@@ -168,6 +354,51 @@ int main (int argc, char * argv[]) {
 
 		QObject::connect (v, &PageViewer::request_render, &renderer, &Render::System::request_render);
 		QObject::connect (&renderer, &Render::System::new_render, v, &PageViewer::receive_pixmap);
+		QObject::connect (v, &PageViewer::render_shown, &renderer, &Render::System::set_shown_render);
+	}
+
+	// Control socket
+	std::unique_ptr<RemoteControl> remote_control;
+	if (parser.isSet (control_option)) {
+		remote_control = make_unique<RemoteControl> (control);
+		if (!remote_control->listen (parser.value (control_option)))
+			return EXIT_FAILURE;
+	}
+
+	// Recording of the public view
+	std::unique_ptr<FrameSink> frame_sink;
+	if (parser.isSet (record_option)) {
+		frame_sink = make_unique<FrameSink> (parser.value (record_option));
+		QObject::connect (presentation_view, &PageViewer::pixmap_shown, frame_sink.get (),
+		                  &FrameSink::push_frame);
+	}
+
+	// Streaming of the public view to followers
+	std::unique_ptr<Streaming::Leader> stream_leader;
+	if (parser.isSet (lead_option)) {
+		bool port_ok = false;
+		auto port = parser.value (lead_option).toUShort (&port_ok);
+		if (!port_ok) {
+			QTextStream (stderr) << tr ("Error: invalid port \"%1\"\n").arg (parser.value (lead_option));
+			return EXIT_FAILURE;
+		}
+		QHostAddress address (QHostAddress::LocalHost);
+		if (parser.isSet (lead_address_option)) {
+			auto name = parser.value (lead_address_option);
+			if (name == "any") {
+				address = QHostAddress::Any;
+			} else if (!address.setAddress (name)) {
+				QTextStream (stderr) << tr ("Error: invalid address \"%1\"\n").arg (name);
+				return EXIT_FAILURE;
+			}
+		}
+		stream_leader = make_unique<Streaming::Leader> (renderer);
+		if (!stream_leader->listen (port, address))
+			return EXIT_FAILURE;
+		QObject::connect (presentation_view, &PageViewer::pixmap_shown, stream_leader.get (),
+		                  &Streaming::Leader::show_render);
+		QObject::connect (&control, &Controller::document_changed, stream_leader.get (),
+		                  &Streaming::Leader::change_document);
 	}
 
 	// Setup window swapping system
@@ -175,5 +406,10 @@ int main (int argc, char * argv[]) {
 
 	// Init system
 	QTimer::singleShot (0, &control, SLOT (reset ()));
-	return app.exec ();
+	auto exit_code = app.exec ();
+
+	if (parser.isSet (timing_log_option)) {
+		control.write_timing_log (parser.value (timing_log_option));
+	}
+	return exit_code;
 }
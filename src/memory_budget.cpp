@@ -0,0 +1,187 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+#include <QtDebug>
+
+#include "document.h"
+#include "memory_budget.h"
+#include "render.h"
+
+namespace {
+constexpr qint64 minimum_budget = 10 * (1 << 20);   // Previous fixed default
+constexpr qint64 unknown_memory_budget = 1LL << 30; // Bound if available memory is unknown
+constexpr qint64 available_memory_fraction = 4;     // Budget <= available / fraction
+constexpr qint64 bytes_per_pixel = 4;               // ARGB32
+constexpr qint64 compression_ratio = 4;             // Estimation
+constexpr qint64 pressure_fraction = 10;            // Pressure if available < total / fraction
+constexpr qint64 relief_fraction = 5;               // Relief if available > total / fraction
+
+// Reads a single integer from a file (cgroup interface). Negative if absent or "max".
+qint64 read_integer_file (const QString & path) {
+	QFile file (path);
+	if (!file.open (QFile::ReadOnly | QFile::Text))
+		return -1;
+	bool ok = false;
+	auto value = file.readAll ().trimmed ().toLongLong (&ok);
+	return ok ? value : -1;
+}
+
+// Minimum of known values (negative is unknown)
+qint64 min_known (qint64 a, qint64 b) {
+	if (a < 0)
+		return b;
+	if (b < 0)
+		return a;
+	return std::min (a, b);
+}
+
+/* Path of the cgroup of the process in a hierarchy, from /proc/self/cgroup ("/" if not found).
+ * Lines are like "hierarchy-id:controllers:/path".
+ * The v2 hierarchy has id 0 and no controllers (empty controller), v1 ones list their controllers.
+ */
+QString own_cgroup_path (const QString & controller) {
+	QFile file ("/proc/self/cgroup");
+	if (file.open (QFile::ReadOnly | QFile::Text)) {
+		QTextStream stream (&file);
+		QString line;
+		while (!(line = stream.readLine ()).isNull ()) {
+			auto fields = line.split (':');
+			if (fields.size () < 3)
+				continue;
+			const bool in_hierarchy = controller.isEmpty ()
+			                              ? fields[0] == "0" && fields[1].isEmpty ()
+			                              : fields[1].split (',').contains (controller);
+			if (in_hierarchy)
+				return fields.mid (2).join (':'); // The path may contain ':'
+		}
+	}
+	return "/";
+}
+
+struct CgroupMemory {
+	qint64 limit{-1};
+	qint64 available{-1};
+};
+
+/* Smallest limit and remaining memory of the cgroup of the process and its ancestors.
+ * Files missing in a cgroup (root cgroup, path outside of our cgroup namespace) are skipped.
+ */
+CgroupMemory cgroup_memory (const QString & mount, const QString & controller,
+                            const QString & limit_file, const QString & usage_file) {
+	CgroupMemory memory;
+	auto directory = QDir::cleanPath (mount + '/' + own_cgroup_path (controller));
+	while (directory.startsWith (mount)) {
+		auto limit = read_integer_file (directory + '/' + limit_file);
+		auto usage = read_integer_file (directory + '/' + usage_file);
+		// cgroup v1 uses a huge value (near 2^63) for no limit
+		if (limit >= 0 && limit < (1LL << 62)) {
+			memory.limit = min_known (memory.limit, limit);
+			if (usage >= 0)
+				memory.available = min_known (memory.available, std::max<qint64> (0, limit - usage));
+		}
+		if (directory == mount)
+			break;
+		directory = directory.left (directory.lastIndexOf ('/'));
+	}
+	return memory;
+}
+} // namespace
+
+MemoryStatus read_memory_status () {
+	MemoryStatus status;
+	QFile meminfo ("/proc/meminfo");
+	if (meminfo.open (QFile::ReadOnly | QFile::Text)) {
+		// Lines are like "MemAvailable:    1234 kB"
+		QTextStream stream (&meminfo);
+		QString line;
+		while (!(line = stream.readLine ()).isNull ()) {
+			auto fields = line.simplified ().split (' ');
+			if (fields.size () < 2)
+				continue;
+			auto kib = fields[1].toLongLong ();
+			if (fields[0] == "MemTotal:")
+				status.total_bytes = kib * 1024;
+			else if (fields[0] == "MemAvailable:")
+				status.available_bytes = kib * 1024;
+		}
+	}
+	const auto cgroup_v2 =
+	    cgroup_memory ("/sys/fs/cgroup", QString (), "memory.max", "memory.current");
+	const auto cgroup_v1 = cgroup_memory ("/sys/fs/cgroup/memory", "memory", "memory.limit_in_bytes",
+	                                      "memory.usage_in_bytes");
+	status.available_bytes = min_known (status.available_bytes,
+	                                    min_known (cgroup_v2.available, cgroup_v1.available));
+	status.total_bytes = min_known (status.total_bytes, min_known (cgroup_v2.limit, cgroup_v1.limit));
+	return status;
+}
+
+qint64 automatic_cache_budget (qint64 view_pixels_per_page, int nb_pages,
+                               const MemoryStatus & status) {
+	const qint64 deck_bytes =
+	    view_pixels_per_page * bytes_per_pixel / compression_ratio * std::max (nb_pages, 1);
+	const qint64 memory_bound = status.available_bytes >= 0
+	                                ? status.available_bytes / available_memory_fraction
+	                                : unknown_memory_budget;
+	return std::max (minimum_budget, std::min (deck_bytes, memory_bound));
+}
+
+// MemoryPressureMonitor
+
+MemoryPressureMonitor::MemoryPressureMonitor (qint64 view_pixels_per_page, int nb_pages)
+    : view_pixels_per_page_ (view_pixels_per_page), nb_pages_ (nb_pages) {
+	target_budget_ = current_budget_ =
+	    automatic_cache_budget (view_pixels_per_page_, nb_pages_, read_memory_status ());
+	qDebug () << QString ("Render cache: automatic size %1").arg (size_in_bytes_to_string (target_budget_));
+	connect (&timer_, &QTimer::timeout, this, &MemoryPressureMonitor::check_memory);
+	timer_.start (check_interval_ms);
+}
+
+void MemoryPressureMonitor::change_document (const Document * new_document) {
+	if (new_document->nb_pages () == nb_pages_)
+		return;
+	nb_pages_ = new_document->nb_pages ();
+	// Our own cache usage is not available anymore: count the current budget as available
+	auto status = read_memory_status ();
+	if (status.available_bytes >= 0)
+		status.available_bytes += current_budget_;
+	target_budget_ = automatic_cache_budget (view_pixels_per_page_, nb_pages_, status);
+	set_budget (target_budget_);
+}
+
+void MemoryPressureMonitor::check_memory () {
+	auto status = read_memory_status ();
+	if (status.available_bytes < 0 || status.total_bytes <= 0)
+		return;
+	if (status.available_bytes < status.total_bytes / pressure_fraction) {
+		set_budget (std::max (minimum_budget, current_budget_ / 2));
+	} else if (status.available_bytes > status.total_bytes / relief_fraction &&
+	           current_budget_ < target_budget_) {
+		set_budget (std::min (target_budget_, current_budget_ * 2));
+	}
+}
+
+void MemoryPressureMonitor::set_budget (qint64 budget) {
+	if (budget != current_budget_) {
+		current_budget_ = budget;
+		emit cache_budget_changed (current_budget_);
+	}
+}
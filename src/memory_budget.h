@@ -0,0 +1,83 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <QObject>
+#include <QTimer>
+
+class Document;
+
+/* Memory status of the system, used to size the render cache automatically.
+ *
+ * Available memory is the minimum of:
+ * - MemAvailable from /proc/meminfo,
+ * - the remaining memory of the cgroup (v2: memory.max - memory.current, v1: limit - usage).
+ * The cgroup of the process is found in /proc/self/cgroup, and the limits of its ancestors apply.
+ * Values are negative if unknown (not on Linux, no limit).
+ */
+struct MemoryStatus {
+	qint64 total_bytes{-1};
+	qint64 available_bytes{-1};
+};
+MemoryStatus read_memory_status ();
+
+/* Automatic render cache budget.
+ *
+ * The cache is useful up to every page of the deck, rendered for all views.
+ * This is estimated from the number of pixels of all views for one page (about the screens area).
+ * Renders are ARGB32 (4 bytes per pixel), and compress well (ratio estimated at 1/4).
+ * The budget is bounded by a fraction of available memory, and has a small minimum.
+ */
+qint64 automatic_cache_budget (qint64 view_pixels_per_page, int nb_pages,
+                               const MemoryStatus & status);
+
+/* Periodically checks memory status, and adapts the render cache budget.
+ *
+ * The target budget is computed by automatic_cache_budget (updated on document change).
+ * Under memory pressure (little available memory), the budget is halved, down to a minimum.
+ * When pressure goes away, the budget grows back progressively to the target.
+ * Changes are signaled by cache_budget_changed.
+ */
+class MemoryPressureMonitor : public QObject {
+	Q_OBJECT
+
+private:
+	static constexpr int check_interval_ms = 2000;
+
+	const qint64 view_pixels_per_page_;
+	int nb_pages_;
+	qint64 target_budget_;
+	qint64 current_budget_;
+	QTimer timer_;
+
+public:
+	MemoryPressureMonitor (qint64 view_pixels_per_page, int nb_pages);
+
+	qint64 budget () const noexcept { return current_budget_; }
+
+signals:
+	void cache_budget_changed (qint64 new_budget_bytes);
+
+public slots:
+	void change_document (const Document * new_document);
+
+private slots:
+	void check_memory ();
+
+private:
+	void set_budget (qint64 budget);
+};
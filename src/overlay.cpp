@@ -0,0 +1,203 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QColor>
+#include <QKeySequence>
+#include <QPainter>
+#include <QPen>
+#include <QRadialGradient>
+#include <QShortcut>
+#include <QWidget>
+
+#include "document.h"
+#include "overlay.h"
+
+namespace {
+// Sizes relative to the page width
+constexpr qreal laser_radius = 0.008;
+constexpr qreal ink_width = 0.003;
+
+// Normalized rect around rect, with a margin relative to the page width
+QRectF area_around (const PageInfo * page, const QRectF & rect, qreal margin) {
+	const qreal ratio = page->height_for_width_ratio ();
+	const qreal margin_y = ratio > 0 ? margin / ratio : margin;
+	return rect.normalized ().adjusted (-margin, -margin_y, margin, margin_y);
+}
+QRectF laser_area (const PageInfo * page, const QPointF & position) {
+	return area_around (page, QRectF (position, position), laser_radius);
+}
+} // namespace
+
+Overlay::Overlay (QObject * parent) : QObject (parent) {}
+
+void Overlay::paint (QPainter & painter, const PageInfo * page, const QRectF & page_rect,
+                     const QRect & damaged) const {
+	if (page == nullptr || page_rect.isEmpty ())
+		return;
+	auto to_widget = [&page_rect](const QPointF & p) {
+		return QPointF (page_rect.x () + p.x () * page_rect.width (),
+		                page_rect.y () + p.y () * page_rect.height ());
+	};
+	painter.save ();
+	painter.setRenderHint (QPainter::Antialiasing);
+
+	auto it = ink_.find (page);
+	if (it != ink_.end ()) {
+		QPen pen (QColor (220, 20, 60));
+		pen.setWidthF (ink_width * page_rect.width ());
+		pen.setCapStyle (Qt::RoundCap);
+		pen.setJoinStyle (Qt::RoundJoin);
+		painter.setPen (pen);
+		QPolygonF points;
+		for (const auto & stroke : it.value ()) {
+			const QRectF stroke_rect (to_widget (stroke.area.topLeft ()),
+			                          to_widget (stroke.area.bottomRight ()));
+			if (!stroke_rect.intersects (damaged))
+				continue;
+			points.resize (0);
+			for (const auto & p : stroke.points)
+				points << to_widget (p);
+			if (points.size () == 1) {
+				painter.drawPoint (points.first ());
+			} else {
+				painter.drawPolyline (points);
+			}
+		}
+	}
+
+	if (laser_page_ == page) {
+		const auto center = to_widget (laser_position_);
+		const qreal radius = laser_radius * page_rect.width ();
+		QRadialGradient gradient (center, radius);
+		gradient.setColorAt (0, QColor (255, 0, 0, 230));
+		gradient.setColorAt (0.6, QColor (255, 0, 0, 160));
+		gradient.setColorAt (1, QColor (255, 0, 0, 0));
+		painter.setPen (Qt::NoPen);
+		painter.setBrush (gradient);
+		painter.drawEllipse (center, radius, radius);
+	}
+	painter.restore ();
+}
+
+void Overlay::toggle_laser () {
+	set_tool (tool_ == Tool::Laser ? Tool::None : Tool::Laser);
+}
+void Overlay::toggle_ink () {
+	set_tool (tool_ == Tool::Ink ? Tool::None : Tool::Ink);
+}
+void Overlay::clear_current_page_ink () {
+	auto it = ink_.find (current_page_);
+	if (it == ink_.end ())
+		return;
+	if (stroke_page_ == current_page_)
+		end_stroke ();
+	QRectF area;
+	for (const auto & stroke : it.value ())
+		area |= stroke.area;
+	ink_.erase (it);
+	emit changed (current_page_, area);
+}
+
+void Overlay::change_current_page (const PageInfo * new_current_page, RedrawCause) {
+	current_page_ = new_current_page;
+	if (laser_page_ != current_page_)
+		hide_laser ();
+	if (stroke_page_ != current_page_)
+		end_stroke ();
+}
+void Overlay::change_document (const Document * new_document, const Document * old_document) {
+	hide_laser ();
+	end_stroke ();
+	current_page_ = nullptr; // The controller then gives the current page of the new document
+	// Ink of changed pages may not match the new content anymore: drop it
+	const auto unchanged_pages = Document::unchanged_pages (*old_document, *new_document);
+	QHash<const PageInfo *, std::vector<Stroke>> kept_ink;
+	for (auto it = ink_.begin (); it != ink_.end (); ++it) {
+		auto new_page = unchanged_pages.find (it.key ());
+		if (new_page != unchanged_pages.end ())
+			kept_ink.insert (new_page.value (), std::move (it.value ()));
+	}
+	ink_ = std::move (kept_ink);
+}
+
+void Overlay::move_laser (const PageInfo * page, const QPointF & position) {
+	if (tool_ != Tool::Laser || page == nullptr)
+		return;
+	// Old and new dot areas are damaged separately: fast moves would make a large union
+	hide_laser ();
+	laser_page_ = page;
+	laser_position_ = position;
+	emit changed (page, laser_area (page, position));
+}
+void Overlay::hide_laser () {
+	if (laser_page_ != nullptr) {
+		auto page = laser_page_;
+		laser_page_ = nullptr;
+		emit changed (page, laser_area (page, laser_position_));
+	}
+}
+
+void Overlay::start_stroke (const PageInfo * page, const QPointF & position) {
+	if (tool_ != Tool::Ink || page == nullptr)
+		return;
+	end_stroke ();
+	Stroke stroke;
+	stroke.points << position;
+	stroke.area = area_around (page, QRectF (position, position), ink_width / 2);
+	ink_[page].push_back (stroke);
+	stroke_page_ = page;
+	emit changed (page, stroke.area);
+}
+void Overlay::extend_stroke (const QPointF & position) {
+	if (stroke_page_ == nullptr)
+		return;
+	auto & stroke = ink_[stroke_page_].back ();
+	const auto segment =
+	    area_around (stroke_page_, QRectF (stroke.points.last (), position), ink_width / 2);
+	stroke.points << position;
+	stroke.area |= segment;
+	emit changed (stroke_page_, segment);
+}
+void Overlay::end_stroke () {
+	stroke_page_ = nullptr;
+}
+
+void Overlay::set_tool (Tool tool) {
+	if (tool == tool_)
+		return;
+	hide_laser ();
+	end_stroke ();
+	tool_ = tool;
+	emit tool_changed (tool);
+}
+
+void add_overlay_shortcuts_to_widget (Overlay & overlay, QWidget * widget) {
+	{
+		auto sc = new QShortcut (QKeySequence (QObject::tr ("L", "laser_toggle key")), widget);
+		sc->setAutoRepeat (false);
+		QObject::connect (sc, &QShortcut::activated, &overlay, &Overlay::toggle_laser);
+	}
+	{
+		auto sc = new QShortcut (QKeySequence (QObject::tr ("I", "ink_toggle key")), widget);
+		sc->setAutoRepeat (false);
+		QObject::connect (sc, &QShortcut::activated, &overlay, &Overlay::toggle_ink);
+	}
+	{
+		auto sc = new QShortcut (QKeySequence (QObject::tr ("C", "ink_clear key")), widget);
+		sc->setAutoRepeat (false);
+		QObject::connect (sc, &QShortcut::activated, &overlay, &Overlay::clear_current_page_ink);
+	}
+}
@@ -0,0 +1,103 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <vector>
+
+#include <QHash>
+#include <QObject>
+#include <QPointF>
+#include <QPolygonF>
+#include <QRect>
+#include <QRectF>
+
+#include "controller.h"
+class Document;
+class PageInfo;
+class QPainter;
+class QWidget;
+
+/* Presenter annotations drawn over the pages: a laser pointer dot, and freehand ink.
+ *
+ * The overlay is a model shared by the viewers of the current page.
+ * The presenter draws with the mouse in its current page view, and the public view mirrors it.
+ * Positions use normalized [0,1]x[0,1] page coordinates (as links), so each view maps them to its
+ * own render size. Sizes (dot radius, pen width) are relative to the page width.
+ *
+ * Each change emits changed () with the damaged area of the page (normalized coordinates).
+ * Viewers showing this page only repaint this area, not the whole render.
+ *
+ * Ink is stored per page: it is shown again when coming back to the page, until cleared.
+ * The laser dot is hidden when the current page changes.
+ * Ink of pages unchanged by a document reload is kept (see Document::unchanged_pages).
+ * change_document must be called before the controller switches to the new document.
+ */
+class Overlay : public QObject {
+	Q_OBJECT
+
+public:
+	enum class Tool { None, Laser, Ink };
+
+private:
+	struct Stroke {
+		QPolygonF points; // Normalized coordinates
+		QRectF area;      // Normalized bounding rect, including the pen width
+	};
+
+	Tool tool_{Tool::None};
+	const PageInfo * current_page_{nullptr};
+	const PageInfo * laser_page_{nullptr}; // nullptr if the dot is hidden
+	QPointF laser_position_;
+	QHash<const PageInfo *, std::vector<Stroke>> ink_;
+	const PageInfo * stroke_page_{nullptr}; // Page of the stroke being drawn, nullptr if none
+
+public:
+	explicit Overlay (QObject * parent = nullptr);
+
+	Tool tool () const { return tool_; }
+
+	/* Paint the overlay of page, whose render is shown in page_rect (widget coordinates).
+	 * Only strokes intersecting the damaged rect are painted.
+	 */
+	void paint (QPainter & painter, const PageInfo * page, const QRectF & page_rect,
+	            const QRect & damaged) const;
+
+signals:
+	void tool_changed (Tool tool);
+	void changed (const PageInfo * page, const QRectF & area);
+
+public slots:
+	void toggle_laser ();
+	void toggle_ink ();
+	void clear_current_page_ink ();
+
+	void change_current_page (const PageInfo * new_current_page, RedrawCause cause);
+	void change_document (const Document * new_document, const Document * old_document);
+
+	// Mouse input from the presenter view, in normalized coordinates
+	void move_laser (const PageInfo * page, const QPointF & position);
+	void hide_laser ();
+	void start_stroke (const PageInfo * page, const QPointF & position);
+	void extend_stroke (const QPointF & position);
+	void end_stroke ();
+
+private:
+	void set_tool (Tool tool);
+};
+
+// Add overlay tool shortcuts (laser, ink, clear) to the widget
+void add_overlay_shortcuts_to_widget (Overlay & overlay, QWidget * widget);
@@ -14,6 +14,10 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <array>
+
+#include <QSize>
+
 #include "controller.h"
 #include "document.h"
 #include "render_internal.h"
@@ -21,8 +25,7 @@
 namespace Render {
 // Tools
 namespace {
-	void prefetch_next_n (const Request & context,
-	                      const std::function<void(const Info &)> & request_render, int n) {
+	void prefetch_next_n (const Request & context, const PrefetchRender & request_render, int n) {
 		auto * current_page = context.current_page ();
 		do {
 			--n;
@@ -30,12 +33,11 @@ namespace {
 
 			auto * render_page = page_for_role (current_page, context.role ());
 			if (render_page != nullptr) {
-				request_render (Info{render_page, context.box_size ()});
+				request_render (context.role (), context.render_of_page (render_page));
 			}
 		} while (n > 0 && current_page != nullptr);
 	}
-	void prefetch_previous_n (const Request & context,
-	                          const std::function<void(const Info &)> & request_render, int n) {
+	void prefetch_previous_n (const Request & context, const PrefetchRender & request_render, int n) {
 		auto * current_page = context.current_page ();
 		do {
 			--n;
@@ -43,7 +45,7 @@ namespace {
 
 			auto * render_page = page_for_role (current_page, context.role ());
 			if (render_page != nullptr) {
-				request_render (Info{render_page, context.box_size ()});
+				request_render (context.role (), context.render_of_page (render_page));
 			}
 		} while (n > 0 && current_page != nullptr);
 	}
@@ -53,19 +55,26 @@ namespace {
 class DisabledStrategy : public PrefetchStrategy {
 public:
 	DisabledStrategy () : PrefetchStrategy ("disabled") {}
-	void prefetch (const Request &, const std::function<void(const Info &)> &) final {}
+	void prefetch (const RequestBatch &, const ViewRequests &, const PrefetchRender &) final {}
 };
 
-/* Reasonnable prefetch:
+/* Neighbour prefetch:
  * Always prefetch the next/prev page for every action.
  * When moving, prefetch the 5 next pages in the direction of movement for current page role.
+ * This is done for each request of the batch, at the size of the requesting view.
  */
-class DefaultStrategy : public PrefetchStrategy {
+class NeighboursStrategy : public PrefetchStrategy {
 public:
-	DefaultStrategy () : PrefetchStrategy ("default") {}
+	NeighboursStrategy () : PrefetchStrategy ("neighbours") {}
+
+	void prefetch (const RequestBatch & batch, const ViewRequests &,
+	               const PrefetchRender & request_render) final {
+		for (const auto & context : batch)
+			prefetch_for_request (context, request_render);
+	}
 
-	void prefetch (const Request & context,
-	               const std::function<void(const Info &)> & request_render) final {
+private:
+	void prefetch_for_request (const Request & context, const PrefetchRender & request_render) {
 		bool has_directional_long_prefetch =
 		    context.role () == ViewRole::CurrentPublic || context.role () == ViewRole::CurrentPresenter;
 
@@ -82,6 +91,79 @@ public:
 	}
 };
 
+/* Role aware prefetch (default):
+ * Predicts what every view will show after the likely next moves.
+ *
+ * The size, profile and device pixel ratio of each view come from its last request (views).
+ * Views only request when needed, so these are up to date.
+ * Likely next moves depend on the last movement: the current direction is favored.
+ * For each future current page (in order of likelihood), every view is considered.
+ * The render this view would need is given by page_for_role, at the size of the view.
+ * Examples after a "next": NextSlide view needs the first page of the slide after the next one;
+ * PrevTransition view needs the current page.
+ */
+class RoleAwareStrategy : public PrefetchStrategy {
+private:
+	static constexpr int long_prefetch_depth = 3; // In the direction of movement
+
+public:
+	RoleAwareStrategy () : PrefetchStrategy ("default") {}
+
+	void prefetch (const RequestBatch & batch, const ViewRequests & views,
+	               const PrefetchRender & request_render) final {
+		if (batch.empty ())
+			return;
+		auto cause = RedrawCause::Resize;
+		for (const auto & request : batch) {
+			if (request.cause () != RedrawCause::Resize)
+				cause = request.cause ();
+		}
+		auto * current_page = batch.front ().current_page ();
+
+		// Future current pages, most likely first
+		auto * next = current_page->next_page ();
+		auto * previous = current_page->previous_page ();
+		if (cause == RedrawCause::BackwardMove) {
+			prefetch_all_views (previous, views, request_render);
+			prefetch_all_views (next, views, request_render);
+			prefetch_in_direction (previous, &PageInfo::previous_page, views, request_render);
+		} else if (cause == RedrawCause::ForwardMove) {
+			prefetch_all_views (next, views, request_render);
+			prefetch_all_views (previous, views, request_render);
+			prefetch_in_direction (next, &PageInfo::next_page, views, request_render);
+		} else {
+			prefetch_all_views (next, views, request_render);
+			prefetch_all_views (previous, views, request_render);
+		}
+	}
+
+private:
+	// Renders needed by all known views if future_page becomes current
+	static void prefetch_all_views (const PageInfo * future_page, const ViewRequests & views,
+	                                const PrefetchRender & request_render) {
+		if (future_page == nullptr)
+			return;
+		for (int role = 0; role < nb_view_roles; ++role) {
+			const auto & view = views[role];
+			auto * render_page = page_for_role (future_page, static_cast<ViewRole> (role));
+			if (!view.box_size ().isEmpty () && render_page != nullptr)
+				request_render (static_cast<ViewRole> (role), view.render_of_page (render_page));
+		}
+	}
+
+	// Continue after 'start' in one direction: 'start' has already been prefetched
+	static void prefetch_in_direction (const PageInfo * start,
+	                                   const PageInfo * (PageInfo::*step) () const noexcept,
+	                                   const ViewRequests & views,
+	                                   const PrefetchRender & request_render) {
+		auto * page = start;
+		for (int depth = 1; depth < long_prefetch_depth && page != nullptr; ++depth) {
+			page = (page->*step) ();
+			prefetch_all_views (page, views, request_render);
+		}
+	}
+};
+
 /* Listing and selection.
  *
  * PrefetchStrategy instances are created as global variables.
@@ -93,9 +175,10 @@ public:
  */
 namespace {
 	DisabledStrategy disabled;
-	DefaultStrategy defaulted;
+	NeighboursStrategy neighbours;
+	RoleAwareStrategy defaulted;
 
-	PrefetchStrategy * defined_strategies[] = {&disabled, &defaulted};
+	PrefetchStrategy * defined_strategies[] = {&disabled, &neighbours, &defaulted};
 } // namespace
 
 QStringList list_of_prefetch_strategy_names () {
@@ -0,0 +1,128 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+
+#include <QCoreApplication>
+#include <QLocalSocket>
+#include <QTextStream>
+#include <QtDebug>
+
+#include "document.h"
+#include "remote_control.h"
+
+namespace {
+const int stale_probe_timeout_ms = 100; // Local connections are immediate or refused
+
+struct NamedCommand {
+	const char * name;
+	void (Controller::*slot) ();
+};
+const NamedCommand simple_commands[] = {
+    {"next", &Controller::go_to_next_page},
+    {"previous", &Controller::go_to_previous_page},
+    {"first", &Controller::go_to_first_page},
+    {"last", &Controller::go_to_last_page},
+    {"timer-start", &Controller::timer_start},
+    {"timer-toggle-pause", &Controller::timer_toggle_pause},
+    {"timer-reset", &Controller::timer_reset},
+};
+} // namespace
+
+RemoteControl::RemoteControl (Controller & controller) : controller_ (controller) {
+	connect (&server_, &QLocalServer::newConnection, this, &RemoteControl::new_connection);
+	connect (&controller_, &Controller::current_page_changed, this,
+	         &RemoteControl::send_page_changed);
+	connect (&controller_, &Controller::time_changed, this, &RemoteControl::send_time_changed);
+}
+
+bool RemoteControl::listen (const QString & name) {
+	auto tr = [](const char * str) { return qApp->translate ("RemoteControl", str); };
+	// A socket accepting connections belongs to a running instance: do not steal it
+	{
+		QLocalSocket probe;
+		probe.connectToServer (name);
+		if (probe.waitForConnected (stale_probe_timeout_ms)) {
+			QTextStream (stderr) << tr ("Error: control socket \"%1\" is used by another instance\n")
+			                            .arg (name);
+			return false;
+		}
+	}
+	// Remove a socket left by a crashed instance
+	QLocalServer::removeServer (name);
+	// Commands control the presentation: only the current user may connect
+	server_.setSocketOptions (QLocalServer::UserAccessOption);
+	if (!server_.listen (name)) {
+		QTextStream (stderr) << tr ("Error: unable to listen on control socket \"%1\": %2\n")
+		                            .arg (name, server_.errorString ());
+		return false;
+	}
+	qDebug () << "Control socket:" << server_.fullServerName ();
+	return true;
+}
+
+void RemoteControl::new_connection () {
+	while (auto * client = server_.nextPendingConnection ()) {
+		// Clients are children of the server, deleted when disconnected
+		connect (client, &QLocalSocket::readyRead, this, [this, client]() { read_commands (client); });
+		connect (client, &QLocalSocket::disconnected, client, &QLocalSocket::deleteLater);
+		read_commands (client); // Commands sent before the connection was accepted
+	}
+}
+
+void RemoteControl::send_page_changed (const PageInfo * new_current_page) {
+	broadcast (QByteArray ("page ") + QByteArray::number (new_current_page->index () + 1) + ' ' +
+	           QByteArray::number (new_current_page->slide ()->index () + 1));
+}
+void RemoteControl::send_time_changed (bool paused, const QString & time_text) {
+	broadcast (QByteArray ("time ") + (paused ? '1' : '0') + ' ' + time_text.toUtf8 ());
+}
+
+void RemoteControl::read_commands (QLocalSocket * client) {
+	while (client->canReadLine ()) {
+		execute_command (client, client->readLine ().trimmed ());
+	}
+}
+
+void RemoteControl::execute_command (QLocalSocket * client, const QByteArray & command) {
+	if (command.isEmpty ())
+		return;
+	for (const auto & c : simple_commands) {
+		if (command == c.name) {
+			(controller_.*c.slot) ();
+			return;
+		}
+	}
+	if (command.startsWith ("goto ")) {
+		bool ok = false;
+		auto page_number = command.mid (5).trimmed ().toInt (&ok);
+		if (ok) {
+			controller_.go_to_page_index (page_number - 1); // No effect if out of bounds
+			return;
+		}
+	}
+	client->write ("error unknown command\n");
+	client->flush ();
+}
+
+void RemoteControl::broadcast (const QByteArray & line) {
+	for (auto * client : server_.findChildren<QLocalSocket *> ()) {
+		if (client->state () == QLocalSocket::ConnectedState) {
+			client->write (line + '\n');
+			client->flush ();
+		}
+	}
+}
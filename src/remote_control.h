@@ -0,0 +1,67 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <QByteArray>
+#include <QLocalServer>
+#include <QObject>
+#include <QString>
+
+#include "controller.h"
+class QLocalSocket;
+
+/* Local control socket (Unix domain socket, named pipe on Windows).
+ * Lets external programs (clicker bridges, scripts) control the presentation.
+ *
+ * The protocol is text based, one command or event per line ('\n' terminated).
+ * Commands (client to pdftalk):
+ * - "next", "previous", "first", "last": page navigation,
+ * - "goto <n>": go to page n (counting from 1, like the page labels of most documents),
+ * - "timer-start", "timer-toggle-pause", "timer-reset": timer control.
+ * Invalid commands are answered with "error <reason>".
+ * Events (pdftalk to all clients):
+ * - "page <page> <slide>" when the current page changes (counting from 1),
+ * - "time <paused> <time>" at each timer update (paused is 0 or 1).
+ *
+ * Commands are executed as soon as they are read, and events are flushed immediately.
+ */
+class RemoteControl : public QObject {
+	Q_OBJECT
+
+private:
+	Controller & controller_;
+	QLocalServer server_;
+
+public:
+	explicit RemoteControl (Controller & controller);
+
+	/* Listen on the given socket name (or path), for the current user only.
+	 * A stale socket left by a crashed instance is replaced; fails if another instance listens.
+	 * Returns false on error.
+	 */
+	bool listen (const QString & name);
+
+private slots:
+	void new_connection ();
+	void send_page_changed (const PageInfo * new_current_page);
+	void send_time_changed (bool paused, const QString & time_text);
+
+private:
+	void read_commands (QLocalSocket * client);
+	void execute_command (QLocalSocket * client, const QByteArray & command);
+	void broadcast (const QByteArray & line);
+};
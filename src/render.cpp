@@ -14,20 +14,32 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <vector>
+
 #include <QCoreApplication>
+#include <QElapsedTimer>
 #include <QHash>
 #include <QLocale>
 #include <QMetaType>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QThreadPool>
+#include <QTimer>
 #include <QtDebug>
 
 #include "document.h"
 #include "render.h"
+#include "render_backend.h"
 #include "render_internal.h"
 
 // Byte size conversion
 
-QString size_in_bytes_to_string (int size) {
+QString size_in_bytes_to_string (qint64 size) {
 	qreal num = size;
 	qreal increment = 1024.0;
 	static const char * suffixes[] = {QT_TR_NOOP ("B"),
@@ -45,20 +57,22 @@ QString size_in_bytes_to_string (int size) {
 	return QLocale ().toString (num, 'f', 2) +
 	       qApp->translate ("byte_size_conversion", suffixes[unit_idx]);
 }
-int string_to_size_in_bytes (QString size_str) {
-	int factor = 1;
+qint64 string_to_size_in_bytes (QString size_str) {
+	qint64 factor = 1;
 
 	// Remove suffix if present. Order in the array is important, first match wins.
 	struct SuffixWithFactor {
 		const char * suffix;
-		int factor;
+		qint64 factor;
 	};
 	static const SuffixWithFactor suffixes[] = {
-	    {QT_TR_NOOP ("G"), 1000000000}, {QT_TR_NOOP ("GB"), 1000000000},
-	    {QT_TR_NOOP ("GiB"), 1 << 30},  {QT_TR_NOOP ("M"), 1000000},
-	    {QT_TR_NOOP ("MB"), 1000000},   {QT_TR_NOOP ("MiB"), 1 << 20},
-	    {QT_TR_NOOP ("K"), 1000},       {QT_TR_NOOP ("KB"), 1000},
-	    {QT_TR_NOOP ("KiB"), 1 << 10},  {QT_TR_NOOP ("B"), 1},
+	    {QT_TR_NOOP ("T"), 1000000000000}, {QT_TR_NOOP ("TB"), 1000000000000},
+	    {QT_TR_NOOP ("TiB"), 1LL << 40},   {QT_TR_NOOP ("G"), 1000000000},
+	    {QT_TR_NOOP ("GB"), 1000000000},   {QT_TR_NOOP ("GiB"), 1 << 30},
+	    {QT_TR_NOOP ("M"), 1000000},       {QT_TR_NOOP ("MB"), 1000000},
+	    {QT_TR_NOOP ("MiB"), 1 << 20},     {QT_TR_NOOP ("K"), 1000},
+	    {QT_TR_NOOP ("KB"), 1000},         {QT_TR_NOOP ("KiB"), 1 << 10},
+	    {QT_TR_NOOP ("B"), 1},
 	};
 	for (const auto & s : suffixes) {
 		auto suffix = qApp->translate ("byte_size_conversion", s.suffix);
@@ -72,23 +86,63 @@ int string_to_size_in_bytes (QString size_str) {
 	// Parse value (fails if there is anything but the number)
 	bool ok;
 	auto raw_value = QLocale ().toDouble (size_str, &ok);
-	if (ok) {
-		return static_cast<int> (raw_value * factor);
+	if (ok && raw_value >= 0) {
+		return static_cast<qint64> (raw_value * factor);
 	} else {
 		return -1;
 	}
 }
 
 namespace Render {
+// Render Profile
+
+QDebug operator<< (QDebug d, Profile profile) {
+	switch (profile) {
+	case Profile::Quality:
+		d << "Quality";
+		break;
+	case Profile::Fast:
+		d << "Fast";
+		break;
+	case Profile::Draft:
+		d << "Draft";
+		break;
+	}
+	return d;
+}
+
+Profile default_profile_for_role (ViewRole role) {
+	switch (role) {
+	case ViewRole::NextSlide:
+		return Profile::Fast;
+	case ViewRole::NextTransition:
+	case ViewRole::PrevTransition:
+		return Profile::Draft;
+	default:
+		return Profile::Quality;
+	}
+}
+
+const RenderSettings & settings_for_profile (Profile profile) {
+	static const RenderSettings settings[nb_profiles] = {
+	    {RenderHints::Antialiased, false, 0.}, // Quality
+	    {RenderHints::Aliased, false, 0.},     // Fast
+	    {RenderHints::Aliased, true, 72.},     // Draft
+	};
+	return settings[static_cast<int> (profile)];
+}
+
 // Render Info
 
-Info::Info (const PageInfo * p, const QSize & box) : page_ (p) {
+Info::Info (const PageInfo * p, const QSize & box, Profile profile, qreal device_pixel_ratio)
+    : page_ (p), profile_ (profile), device_pixel_ratio_ (device_pixel_ratio) {
 	if (p != nullptr)
 		size_ = p->render_size (box);
 }
 
 bool operator== (const Info & a, const Info & b) {
-	return a.page () == b.page () && a.size () == b.size ();
+	return a.page () == b.page () && a.size () == b.size () && a.profile () == b.profile () &&
+	       a.device_pixel_ratio () == b.device_pixel_ratio ();
 }
 bool operator!= (const Info & a, const Info & b) {
 	return !(a == b);
@@ -96,12 +150,15 @@ bool operator!= (const Info & a, const Info & b) {
 uint qHash (const Info & info, uint seed) {
 	using ::qHash; // Have access to Qt's basic qHash
 	return qHash (info.page (), seed) ^ qHash (info.size ().width (), seed) ^
-	       qHash (info.size ().height (), seed);
+	       qHash (info.size ().height (), seed) ^ qHash (static_cast<int> (info.profile ()), seed) ^
+	       qHash (info.device_pixel_ratio (), seed);
 }
 
 QDebug operator<< (QDebug d, const Info & render_info) {
 	if (!render_info.isNull ()) {
-		d << render_info.page () << render_info.size ();
+		d << render_info.page () << render_info.size () << render_info.profile ();
+		if (render_info.device_pixel_ratio () != 1.)
+			d << "dpr" << render_info.device_pixel_ratio ();
 	} else {
 		d << "Render::Info()";
 	}
@@ -111,24 +168,133 @@ QDebug operator<< (QDebug d, const Info & render_info) {
 // Render Request
 
 Request::Request (const PageInfo * current_page, const QSize & box, ViewRole role,
-                  RedrawCause cause)
-    : current_page_ (current_page), box_size_ (box), role_ (role), cause_ (cause) {
+                  RedrawCause cause, Profile profile, qreal device_pixel_ratio)
+    : current_page_ (current_page),
+      box_size_ (box * device_pixel_ratio),
+      role_ (role),
+      cause_ (cause),
+      profile_ (profile),
+      device_pixel_ratio_ (device_pixel_ratio) {
 	Q_ASSERT (role != ViewRole::Unknown);
 	Q_ASSERT (cause != RedrawCause::Unknown);
 }
 
+// Cache cost
+
+int cache_cost (const Compressed & compressed) {
+	return cache_cost_from_bytes (compressed.data.allocated_bytes ());
+}
+int cache_cost_from_bytes (qint64 bytes) {
+	auto cost = (bytes + cache_cost_unit - 1) / cache_cost_unit;
+	return static_cast<int> (std::min<qint64> (cost, std::numeric_limits<int>::max ()));
+}
+
+// Compressed data storage
+
+SlabAllocator & compressed_render_allocator () {
+	// Leaked: compressed renders of static objects may be freed during static destruction
+	static auto * allocator = new SlabAllocator;
+	return *allocator;
+}
+
+struct CompressedData::Block {
+	SlabAllocator::Block block;
+	int size;
+
+	Block (const QByteArray & bytes)
+	    : block (compressed_render_allocator ().allocate (bytes.size ())), size (bytes.size ()) {
+		if (block.data == nullptr)
+			throw std::bad_alloc ();
+		std::memcpy (block.data, bytes.constData (), static_cast<std::size_t> (size));
+	}
+	~Block () { compressed_render_allocator ().deallocate (block); }
+	Block (const Block &) = delete;
+	Block & operator= (const Block &) = delete;
+};
+
+CompressedData::CompressedData (const QByteArray & compressed_bytes)
+    : block_ (std::make_shared<const Block> (compressed_bytes)) {}
+
+int CompressedData::size () const noexcept {
+	return block_ ? block_->size : 0;
+}
+qint64 CompressedData::allocated_bytes () const noexcept {
+	return block_ ? block_->block.capacity : 0;
+}
+QByteArray CompressedData::bytes () const {
+	if (!block_)
+		return {};
+	return QByteArray::fromRawData (block_->block.data, block_->size);
+}
+
 // PrefetchStrategy
 
 PrefetchStrategy::PrefetchStrategy (const QString & name) : name_ (name) {}
 
 // Rendering, Compressing / Uncompressing primitives
 
-std::pair<Compressed *, QPixmap> make_render (const Info & render_info) {
+Compressed * make_compressed_render (const QImage & image) {
+	// Compressed in a temporary, then stored in an allocator block of the compressed size
+	CompressedData compressed_data (qCompress (image.constBits (), image.byteCount ()));
+	return new Compressed{compressed_data, image.size (), image.bytesPerLine (), image.format ()};
+}
+namespace {
+	// Idle render buffers, most recently used last. Leaked, like the allocator.
+	struct RenderBuffers {
+		QMutex mutex;
+		std::vector<QImage> idle;
+	};
+	RenderBuffers & render_buffers () {
+		static auto * buffers = new RenderBuffers;
+		return *buffers;
+	}
+	constexpr qint64 max_idle_render_buffer_bytes = 64 << 20; // Two 4K ARGB32 buffers
+
+	// Idle buffer of this size if any, or a null image
+	QImage take_render_buffer (const QSize & size) {
+		auto & buffers = render_buffers ();
+		QMutexLocker lock (&buffers.mutex);
+		auto it = std::find_if (buffers.idle.rbegin (), buffers.idle.rend (),
+		                        [&size](const QImage & buffer) { return buffer.size () == size; });
+		if (it == buffers.idle.rend ())
+			return {};
+		QImage buffer = std::move (*it);
+		buffers.idle.erase (std::next (it).base ());
+		return buffer;
+	}
+	// Keeps the buffer for later renders, releasing the oldest ones above the limit
+	void give_back_render_buffer (QImage buffer) {
+		if (buffer.isNull ())
+			return;
+		auto & buffers = render_buffers ();
+		QMutexLocker lock (&buffers.mutex);
+		buffers.idle.push_back (std::move (buffer));
+		qint64 bytes = 0;
+		auto it = buffers.idle.end ();
+		while (it != buffers.idle.begin ()) {
+			--it;
+			bytes += it->byteCount ();
+			if (bytes > max_idle_render_buffer_bytes) {
+				buffers.idle.erase (buffers.idle.begin (), it + 1);
+				break;
+			}
+		}
+	}
+} // namespace
+
+std::pair<Compressed *, QPixmap> make_render (const Backend & backend, const Info & render_info,
+                                              bool with_pixmap) {
 	// Renders, and returns both the pixmap and the compressed image
-	QImage image = render_info.page ()->render (render_info.size ());
-	auto compressed_data = qCompress (image.bits (), image.byteCount ());
-	auto * compressed_render =
-	    new Compressed{compressed_data, image.size (), image.bytesPerLine (), image.format ()};
+	QImage buffer = take_render_buffer (render_info.size ());
+	QImage image = backend.render (render_info, buffer);
+	auto * compressed_render = make_compressed_render (image);
+	if (!with_pixmap) {
+		image = QImage (); // Not shared anymore: the buffer is not detached by its next render
+		give_back_render_buffer (std::move (buffer));
+		return {compressed_render, QPixmap ()};
+	}
+	// If the image is the buffer, it becomes the pixmap: the buffer is not reused
+	buffer = QImage ();
 	return {compressed_render, QPixmap::fromImage (std::move (image))};
 }
 
@@ -139,7 +305,7 @@ QPixmap make_pixmap_from_compressed_render (const Compressed & render) {
 	// Recreate an image and then a pixmap from compressed data
 	// Try to avoid any useless copy by using the non-owning QImage constructor
 	auto * uncompressed_data = new QByteArray;
-	*uncompressed_data = qUncompress (render.data);
+	*uncompressed_data = qUncompress (render.data.bytes ()); // bytes () does not copy
 	QImage image (reinterpret_cast<uchar *> (uncompressed_data->data ()), render.size.width (),
 	              render.size.height (), render.bytes_per_line, render.image_format,
 	              &qbytearray_deleter, uncompressed_data);
@@ -148,50 +314,282 @@ QPixmap make_pixmap_from_compressed_render (const Compressed & render) {
 
 // System impl
 
-System::System (int cache_size_bytes, PrefetchStrategy * strategy)
-    : d_ (new SystemPrivate (cache_size_bytes, strategy, this)) {}
+System::System (qint64 cache_size_bytes, PrefetchStrategy * strategy,
+                std::shared_ptr<const Backend> backend)
+    : d_ (new SystemPrivate (cache_size_bytes, strategy, std::move (backend), this)) {}
 
+bool System::find_cached_render (const Info & render_info, Compressed & compressed) const {
+	const auto * cached = d_->find_cached_render (render_info);
+	if (cached == nullptr)
+		return false;
+	compressed = *cached; // Data is shared, not copied
+	return true;
+}
 void System::request_render (const Request & request) {
 	d_->request_render (request);
 }
+void System::prefetch_current_page (const PageInfo * future_current_page) {
+	d_->prefetch_current_page (future_current_page);
+}
+void System::change_document (const Document * new_document, const Document * old_document) {
+	d_->change_document (Document::unchanged_pages (*old_document, *new_document));
+}
+void System::set_cache_size (qint64 cache_size_bytes) {
+	d_->set_cache_size (cache_size_bytes);
+}
+CacheStatistics System::cache_statistics () const {
+	return d_->cache_statistics ();
+}
+void System::set_cache_policy (CachePolicy policy) {
+	d_->set_cache_policy (policy);
+}
+void System::set_shown_render (ViewRole role, const Info & render_info) {
+	d_->set_shown_render (role, render_info);
+}
 
-SystemPrivate::SystemPrivate (int cache_size_bytes, PrefetchStrategy * strategy, System * parent)
+SystemPrivate::SystemPrivate (qint64 cache_size_bytes, PrefetchStrategy * strategy,
+                              std::shared_ptr<const Backend> backend, System * parent)
     : QObject (parent),
       parent_ (parent),
-      cache_ (cache_size_bytes),
+      backend_ (std::move (backend)),
+      cache_ (cache_cost_from_bytes (cache_size_bytes), view_requests_),
       prefetch_strategy_ (strategy),
-      prefetch_render_lambda_ ([this](const Info & render_info) {
+      prefetch_render_lambda_ ([this](ViewRole role, const Info & render_info) {
+	      if (batch_renders_.contains (render_info)) {
+		      ++stats_.duplicate_prefetches;
+		      return;
+	      }
+	      batch_renders_.insert (render_info);
+	      ++stats_.prefetch_renders;
 	      qDebug () << "prefetch   " << render_info;
-	      this->perform_render (render_info, RenderType::Prefetch);
+	      this->perform_render (render_info, role, RenderType::Prefetch);
       }) {}
 
 SystemPrivate::~SystemPrivate () {
 	qDebug () << QString ("Render cache: used %1 out of %2")
-	                 .arg (size_in_bytes_to_string (cache_.totalCost ()),
-	                       size_in_bytes_to_string (cache_.maxCost ()));
+	                 .arg (size_in_bytes_to_string (cache_.total_cost () * cache_cost_unit),
+	                       size_in_bytes_to_string (cache_.max_cost () * cache_cost_unit));
+	const auto & cache_stats = cache_.statistics ();
+	qDebug () << QString ("Render cache evictions: %1 capacity, %2 shrink, %3 document, %4 "
+	                      "rejected; made again: %5 requested, %6 prefetch")
+	                 .arg (cache_stats.capacity_evictions)
+	                 .arg (cache_stats.shrink_evictions)
+	                 .arg (cache_stats.document_evictions)
+	                 .arg (cache_stats.rejected_renders)
+	                 .arg (cache_stats.requested_after_eviction)
+	                 .arg (cache_stats.prefetched_after_eviction);
+	const auto memory = compressed_render_allocator ().statistics ();
+	qDebug () << QString ("Render memory: %1 in use, %2 reserved (peak %3), %4 slabs allocated, %5 "
+	                      "released, %6 lone blocks")
+	                 .arg (size_in_bytes_to_string (memory.bytes_in_use),
+	                       size_in_bytes_to_string (memory.bytes_reserved),
+	                       size_in_bytes_to_string (memory.peak_bytes_reserved))
+	                 .arg (memory.slabs_allocated)
+	                 .arg (memory.slabs_released)
+	                 .arg (memory.lone_blocks);
+	qDebug () << QString ("Render batches: %1 batches, %2 requests (%3 outdated, %4 duplicates)")
+	                 .arg (stats_.batches)
+	                 .arg (stats_.requests)
+	                 .arg (stats_.outdated_requests)
+	                 .arg (stats_.duplicate_requests);
+	qDebug () << QString ("Render prefetch: %1 plans, %2 renders, %3 duplicates skipped, %4 "
+	                      "speculative")
+	                 .arg (stats_.prefetch_plans)
+	                 .arg (stats_.prefetch_renders)
+	                 .arg (stats_.duplicate_prefetches)
+	                 .arg (stats_.speculative_renders);
+	if (stats_.batches > 0)
+		qDebug () << QString ("Render scheduling: %1 us per batch")
+		                 .arg (static_cast<double> (stats_.scheduling_ns) / (1000. * stats_.batches));
+	if (stats_.decompressions > 0)
+		qDebug () << QString ("Render cache hits: %1 decompressions, %2 ms per decompression")
+		                 .arg (stats_.decompressions)
+		                 .arg (static_cast<double> (stats_.decompress_ns) /
+		                       (1000000. * stats_.decompressions));
+	for (int role = 0; role < nb_view_roles; ++role) {
+		for (int profile = 0; profile < nb_profiles; ++profile) {
+			const int renders = stats_.renders[role][profile];
+			if (renders > 0)
+				qDebug () << "Render time:" << static_cast<ViewRole> (role)
+				          << static_cast<Profile> (profile)
+				          << QString ("%1 renders, %2 ms per render")
+				                 .arg (renders)
+				                 .arg (static_cast<double> (stats_.render_ns[role][profile]) /
+				                       (1000000. * renders));
+		}
+	}
 }
 
 void SystemPrivate::request_render (const Request & request) {
-	auto current_render = request.requested_render ();
-	qDebug () << "request    " << current_render << request.role () << request.cause ();
-	perform_render (current_render, RenderType::Requested);
+	qDebug () << "request    " << request.requested_render () << request.role () << request.cause ();
+	++stats_.requests;
+	if (pending_batch_.empty ())
+		QTimer::singleShot (0, this, SLOT (process_batch ()));
+
+	// Keep only the last request of a role
+	auto same_role = std::find_if (pending_batch_.begin (), pending_batch_.end (),
+	                               [&request](const Request & r) { return r.role () == request.role (); });
+	if (same_role != pending_batch_.end ()) {
+		*same_role = request;
+		++stats_.outdated_requests;
+	} else {
+		pending_batch_.push_back (request);
+	}
+}
+
+void SystemPrivate::process_batch () {
+	if (pending_batch_.empty ())
+		return; // Dropped by a document change
+	QElapsedTimer timer;
+	timer.start ();
+	++stats_.batches;
+	RequestBatch batch;
+	std::swap (batch, pending_batch_);
+	batch_renders_.clear ();
+
+	// Requested renders first, as views are waiting for them
+	for (const auto & request : batch) {
+		view_requests_[static_cast<int> (request.role ())] = request;
+		auto render_info = request.requested_render ();
+		if (batch_renders_.contains (render_info)) {
+			++stats_.duplicate_requests;
+			continue;
+		}
+		batch_renders_.insert (render_info);
+		perform_render (render_info, request.role (), RenderType::Requested);
+	}
+
 	if (prefetch_strategy_ != nullptr) {
-		prefetch_strategy_->prefetch (request, prefetch_render_lambda_);
+		++stats_.prefetch_plans;
+		prefetch_strategy_->prefetch (batch, view_requests_, prefetch_render_lambda_);
 	}
+	stats_.scheduling_ns += timer.nsecsElapsed ();
 }
 
-void SystemPrivate::rendering_finished (Info render_info, Compressed * compressed, QPixmap pixmap) {
-	// When rendering has finished: store compressed, untrack, give pixmap only if the render was
+void SystemPrivate::prefetch_current_page (const PageInfo * future_current_page) {
+	// Renders all known views would request after a jump to future_current_page
+	if (future_current_page == nullptr)
+		return;
+	for (int role = 0; role < nb_view_roles; ++role) {
+		const auto & view = view_requests_[role];
+		auto * render_page = page_for_role (future_current_page, static_cast<ViewRole> (role));
+		if (!view.box_size ().isEmpty () && render_page != nullptr) {
+			auto render_info = view.render_of_page (render_page);
+			qDebug () << "speculative" << render_info;
+			++stats_.speculative_renders;
+			perform_render (render_info, static_cast<ViewRole> (role), RenderType::Prefetch);
+		}
+	}
+}
+
+void SystemPrivate::change_document (
+    const QHash<const PageInfo *, const PageInfo *> & unchanged_pages) {
+	// Move renders to the new pages, with the same size. Returns a null Info if not possible.
+	auto new_info_for = [&unchanged_pages](const Info & old_info) -> Info {
+		auto it = unchanged_pages.find (old_info.page ());
+		if (it == unchanged_pages.end ())
+			return {};
+		Info new_info{it.value (), old_info.size (), old_info.profile (),
+		              old_info.device_pixel_ratio ()};
+		return new_info.size () == old_info.size () ? new_info : Info{};
+	};
+
+	// Pending requests reference old pages, views will make new requests
+	pending_batch_.clear ();
+	dropped_decompressions_ += being_decompressed_;
+	being_decompressed_.clear ();
+
+	const int evicted_before = cache_.statistics ().document_evictions;
+	const int kept = cache_.change_document (new_info_for);
+	view_requests_.fill (Request ()); // Old pages, after the cache has renamed its renders
+	const int evicted = cache_.statistics ().document_evictions - evicted_before;
+
+	/* Running renders: their results are stored under the new Info, or dropped.
+	 * A render renamed by a previous change has no task of its own: the rename chain is collapsed,
+	 * so that the task finishes under the newest Info.
+	 */
+	for (const auto & old_info : being_rendered_.keys ()) {
+		auto type = being_rendered_.take (old_info);
+		auto new_info = new_info_for (old_info);
+		if (!new_info.isNull () && !being_rendered_.contains (new_info)) {
+			being_rendered_.insert (new_info, type);
+		} else {
+			new_info = Info{};
+		}
+		bool was_renamed = false;
+		for (auto & renamed_info : renamed_renders_) {
+			if (renamed_info == old_info) {
+				renamed_info = new_info;
+				was_renamed = true;
+			}
+		}
+		if (!was_renamed)
+			renamed_renders_.insert (old_info, new_info);
+	}
+
+	qDebug () << QString ("Render cache: document changed, kept %1 renders, evicted %2")
+	                 .arg (kept)
+	                 .arg (evicted);
+	if (!has_running_tasks ())
+		emit parent_->all_renders_finished ();
+}
+
+void SystemPrivate::set_cache_size (qint64 cache_size_bytes) {
+	// Shrinking evicts renders immediately
+	qDebug () << QString ("Render cache: size set to %1")
+	                 .arg (size_in_bytes_to_string (cache_size_bytes));
+	cache_.set_max_cost (cache_cost_from_bytes (cache_size_bytes));
+}
+void SystemPrivate::set_cache_policy (CachePolicy policy) {
+	cache_.set_policy (policy);
+}
+void SystemPrivate::set_shown_render (ViewRole role, const Info & render_info) {
+	cache_.set_shown (role, render_info);
+}
+
+const Compressed * SystemPrivate::find_cached_render (const Info & render_info) const {
+	return cache_.object (render_info);
+}
+
+void SystemPrivate::rendering_finished (Info render_info, ViewRole role, Compressed * compressed,
+                                        QPixmap pixmap, qint64 render_ns) {
+	auto profile = static_cast<int> (render_info.profile ());
+	++stats_.renders[static_cast<int> (role)][profile];
+	stats_.render_ns[static_cast<int> (role)][profile] += render_ns;
+
+	// Renders started for an old document: rename, or drop if the page changed
+	auto renamed = renamed_renders_.find (render_info);
+	if (renamed != renamed_renders_.end ()) {
+		render_info = renamed.value ();
+		renamed_renders_.erase (renamed);
+		if (render_info.isNull ()) {
+			delete compressed;
+			if (!has_running_tasks ())
+				emit parent_->all_renders_finished ();
+			return;
+		}
+	}
+
+	// When rendering has finished: untrack, store compressed, give pixmap only if the render was
 	// requested.
-	cache_.insert (render_info, compressed, compressed->data.size ());
 	Q_ASSERT (being_rendered_.contains (render_info));
 	auto type = being_rendered_.take (render_info);
-	if (type == RenderType::Requested) {
+	const bool has_pixmap = !pixmap.isNull ();
+	if (type == RenderType::Requested && !has_pixmap) {
+		// Launched as a prefetch render, without pixmap: decompress like a cache hit.
+		// Before insertion, which may delete it.
+		launch_decompression (render_info, *compressed);
+	}
+	cache_.insert (render_info, compressed, cache_cost (*compressed));
+	if (type == RenderType::Requested && has_pixmap) {
+		pixmap.setDevicePixelRatio (render_info.device_pixel_ratio ());
 		emit parent_->new_render (render_info, pixmap);
 	}
+	if (!has_running_tasks ())
+		emit parent_->all_renders_finished ();
 }
 
-void SystemPrivate::perform_render (const Info & render_info, RenderType type) {
+void SystemPrivate::perform_render (const Info & render_info, ViewRole role, RenderType type) {
 	// Ignore bad renders (null, too small).
 	static constexpr int pixmap_size_limit_px = 10;
 	if (render_info.isNull () || render_info.size ().width () < pixmap_size_limit_px ||
@@ -205,10 +603,8 @@ void SystemPrivate::perform_render (const Info & render_info, RenderType type) {
 	if (compressed_render != nullptr) {
 		qDebug () << "-> cached  " << render_info;
 		// Only serve if actually requested
-		if (type == RenderType::Requested) {
-			emit parent_->new_render (render_info,
-			                          make_pixmap_from_compressed_render (*compressed_render));
-		}
+		if (type == RenderType::Requested && !being_decompressed_.contains (render_info))
+			launch_decompression (render_info, *compressed_render);
 		return;
 	}
 
@@ -225,9 +621,36 @@ void SystemPrivate::perform_render (const Info & render_info, RenderType type) {
 
 	// No render running, launch our own
 	qDebug () << "-> launch  " << render_info;
+	cache_.note_miss (render_info, type == RenderType::Requested);
 	being_rendered_.insert (render_info, type);
-	auto * task = new Task (render_info);
+	auto * task = new Task (backend_, render_info, role, type == RenderType::Requested);
 	connect (task, &Task::finished_rendering, this, &SystemPrivate::rendering_finished);
 	QThreadPool::globalInstance ()->start (task);
 }
+
+void SystemPrivate::launch_decompression (const Info & render_info, const Compressed & compressed) {
+	being_decompressed_.insert (render_info);
+	auto * task = new DecompressTask (render_info, compressed);
+	connect (task, &DecompressTask::finished_decompressing, this,
+	         &SystemPrivate::decompression_finished);
+	QThreadPool::globalInstance ()->start (task, DecompressTask::priority);
+}
+
+void SystemPrivate::decompression_finished (Info render_info, QPixmap pixmap,
+                                            qint64 decompress_ns) {
+	++stats_.decompressions;
+	stats_.decompress_ns += decompress_ns;
+	if (!dropped_decompressions_.remove (render_info)) {
+		being_decompressed_.remove (render_info);
+		pixmap.setDevicePixelRatio (render_info.device_pixel_ratio ());
+		emit parent_->new_render (render_info, pixmap);
+	}
+	if (!has_running_tasks ())
+		emit parent_->all_renders_finished ();
+}
+
+bool SystemPrivate::has_running_tasks () const {
+	return !being_rendered_.isEmpty () || !renamed_renders_.isEmpty () ||
+	       !being_decompressed_.isEmpty () || !dropped_decompressions_.isEmpty ();
+}
 } // namespace Render
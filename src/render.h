@@ -17,45 +17,73 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 
+#include <QByteArray>
 #include <QDebug>
+#include <QImage>
 #include <QPixmap>
 #include <QSize>
 #include <QStringList>
 
 #include "controller.h"
+class Document;
 class PageInfo;
 
 /* Conversion between size str and integer size, with suffix support.
  * ("10k" <-> 10000)
+ * Sizes are 64 bits, to support caches above 2GB.
  *
  * string_to_size_in_bytes returns a negative value on error.
  */
-QString size_in_bytes_to_string (int size);
-int string_to_size_in_bytes (QString size_str);
+QString size_in_bytes_to_string (qint64 size);
+qint64 string_to_size_in_bytes (QString size_str);
 
 namespace Render {
+class Backend;
 class PrefetchStrategy;
 class SystemPrivate;
 
+/* Render profile: trades render quality for speed.
+ * Quality: antialiased, full resolution.
+ * Fast: no antialiasing (thin lines drawn solid).
+ * Draft: like Fast, in grayscale, and rasterized at 72 dpi at most.
+ *
+ * The public view must always use Quality.
+ * Presenter only previews (next slide, transitions) can use faster profiles by default.
+ */
+enum class Profile { Quality, Fast, Draft };
+constexpr int nb_profiles = 3;
+QDebug operator<< (QDebug d, Profile profile);
+
+Profile default_profile_for_role (ViewRole role);
+
 /* Info represent a render metadata.
- * It is composed of a render size, and the selected page.
+ * It is composed of a render size, the selected page, the render profile, and the device pixel
+ * ratio of the screen the render is shown on.
+ * The size is in device pixels: renders are rasterized at the exact physical size of the screen,
+ * and their pixmap has the device pixel ratio set.
  * A "null" render represents invalid metadata (no page / zero size).
  *
- * The Info constructor accept any size: it will be shrunk to the biggest fitting render size.
+ * The Info constructor accept any box (device pixels): it will be shrunk to the biggest fitting
+ * render size.
  * Info is comparable / hashable to enable use as a hash table key (render system cache).
  */
 class Info {
 private:
 	const PageInfo * page_{nullptr};
 	QSize size_{};
+	Profile profile_{Profile::Quality};
+	qreal device_pixel_ratio_{1.};
 
 public:
 	Info () = default;
-	Info (const PageInfo * p, const QSize & box);
+	Info (const PageInfo * p, const QSize & box, Profile profile, qreal device_pixel_ratio = 1.);
 
 	const PageInfo * page () const noexcept { return page_; }
 	const QSize & size () const noexcept { return size_; }
+	Profile profile () const noexcept { return profile_; }
+	qreal device_pixel_ratio () const noexcept { return device_pixel_ratio_; }
 	bool isNull () const noexcept { return page () == nullptr || size ().isNull (); }
 };
 bool operator== (const Info & a, const Info & b);
@@ -63,8 +91,61 @@ bool operator!= (const Info & a, const Info & b);
 uint qHash (const Info & info, uint seed = 0);
 QDebug operator<< (QDebug d, const Info & render_info);
 
+/* Compressed image data (qCompress format), stored in a block of the compressed render allocator.
+ * The allocator uses size class slabs (see slab_allocator.h), to avoid heap fragmentation by
+ * cache churn. Copies share the block, which is returned when the last copy is destroyed.
+ * allocated_bytes () is the memory really used (block capacity), charged to the render cache.
+ * bytes () is a non-owning view, valid as long as this CompressedData.
+ */
+class CompressedData {
+private:
+	struct Block;
+	std::shared_ptr<const Block> block_;
+
+public:
+	CompressedData () = default;
+	explicit CompressedData (const QByteArray & compressed_bytes); // Copied to a new block
+
+	int size () const noexcept;
+	qint64 allocated_bytes () const noexcept;
+	QByteArray bytes () const;
+};
+
+/* Stores data for a Compressed render.
+ * Used by the render cache, and to stream renders to other instances (see streaming.h).
+ */
+struct Compressed {
+	CompressedData data;
+	QSize size;
+	int bytes_per_line;
+	QImage::Format image_format;
+};
+
+/* Render cache eviction policy (see RenderCache in render_cache.h).
+ * Lru: least recently used renders are evicted first.
+ * Distance: renders far (along the deck) from the pages shown by the views are evicted first.
+ * Renders shown by a view are never evicted.
+ */
+enum class CachePolicy { Lru, Distance };
+QStringList list_of_cache_policy_names ();
+bool select_cache_policy_by_name (const QString & name, CachePolicy & policy); // false if unknown
+
+// Render cache evictions by cause, and renders made again after their eviction
+struct CacheStatistics {
+	int capacity_evictions{0};        // To make room for a new render
+	int shrink_evictions{0};          // Cache size reduced (memory pressure)
+	int document_evictions{0};        // Page changed by a document reload
+	int rejected_renders{0};          // Larger than the whole cache
+	int requested_after_eviction{0};  // Requested render missing because evicted: a view waited
+	int prefetched_after_eviction{0}; // Prefetch render made again after its eviction
+};
+
 /* Represent a render request comming from one of the views.
  * A view will request a render of a specific page, to fit within the view space.
+ * The render profile is selected by the view.
+ * The view space is given in device independent pixels, with the device pixel ratio of the screen.
+ * box_size () is in device pixels.
+ * render_of_page gives the render this view would request to show another page.
  */
 class Request {
 private:
@@ -72,16 +153,24 @@ private:
 	QSize box_size_{};
 	ViewRole role_{ViewRole::Unknown};
 	RedrawCause cause_{RedrawCause::Unknown};
+	Profile profile_{Profile::Quality};
+	qreal device_pixel_ratio_{1.};
 
 public:
-	Request () = default; // Required by Qt Moc, should not be used otherwise
-	Request (const PageInfo * current_page, const QSize & box, ViewRole role, RedrawCause cause);
-
-	Info requested_render () const { return {page_for_role (current_page_, role_), box_size_}; }
+	Request () = default; // Required by Qt Moc, and for views without request (empty box)
+	Request (const PageInfo * current_page, const QSize & box, ViewRole role, RedrawCause cause,
+	         Profile profile, qreal device_pixel_ratio = 1.);
+
+	Info requested_render () const { return render_of_page (page_for_role (current_page_, role_)); }
+	Info render_of_page (const PageInfo * page) const {
+		return {page, box_size_, profile_, device_pixel_ratio_};
+	}
 	const PageInfo * current_page () const noexcept { return current_page_; }
 	const QSize & box_size () const noexcept { return box_size_; }
 	ViewRole role () const noexcept { return role_; }
 	RedrawCause cause () const noexcept { return cause_; }
+	Profile profile () const noexcept { return profile_; }
+	qreal device_pixel_ratio () const noexcept { return device_pixel_ratio_; }
 };
 
 /* Global rendering system.
@@ -90,9 +179,24 @@ public:
  * The new pixmap is broadcasted to all views; only requesting views will actually update.
  *
  * Internally, the cost of rendering is reduced by caching (see render_internal.h).
+ * Renders and cache hits are both answered asynchronously: decompression runs in the thread pool.
  * Additionally, the pages next to the current one are pre-rendered.
- * 'cache_size_bytes' sets the size of the cache in bytes.
+ * Render times are measured for each profile, and reported at destruction.
+ * 'cache_size_bytes' sets the size of the cache in bytes, it can be changed later (set_cache_size).
+ * Evictions favor renders near the shown pages by default (set_cache_policy to compare with LRU).
+ * Eviction counts are available from cache_statistics, and reported at destruction.
  * 'strategy' defines the prefetch strategy, it can be null (no prefetch).
+ * 'backend' makes the renders (Poppler, or synthetic renders for tests).
+ *
+ * find_cached_render gives access to the cached Compressed version of a render, if present.
+ *
+ * prefetch_current_page prerenders what all views would show if a page became current.
+ * It is used to make a jump to a page typed by the user instant.
+ *
+ * When the document is replaced, renders of unchanged pages (same content hash) are kept.
+ * They are moved to the pages of the new document, others are evicted.
+ * all_renders_finished signals that no render or decompression is running (old documents are
+ * unused).
  */
 class System : public QObject {
 	Q_OBJECT
@@ -101,18 +205,34 @@ private:
 	SystemPrivate * d_; // Cleanup is done through the QObject ownership tree
 
 public:
-	System (int cache_size_bytes, PrefetchStrategy * strategy);
+	System (qint64 cache_size_bytes, PrefetchStrategy * strategy,
+	        std::shared_ptr<const Backend> backend);
+
+	// Returns false if not in the cache
+	bool find_cached_render (const Info & render_info, Compressed & compressed) const;
+	CacheStatistics cache_statistics () const;
+	void set_cache_policy (CachePolicy policy);
 
 signals:
 	void new_render (const Info & render_info, QPixmap render_data);
+	void all_renders_finished ();
 
 public slots:
 	void request_render (const Request & request);
+	void prefetch_current_page (const PageInfo * future_current_page);
+	void change_document (const Document * new_document, const Document * old_document);
+	void set_cache_size (qint64 cache_size_bytes);
+	// Render shown by a view (null Info if none): pinned in the cache, like the requested one
+	void set_shown_render (ViewRole role, const Info & render_info);
 };
 
 // List of defined prefetch strategies (names)
 QStringList list_of_prefetch_strategy_names ();
 
+/* Recreate a pixmap from a Compressed render.
+ */
+QPixmap make_pixmap_from_compressed_render (const Compressed & render);
+
 // Select a PrefetchStrategy based on a name
 PrefetchStrategy * default_prefetch_strategy ();
 PrefetchStrategy * select_prefetch_strategy_by_name (const QString & name);
@@ -121,3 +241,4 @@ PrefetchStrategy * select_prefetch_strategy_by_name (const QString & name);
 
 Q_DECLARE_METATYPE (Render::Info);
 Q_DECLARE_METATYPE (Render::Request);
+Q_DECLARE_METATYPE (Render::Compressed);
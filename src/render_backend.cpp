@@ -0,0 +1,88 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QColor>
+#include <QMutexLocker>
+#include <QThread>
+
+#include "document.h"
+#include "render_backend.h"
+#include "render_internal.h"
+
+namespace Render {
+// Poppler
+
+QImage PopplerBackend::render (const Info & render_info, QImage & buffer) const {
+	const auto * page = render_info.page ();
+	const auto & settings = settings_for_profile (render_info.profile ());
+	if (page->can_render_into (settings)) {
+		page->render_into (buffer, render_info.size (), settings);
+		return buffer;
+	} else {
+		return page->render (render_info.size (), settings);
+	}
+}
+
+// Synthetic
+
+SyntheticBackend::SyntheticBackend (int latency_us, Content content)
+    : latency_us_ (latency_us), content_ (content) {}
+
+QImage SyntheticBackend::render (const Info & render_info, QImage & buffer) const {
+	{
+		QMutexLocker lock (&mutex_);
+		++stats_.renders;
+		if (rendered_.contains (render_info))
+			++stats_.duplicate_renders;
+		else
+			rendered_.insert (render_info);
+	}
+	if (latency_us_ > 0)
+		QThread::usleep (static_cast<unsigned long> (latency_us_));
+
+	const auto format = settings_for_profile (render_info.profile ()).grayscale
+	                        ? QImage::Format_Grayscale8
+	                        : QImage::Format_ARGB32_Premultiplied;
+	if (buffer.size () != render_info.size () || buffer.format () != format)
+		buffer = QImage (render_info.size (), format);
+
+	switch (content_) {
+	case Content::Flat:
+		buffer.fill (QColor::fromHsv ((render_info.page ()->index () * 37) % 360, 128, 224));
+		break;
+	case Content::Noise: {
+		// xorshift32, seeded by page: renders of a page are identical
+		quint32 state = 2463534242u ^ static_cast<quint32> (render_info.page ()->index ());
+		for (int y = 0; y < buffer.height (); ++y) {
+			auto * line = reinterpret_cast<quint32 *> (buffer.scanLine (y));
+			const int nb_words = buffer.bytesPerLine () / 4;
+			for (int x = 0; x < nb_words; ++x) {
+				state ^= state << 13;
+				state ^= state >> 17;
+				state ^= state << 5;
+				line[x] = state | 0xFF000000u; // Opaque in ARGB32
+			}
+		}
+	} break;
+	}
+	return buffer;
+}
+
+SyntheticBackend::Statistics SyntheticBackend::statistics () const {
+	QMutexLocker lock (&mutex_);
+	return stats_;
+}
+} // namespace Render
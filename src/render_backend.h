@@ -0,0 +1,84 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+
+#include <QImage>
+#include <QMutex>
+#include <QSet>
+
+#include "render.h"
+
+namespace Render {
+/* Render backend: makes the image of a render (Info).
+ * The render system only uses pages for their structure (navigation, size).
+ * Rasterization is delegated to its backend, so scheduling and caching can be tested alone.
+ *
+ * render () is called concurrently by render tasks, from worker threads.
+ * buffer is an image kept between renders (null, or of the size of the render).
+ * A backend able to paint in an existing image can reuse it, and return it (no allocation).
+ * Others return a new image.
+ */
+class Backend {
+public:
+	virtual ~Backend () = default;
+	virtual QImage render (const Info & render_info, QImage & buffer) const = 0;
+};
+
+/* Poppler rasterization: the pages render themselves, with the settings of the profile.
+ * The direct paint path of the QPainter Poppler backend uses the buffer.
+ */
+class PopplerBackend : public Backend {
+public:
+	QImage render (const Info & render_info, QImage & buffer) const final;
+};
+
+/* Synthetic renders, without Poppler, for tests and benchmarks (see the "scheduler" benchmark).
+ *
+ * Each render takes at least latency_us (sleeping, like a render waiting for Poppler).
+ * Content is a flat color depending on the page (compresses very well), or noise (does not).
+ * Draft renders are grayscale, as with the Poppler backend.
+ *
+ * Renders are counted. Duplicate renders (same Info rendered twice) come from cache evictions, or
+ * from scheduling bugs.
+ */
+class SyntheticBackend : public Backend {
+public:
+	enum class Content { Flat, Noise };
+
+	struct Statistics {
+		int renders;
+		int duplicate_renders;
+	};
+
+private:
+	const int latency_us_;
+	const Content content_;
+
+	mutable QMutex mutex_;
+	mutable QSet<Info> rendered_;
+	mutable Statistics stats_{0, 0};
+
+public:
+	SyntheticBackend (int latency_us, Content content);
+
+	QImage render (const Info & render_info, QImage & buffer) const final;
+
+	Statistics statistics () const;
+};
+} // namespace Render
@@ -0,0 +1,210 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <limits>
+
+#include "document.h"
+#include "render_cache.h"
+
+namespace Render {
+
+// CachePolicy
+
+namespace {
+struct NamedCachePolicy {
+	const char * name;
+	CachePolicy policy;
+};
+const NamedCachePolicy defined_cache_policies[] = {
+    {"distance", CachePolicy::Distance}, {"lru", CachePolicy::Lru},
+};
+} // namespace
+
+QStringList list_of_cache_policy_names () {
+	QStringList names;
+	for (const auto & p : defined_cache_policies) {
+		names << p.name;
+	}
+	return names;
+}
+bool select_cache_policy_by_name (const QString & name, CachePolicy & policy) {
+	for (const auto & p : defined_cache_policies) {
+		if (name.trimmed () == p.name) {
+			policy = p.policy;
+			return true;
+		}
+	}
+	return false;
+}
+
+// RenderCache
+
+RenderCache::RenderCache (qint64 max_cost, const ViewRequests & views)
+    : max_cost_ (max_cost), views_ (views) {}
+
+void RenderCache::set_policy (CachePolicy policy) {
+	policy_ = policy;
+}
+void RenderCache::set_max_cost (qint64 max_cost) {
+	max_cost_ = max_cost;
+	evict (max_cost_, EvictionCause::Shrink);
+}
+
+void RenderCache::set_shown (ViewRole role, const Info & render_info) {
+	Q_ASSERT (role != ViewRole::Unknown);
+	shown_[static_cast<int> (role)] = render_info;
+}
+
+const Compressed * RenderCache::object (const Info & render_info) const {
+	auto it = entries_.find (render_info);
+	if (it == entries_.end ())
+		return nullptr;
+	it->second.last_use = ++use_clock_;
+	return it->second.compressed.get ();
+}
+
+void RenderCache::insert (const Info & render_info, Compressed * compressed, int cost) {
+	std::unique_ptr<Compressed> owned (compressed);
+	delete take (render_info);
+	evicted_.remove (render_info);
+	if (cost > max_cost_) {
+		++stats_.rejected_renders;
+		return;
+	}
+	Entry entry{std::move (owned), cost, ++use_clock_};
+	entries_.emplace (render_info, std::move (entry));
+	total_cost_ += cost;
+	if (total_cost_ > max_cost_)
+		evict (max_cost_ - max_cost_ / eviction_batch_fraction, EvictionCause::Capacity);
+}
+
+Compressed * RenderCache::take (const Info & render_info) {
+	auto it = entries_.find (render_info);
+	if (it == entries_.end ())
+		return nullptr;
+	auto * compressed = it->second.compressed.release ();
+	total_cost_ -= it->second.cost;
+	entries_.erase (it);
+	return compressed;
+}
+
+int RenderCache::change_document (const std::function<Info(const Info &)> & new_info_for) {
+	decltype (entries_) renamed_entries;
+	int kept = 0;
+	for (auto & entry : entries_) {
+		const auto cost = entry.second.cost;
+		auto new_info = new_info_for (entry.first);
+		if (!new_info.isNull () &&
+		    renamed_entries.emplace (new_info, std::move (entry.second)).second) {
+			++kept;
+		} else {
+			total_cost_ -= cost;
+			++stats_.document_evictions;
+		}
+	}
+	entries_ = std::move (renamed_entries);
+	// Views keep showing their pixmap until the render of the new page arrives
+	for (auto & shown : shown_) {
+		if (!shown.isNull ())
+			shown = new_info_for (shown);
+	}
+	evicted_.clear ();
+	return kept;
+}
+
+void RenderCache::note_miss (const Info & render_info, bool requested) {
+	if (evicted_.remove (render_info)) {
+		if (requested) {
+			++stats_.requested_after_eviction;
+		} else {
+			++stats_.prefetched_after_eviction;
+		}
+	}
+}
+
+void RenderCache::evict (qint64 max_cost, EvictionCause cause) {
+	if (total_cost_ <= max_cost)
+		return;
+	// Eviction order is computed once for all evictions
+	RequestedRenders requested;
+	for (int role = 0; role < nb_view_roles; ++role)
+		requested[role] = views_[role].requested_render ();
+	struct Candidate {
+		int score;
+		quint64 last_use;
+		Info render_info;
+	};
+	std::vector<Candidate> candidates;
+	candidates.reserve (entries_.size ());
+	for (const auto & entry : entries_) {
+		if (policy_ == CachePolicy::Lru) {
+			candidates.push_back (Candidate{0, entry.second.last_use, entry.first});
+		} else if (!is_pinned (entry.first, requested)) {
+			candidates.push_back (
+			    Candidate{score (entry.first, requested), entry.second.last_use, entry.first});
+		}
+	}
+	std::sort (candidates.begin (), candidates.end (), [](const Candidate & a, const Candidate & b) {
+		return a.score != b.score ? a.score > b.score : a.last_use < b.last_use;
+	});
+	for (const auto & candidate : candidates) {
+		if (total_cost_ <= max_cost)
+			break;
+		delete take (candidate.render_info);
+		evicted_.insert (candidate.render_info);
+		if (cause == EvictionCause::Capacity) {
+			++stats_.capacity_evictions;
+		} else {
+			++stats_.shrink_evictions;
+		}
+	}
+}
+
+int RenderCache::score (const Info & render_info, const RequestedRenders & requested) const {
+	int best = std::numeric_limits<int>::max (); // Matches no view
+	for (int role = 0; role < nb_view_roles; ++role) {
+		const auto & view = views_[role];
+		const auto & shown = requested[role];
+		if (shown.isNull ())
+			continue;
+		// Would the view request this render to show this page ? Cheap checks first.
+		if (render_info.profile () != view.profile () ||
+		    render_info.device_pixel_ratio () != view.device_pixel_ratio () ||
+		    view.render_of_page (render_info.page ()) != render_info)
+			continue;
+		const int distance = render_info.page ()->index () - shown.page ()->index ();
+		int view_score = distance >= 0 ? distance : -2 * distance;
+		const auto view_role = static_cast<ViewRole> (role);
+		if (view_role != ViewRole::CurrentPublic && view_role != ViewRole::CurrentPresenter)
+			view_score *= 2;
+		best = std::min (best, view_score);
+	}
+	return best;
+}
+
+bool RenderCache::is_pinned (const Info & render_info, const RequestedRenders & requested) const {
+	for (const auto & render : requested) {
+		if (render == render_info)
+			return true;
+	}
+	for (const auto & render : shown_) {
+		if (render == render_info)
+			return true;
+	}
+	return false;
+}
+} // namespace Render
@@ -0,0 +1,121 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <QSet>
+#include <QSize>
+
+#include "render.h"
+
+namespace Render {
+
+// Last request of each view, by role. Roles without request have a default Request (empty box).
+using ViewRequests = std::array<Request, nb_view_roles>;
+
+/* Render cache: stores Compressed renders, bounded by a total cost (in cache_cost_unit).
+ * Replaces QCache, whose plain LRU order lets a burst of prefetches evict the renders of the
+ * current page, or of the page the presenter will certainly go back to.
+ *
+ * The cache reads the last request of each view from the render system (ViewRequests): the
+ * requested render will be shown. Views also report the render they show (set_shown): it is the
+ * previous render until the requested one arrives.
+ * With the Distance policy:
+ * - Renders shown or requested by a view are pinned: they are never evicted. The cache may then
+ *   exceed its size, by at most two renders per view.
+ * - Other renders are scored by how likely a view is to request them again.
+ *   A render matches a view if it has the size, profile and pixel ratio this view would request
+ *   for its page. Its score is its distance along the deck to the page shown by the view.
+ *   Backward distances count double (moving back is less frequent than moving forward), and
+ *   preview roles count double (their renders are faster to make again).
+ *   The best score among matching views is used.
+ * - Renders matching no view (old window sizes) are evicted first, then the highest scores.
+ *   Ties are evicted in least recently used order.
+ * The Lru policy evicts in least recently used order only, without pinning (like QCache).
+ *
+ * Evictions run when the cache is full, which is the steady state during prefetch bursts.
+ * Each one sorts all renders: thus renders are evicted in batches, down to a low water mark
+ * (1/16 below the size), so that most inserts evict nothing.
+ *
+ * Requests must not reference pages of an old document after change_document.
+ * Evictions are counted by cause. Evicted renders are remembered until the next document change,
+ * so that rendering them again can be counted (note_miss): this measures the eviction quality.
+ */
+class RenderCache {
+private:
+	struct Entry {
+		std::unique_ptr<Compressed> compressed;
+		int cost;
+		mutable quint64 last_use; // Value of use_clock_ at the last use
+	};
+	struct InfoHasher {
+		std::size_t operator() (const Info & info) const { return qHash (info); }
+	};
+	enum class EvictionCause { Capacity, Shrink };
+	using RequestedRenders = std::array<Info, nb_view_roles>;
+	static constexpr qint64 eviction_batch_fraction = 16; // Evict down to size - size / fraction
+
+	CachePolicy policy_{CachePolicy::Distance};
+	std::unordered_map<Info, Entry, InfoHasher> entries_;
+	qint64 total_cost_{0};
+	qint64 max_cost_;
+	mutable quint64 use_clock_{0};
+	const ViewRequests & views_;
+	std::array<Info, nb_view_roles> shown_{}; // Render shown by each view (null if none)
+	QSet<Info> evicted_;
+	CacheStatistics stats_;
+
+public:
+	RenderCache (qint64 max_cost, const ViewRequests & views);
+
+	void set_policy (CachePolicy policy);
+	void set_max_cost (qint64 max_cost); // Evicts renders if shrinking
+	qint64 max_cost () const { return max_cost_; }
+	qint64 total_cost () const { return total_cost_; }
+	const CacheStatistics & statistics () const { return stats_; }
+
+	// Render shown by a view (null Info if none)
+	void set_shown (ViewRole role, const Info & render_info);
+
+	// Returns nullptr if absent. Marks the render as used.
+	const Compressed * object (const Info & render_info) const;
+	// Takes ownership. May evict other renders, or the new one if it is larger than the cache.
+	void insert (const Info & render_info, Compressed * compressed, int cost);
+	// Releases ownership of the render (nullptr if absent), without counting an eviction.
+	Compressed * take (const Info & render_info);
+
+	/* Document change: renders are renamed (new page) or evicted (null Info) by new_info_for.
+	 * Shown renders are renamed too. The eviction history refers to old pages: it is reset.
+	 * Returns the number of kept renders.
+	 */
+	int change_document (const std::function<Info(const Info &)> & new_info_for);
+
+	// A render is missing and will be made: counts it if it was evicted before
+	void note_miss (const Info & render_info, bool requested);
+
+private:
+	void evict (qint64 max_cost, EvictionCause cause);
+	// Higher is evicted first. requested: render requested by each view, computed once per eviction
+	int score (const Info & render_info, const RequestedRenders & requested) const;
+	bool is_pinned (const Info & render_info, const RequestedRenders & requested) const;
+};
+} // namespace Render
@@ -16,16 +16,23 @@
  */
 #pragma once
 
+#include <array>
+#include <memory>
 #include <utility>
+#include <vector>
 
 #include <QByteArray>
-#include <QCache>
+#include <QElapsedTimer>
 #include <QHash>
 #include <QImage>
 #include <QPixmap>
 #include <QRunnable>
+#include <QSet>
 
 #include "render.h"
+#include "render_cache.h"
+#include "slab_allocator.h"
+struct RenderSettings;
 
 /* Internal header of the rendering system.
  * Header is required for moc to process Task/SystemPrivate classes.
@@ -37,7 +44,8 @@
  *
  * In PDFTalk, window sizes are expected to change from program launch to presentation running.
  * No total prerendering is done.
- * Instead we use a LRU cache (bounded by a memory usage) of renders (indexed by page x size).
+ * Instead we use a cache (bounded by a memory usage) of renders (indexed by page x size).
+ * Eviction favors renders near the pages shown by the views (see RenderCache).
  * Rendering is done on demand (when pages are requested).
  * When a page is rendered (QImage), we store a qCompressed version in the cache (Compressed).
  * Page requests are fulfilled from the Compressed if available, or from a render.
@@ -47,96 +55,204 @@
  */
 namespace Render {
 
-// Stores data for a Compressed render
-struct Compressed {
-	QByteArray data;
-	QSize size;
-	int bytes_per_line;
-	QImage::Format image_format;
-};
+// Render requests from all views for one event (navigation, resize), at most one per role
+using RequestBatch = std::vector<Request>;
+// Launches a prefetch render for the view of the given role (PrefetchStrategy)
+using PrefetchRender = std::function<void(ViewRole, const Info &)>;
+
+// Cost of cache entries (and cache size) is counted in KiB
+constexpr qint64 cache_cost_unit = 1024;
+int cache_cost (const Compressed & compressed);
+int cache_cost_from_bytes (qint64 bytes);
+
+// Allocator of CompressedData blocks (global, never destroyed: renders may outlive the System)
+SlabAllocator & compressed_render_allocator ();
+
+// Settings used to render each profile
+const RenderSettings & settings_for_profile (Profile profile);
 
-/* Renders the page at the selected size.
+/* Renders the page at the selected size with the backend (settings of the profile for Poppler).
  * Returns both the pixmap and a Compressed version.
- * The pixmap can be given to the requesting view.
+ * The pixmap can be given to the requesting view; it is only made if with_pixmap is true.
  * The Compressed version can be stored in the render cache.
  *
+ * If the backend supports it (QPainter Poppler backend), the page is painted directly in a buffer.
+ * Buffers of prefetch renders are kept for later renders of the same size, thus prefetch renders
+ * allocate no image. Idle buffers are bounded (64 MiB), requested renders keep theirs as pixmap.
+ *
  * Compressed renders are transmitted as owning raw pointers.
  * Signals cannot handle unique_ptr<Compressed> (move only unsupported).
- * And QCache requires an 'operator new' allocated object.
+ * And the cache takes ownership of an 'operator new' allocated object.
  */
-std::pair<Compressed *, QPixmap> make_render (const Info & render_info);
+std::pair<Compressed *, QPixmap> make_render (const Backend & backend, const Info & render_info,
+                                              bool with_pixmap);
+// Compressed version of an image only (owning raw pointer, as above)
+Compressed * make_compressed_render (const QImage & image);
 
-/* Recreate a pixmap from a Compressed render.
+/* "Render a page" task for QThreadPool.
+ * The pixmap is only made for requested renders (null pixmap for prefetch renders).
+ * The role is the view the render was requested or prefetched for (render statistics).
  */
-QPixmap make_pixmap_from_compressed_render (const Compressed & render);
-
-// "Render a page" task for QThreadPool.
 class Task : public QObject, public QRunnable {
 	Q_OBJECT
 
 private:
+	const std::shared_ptr<const Backend> backend_; // Shared: the task may outlive the System
 	const Info render_info_;
+	const ViewRole role_;
+	const bool with_pixmap_;
 
 public:
-	Task (const Info & render_info) : render_info_ (render_info) {}
+	Task (std::shared_ptr<const Backend> backend, const Info & render_info, ViewRole role,
+	      bool with_pixmap)
+	    : backend_ (std::move (backend)),
+	      render_info_ (render_info),
+	      role_ (role),
+	      with_pixmap_ (with_pixmap) {}
 
 signals:
 	// "Render::Info" as Qt is not very namespace friendly
-	void finished_rendering (Render::Info render_info, Compressed * compressed, QPixmap pixmap);
+	void finished_rendering (Render::Info render_info, ViewRole role, Compressed * compressed,
+	                         QPixmap pixmap, qint64 render_ns);
+
+public:
+	void run () Q_DECL_FINAL {
+		QElapsedTimer timer;
+		timer.start ();
+		auto result = make_render (*backend_, render_info_, with_pixmap_);
+		emit finished_rendering (render_info_, role_, result.first, result.second,
+		                         timer.nsecsElapsed ());
+	}
+};
+
+/* "Decompress a cached render" task for QThreadPool.
+ * Started with a high priority, as a view is waiting for the pixmap.
+ * The Compressed is a copy sharing the cached data: it stays valid if the cache evicts the render.
+ */
+class DecompressTask : public QObject, public QRunnable {
+	Q_OBJECT
+
+private:
+	const Info render_info_;
+	const Compressed compressed_;
+
+public:
+	static constexpr int priority = 1; // Render tasks have the default priority (0)
+
+	DecompressTask (const Info & render_info, const Compressed & compressed)
+	    : render_info_ (render_info), compressed_ (compressed) {}
+
+signals:
+	void finished_decompressing (Render::Info render_info, QPixmap pixmap, qint64 decompress_ns);
 
 public:
 	void run () Q_DECL_FINAL {
-		auto result = make_render (render_info_);
-		emit finished_rendering (render_info_, result.first, result.second);
+		QElapsedTimer timer;
+		timer.start ();
+		auto pixmap = make_pixmap_from_compressed_render (compressed_);
+		emit finished_decompressing (render_info_, pixmap, timer.nsecsElapsed ());
 	}
 };
 
 /* Caching system (internals).
  * Stores compressed renders in a cache to avoid rerendering stuff later.
- * Rendering is done through Tasks in a QThreadPool.
+ * Rendering is done through Tasks in a QThreadPool, by the Backend (see render_backend.h).
  *
  * Render requests arrive at request_render slot.
- * They are either served from the cache, or a render is launched.
- * In any case, prefetch renders are launched.
+ * All views react to a page change in the same event loop turn.
+ * Thus requests are accumulated in a batch, which is processed at the next turn (process_batch).
+ * Only the last request of each role is kept (a view only waits for its last request).
+ * Requested renders are deduplicated, and either served from the cache, or a render is launched.
+ * The last request of each view is kept: the cache pins its render, prefetch reuses its size.
+ * Cache hits are decompressed by DecompressTasks, so the GUI thread never runs the codec.
+ * The decompressions for the views of a flip run in parallel, before queued render tasks.
+ * Then prefetch renders are planned once for the whole batch, and deduplicated.
  *
  * Ongoing renders (render tasks) can be requested or prefetch.
  * Requested renders will emit a signal, as views requested them.
  * Prefetch renders emit no signal, and only update the cache.
  * If a render is requested while it is running, its status is updated to requested.
  * being_rendered tracks running renders, preventing double rendering and keeping their status.
+ *
+ * On document change, cached and running renders are moved to the matching new pages.
+ * Running renders of changed pages are tracked by renamed_renders (to a null Info), and dropped.
+ * Running decompressions are all dropped: views request the renders of the new pages.
  */
 class SystemPrivate : public QObject {
 	Q_OBJECT
 
 private:
 	System * parent_;
-	QCache<Info, Compressed> cache_;
+	std::shared_ptr<const Backend> backend_;
+	// Last request of each view: read by the cache, prefetch_current_page and the strategy
+	ViewRequests view_requests_;
+	RenderCache cache_; // Costs are in cache_cost_unit, reads view_requests_
 
 	enum class RenderType { Requested, Prefetch };
 	QHash<Info, RenderType> being_rendered_;
+	QHash<Info, Info> renamed_renders_; // Running renders from old documents
+
+	QSet<Info> being_decompressed_;     // Running DecompressTasks
+	QSet<Info> dropped_decompressions_; // Running DecompressTasks from old documents
+
+	RequestBatch pending_batch_;
+	QSet<Info> batch_renders_; // Renders already launched for the current batch
 
 	PrefetchStrategy * prefetch_strategy_;
-	std::function<void(const Info &)> prefetch_render_lambda_; // for PrefetchStrategy, cached
+	PrefetchRender prefetch_render_lambda_; // for PrefetchStrategy, cached
+
+	// Scheduling statistics, reported at destruction
+	struct Statistics {
+		int batches{0};
+		int requests{0};
+		int outdated_requests{0};    // Replaced by a later request of the same role in the batch
+		int duplicate_requests{0};   // Same render requested by multiple views
+		int prefetch_plans{0};       // Calls to the prefetch strategy
+		int prefetch_renders{0};     // Prefetch renders performed
+		int duplicate_prefetches{0}; // Prefetches skipped as already handled in the batch
+		int speculative_renders{0};  // Prefetch renders from prefetch_current_page
+		int decompressions{0};       // Cache hits of requested renders
+		qint64 decompress_ns{0};
+		qint64 scheduling_ns{0};     // Time spent in process_batch
+		// Render tasks, by role they were launched for, and profile
+		std::array<std::array<int, nb_profiles>, nb_view_roles> renders{};
+		std::array<std::array<qint64, nb_profiles>, nb_view_roles> render_ns{};
+	};
+	Statistics stats_;
 
 public:
-	SystemPrivate (int cache_size_bytes, PrefetchStrategy * strategy, System * parent);
+	SystemPrivate (qint64 cache_size_bytes, PrefetchStrategy * strategy,
+	               std::shared_ptr<const Backend> backend, System * parent);
 	~SystemPrivate ();
 
 	void request_render (const Request & request);
+	void prefetch_current_page (const PageInfo * future_current_page);
+	void change_document (const QHash<const PageInfo *, const PageInfo *> & unchanged_pages);
+	void set_cache_size (qint64 cache_size_bytes);
+	const Compressed * find_cached_render (const Info & render_info) const;
+	const CacheStatistics & cache_statistics () const { return cache_.statistics (); }
+	void set_cache_policy (CachePolicy policy);
+	void set_shown_render (ViewRole role, const Info & render_info);
 
 private slots:
+	void process_batch ();
 	// "Render::Info" as Qt is not very namespace friendly
-	void rendering_finished (Render::Info render_info, Compressed * compressed, QPixmap pixmap);
+	void rendering_finished (Render::Info render_info, ViewRole role, Compressed * compressed,
+	                         QPixmap pixmap, qint64 render_ns);
+	void decompression_finished (Render::Info render_info, QPixmap pixmap, qint64 decompress_ns);
 
 private:
-	void perform_render (const Info & render_info, RenderType type);
+	void perform_render (const Info & render_info, ViewRole role, RenderType type);
+	void launch_decompression (const Info & render_info, const Compressed & compressed);
+	bool has_running_tasks () const;
 };
 
 /* Prefetch strategy interface.
  * Has a name for commandline identification.
  * Strategies must implement the prefetch method.
- * The context determines which pages will be pre rendered using pre_render.
- * pre_render should do nothing if the render is cached.
+ * The context (a batch of requests) determines which pages will be pre rendered using pre_render.
+ * views gives the last request of every view (already updated by the batch).
+ * pre_render should do nothing if the render is cached or was already handled in the batch.
  */
 class PrefetchStrategy {
 private:
@@ -146,7 +262,7 @@ public:
 	PrefetchStrategy (const QString & name);
 	virtual ~PrefetchStrategy () = default;
 	const QString & name () const noexcept { return name_; }
-	virtual void prefetch (const Request & context,
-	                       const std::function<void(const Info &)> & request_render) = 0;
+	virtual void prefetch (const RequestBatch & context, const ViewRequests & views,
+	                       const PrefetchRender & request_render) = 0;
 };
 } // namespace Render
@@ -0,0 +1,148 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <map>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QtDebug>
+
+#include "document.h"
+#include "search.h"
+
+QStringList words_of (const QString & text) {
+	// Decomposition separates diacritics (non spacing marks) from letters: they are dropped
+	const auto normalized = text.toCaseFolded ().normalized (QString::NormalizationForm_KD);
+	QStringList words;
+	QString word;
+	for (const auto c : normalized) {
+		if (c.isLetterOrNumber ()) {
+			word += c;
+		} else if (c.category () != QChar::Mark_NonSpacing && !word.isEmpty ()) {
+			words << word;
+			word.clear ();
+		}
+	}
+	if (!word.isEmpty ())
+		words << word;
+	return words;
+}
+
+// SearchIndex
+
+SearchIndex::SearchIndex (std::vector<QString> slide_texts)
+    : slide_texts_ (std::move (slide_texts)) {
+	QHash<QString, std::map<int, int>> occurrences_by_word;
+	for (int slide_index = 0; slide_index < nb_slides (); ++slide_index) {
+		for (const auto & word : words_of (slide_texts_[slide_index]))
+			++occurrences_by_word[word][slide_index];
+	}
+	entries_.reserve (occurrences_by_word.size ());
+	for (auto it = occurrences_by_word.cbegin (); it != occurrences_by_word.cend (); ++it)
+		entries_.push_back (Entry{it.key (), {it.value ().begin (), it.value ().end ()}});
+	std::sort (entries_.begin (), entries_.end (),
+	           [](const Entry & a, const Entry & b) { return a.word < b.word; });
+}
+
+std::vector<int> SearchIndex::search (const QString & query) const {
+	const auto words = words_of (query);
+	if (words.isEmpty ())
+		return {};
+
+	// Intersection of the slides of each word, summing occurrences
+	std::vector<std::pair<int, int>> matches;
+	for (int i = 0; i < words.size (); ++i) {
+		auto word_matches = occurrences (words[i], i == words.size () - 1);
+		if (i == 0) {
+			matches = std::move (word_matches);
+			continue;
+		}
+		std::vector<std::pair<int, int>> intersection;
+		auto a = matches.begin ();
+		auto b = word_matches.begin ();
+		while (a != matches.end () && b != word_matches.end ()) {
+			if (a->first < b->first) {
+				++a;
+			} else if (b->first < a->first) {
+				++b;
+			} else {
+				intersection.emplace_back (a->first, a->second + b->second);
+				++a;
+				++b;
+			}
+		}
+		matches = std::move (intersection);
+	}
+
+	std::stable_sort (matches.begin (), matches.end (),
+	                  [](const std::pair<int, int> & a, const std::pair<int, int> & b) {
+		                  return a.second > b.second;
+	                  });
+	std::vector<int> slide_indexes;
+	slide_indexes.reserve (matches.size ());
+	for (const auto & match : matches)
+		slide_indexes.push_back (match.first);
+	return slide_indexes;
+}
+
+std::vector<std::pair<int, int>> SearchIndex::occurrences (const QString & word,
+                                                           bool as_prefix) const {
+	auto it =
+	    std::lower_bound (entries_.begin (), entries_.end (), word,
+	                      [](const Entry & entry, const QString & w) { return entry.word < w; });
+	if (!as_prefix)
+		return it != entries_.end () && it->word == word ? it->slides
+		                                                 : std::vector<std::pair<int, int>> ();
+	// Merge the slides of all words with this prefix
+	std::map<int, int> merged;
+	for (; it != entries_.end () && it->word.startsWith (word); ++it) {
+		for (const auto & slide : it->slides)
+			merged[slide.first] += slide.second;
+	}
+	return {merged.begin (), merged.end ()};
+}
+
+// SearchIndexTask
+
+void SearchIndexTask::run () {
+	QElapsedTimer timer;
+	timer.start ();
+
+	std::vector<QString> slide_texts;
+	slide_texts.reserve (document_->nb_slides ());
+	for (int slide_index = 0; slide_index < document_->nb_slides (); ++slide_index) {
+		const auto * slide = document_->slide (slide_index);
+		QString text;
+		for (const auto * page = slide->first_page (); page != nullptr; page = page->next_page ()) {
+			if (*cancelled_)
+				return;
+			text += page->extract_text ();
+			text += '\n';
+			if (page == slide->last_page ())
+				break;
+		}
+		text += slide->annotations ();
+		slide_texts.push_back (std::move (text));
+	}
+
+	auto * index = new SearchIndex (std::move (slide_texts));
+	qDebug () << QString ("Search index: %1 slides, %2 words, in %3 ms")
+	                 .arg (index->nb_slides ())
+	                 .arg (index->nb_words ())
+	                 .arg (timer.elapsed ());
+	emit finished_index (generation_, index);
+}
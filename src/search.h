@@ -0,0 +1,95 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <QMetaType>
+#include <QObject>
+#include <QRunnable>
+#include <QString>
+#include <QStringList>
+
+class Document;
+
+/* Full-text search over slides, for the presenter search prompt.
+ *
+ * Words are case folded, without diacritics ("Débit" matches "debit").
+ * They are separated by anything else than letters and digits.
+ *
+ * SearchIndex is an inverted index: for each word, the slides containing it, with occurrences.
+ * Words are sorted, so words starting with a prefix are contiguous.
+ * A query matches the slides containing all its words.
+ * The last word is matched as a prefix, so results are useful while typing.
+ * Results are sorted by occurrences of the query words, then by slide index.
+ * Slide texts are kept to show an excerpt of the results.
+ */
+QStringList words_of (const QString & text);
+
+class SearchIndex {
+private:
+	struct Entry {
+		QString word;
+		std::vector<std::pair<int, int>> slides; // (slide index, occurrences), by slide index
+	};
+	std::vector<Entry> entries_; // Sorted by word
+	std::vector<QString> slide_texts_;
+
+public:
+	explicit SearchIndex (std::vector<QString> slide_texts); // By slide index
+
+	int nb_slides () const { return static_cast<int> (slide_texts_.size ()); }
+	int nb_words () const { return static_cast<int> (entries_.size ()); }
+	const QString & slide_text (int slide_index) const { return slide_texts_.at (slide_index); }
+
+	std::vector<int> search (const QString & query) const; // Slide indexes, best first
+
+private:
+	// Occurrences by slide of a word (or of all words starting with it), by slide index
+	std::vector<std::pair<int, int>> occurrences (const QString & word, bool as_prefix) const;
+};
+
+/* "Build the search index of a document" task for QThreadPool.
+ * The text of each slide is the text of its pages, and its pdfpc annotations.
+ * Text extraction is slow (Poppler): the task should run as a background task (see
+ * background_tasks.h).
+ * It can be cancelled between pages. The index is transmitted as an owning raw pointer.
+ */
+class SearchIndexTask : public QObject, public QRunnable {
+	Q_OBJECT
+
+private:
+	const int generation_;
+	const Document * document_;
+	const std::shared_ptr<const std::atomic<bool>> cancelled_;
+
+public:
+	SearchIndexTask (int generation, const Document * document,
+	                 std::shared_ptr<const std::atomic<bool>> cancelled)
+	    : generation_ (generation), document_ (document), cancelled_ (std::move (cancelled)) {}
+
+signals:
+	void finished_index (int generation, SearchIndex * index);
+
+public:
+	void run () Q_DECL_FINAL;
+};
+
+Q_DECLARE_METATYPE (SearchIndex *);
@@ -0,0 +1,160 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include <QMutexLocker>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+#include "slab_allocator.h"
+
+namespace {
+qint64 round_up (qint64 size, qint64 multiple) {
+	return ((size + multiple - 1) / multiple) * multiple;
+}
+
+/* Slabs and lone blocks are obtained directly from the system when possible (mmap).
+ * malloc may keep freed big chunks in its heap (adaptive mmap threshold of glibc).
+ */
+char * system_allocate (qint64 bytes) {
+#ifdef Q_OS_UNIX
+	void * memory = mmap (nullptr, static_cast<std::size_t> (bytes), PROT_READ | PROT_WRITE,
+	                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return memory != MAP_FAILED ? static_cast<char *> (memory) : nullptr;
+#else
+	return static_cast<char *> (std::malloc (static_cast<std::size_t> (bytes)));
+#endif
+}
+void system_free (char * memory, qint64 bytes) {
+#ifdef Q_OS_UNIX
+	munmap (memory, static_cast<std::size_t> (bytes));
+#else
+	Q_UNUSED (bytes);
+	std::free (memory);
+#endif
+}
+} // namespace
+
+SlabAllocator::SlabAllocator () {
+	// Geometric classes (ratio 2^(1/4)), page multiples
+	const double class_ratio = std::pow (2., 0.25);
+	for (qint64 size = min_class_size; size <= max_class_size;) {
+		auto slots = static_cast<int> (std::max<qint64> (1, slab_size / size));
+		classes_.push_back (SizeClass{size, slots, {}});
+		size = round_up (static_cast<qint64> (std::ceil (size * class_ratio)), page_size);
+	}
+}
+
+SlabAllocator::~SlabAllocator () {
+	// Slabs are released with their last block: none is left once all blocks have been freed
+	Q_ASSERT (stats_.bytes_in_use == 0);
+}
+
+SlabAllocator::Block SlabAllocator::allocate (qint64 size) {
+	QMutexLocker lock (&mutex_);
+	Block block;
+	auto it = std::lower_bound (
+	    classes_.begin (), classes_.end (), size,
+	    [](const SizeClass & size_class, qint64 s) { return size_class.slot_size < s; });
+	if (it == classes_.end ()) {
+		// Alone
+		block.capacity = round_up (size, page_size);
+		block.data = system_allocate (block.capacity);
+		if (block.data == nullptr)
+			return {};
+		++stats_.lone_blocks;
+		stats_.bytes_reserved += block.capacity;
+	} else {
+		auto size_class = static_cast<int> (it - classes_.begin ());
+		if (it->partial_slabs.empty () && new_slab (size_class) == nullptr)
+			return {};
+		auto * slab = it->partial_slabs.back ();
+		auto slot = slab->free_slots.back ();
+		slab->free_slots.pop_back ();
+		++slab->nb_used;
+		if (slab->free_slots.empty ()) {
+			it->partial_slabs.pop_back ();
+			slab->in_partial_list = false;
+		}
+		block.data = slab->memory + slot * it->slot_size;
+		block.capacity = it->slot_size;
+		block.size_class = size_class;
+		block.slab = slab;
+	}
+	stats_.bytes_in_use += block.capacity;
+	stats_.peak_bytes_reserved = std::max (stats_.peak_bytes_reserved, stats_.bytes_reserved);
+	return block;
+}
+
+void SlabAllocator::deallocate (const Block & block) {
+	if (block.data == nullptr)
+		return;
+	QMutexLocker lock (&mutex_);
+	stats_.bytes_in_use -= block.capacity;
+	if (block.size_class < 0) {
+		system_free (block.data, block.capacity);
+		stats_.bytes_reserved -= block.capacity;
+		return;
+	}
+	auto & size_class = classes_[block.size_class];
+	auto * slab = static_cast<Slab *> (block.slab);
+	auto slot = static_cast<int> ((block.data - slab->memory) / size_class.slot_size);
+	slab->free_slots.push_back (slot);
+	--slab->nb_used;
+	if (slab->nb_used == 0) {
+		release_slab (slab);
+	} else if (!slab->in_partial_list) {
+		size_class.partial_slabs.push_back (slab);
+		slab->in_partial_list = true;
+	}
+}
+
+SlabAllocator::Statistics SlabAllocator::statistics () const {
+	QMutexLocker lock (&mutex_);
+	return stats_;
+}
+
+SlabAllocator::Slab * SlabAllocator::new_slab (int size_class) {
+	auto & c = classes_[size_class];
+	const auto bytes = c.slot_size * c.slots_per_slab;
+	auto * memory = system_allocate (bytes);
+	if (memory == nullptr)
+		return nullptr;
+	auto * slab = new Slab{memory, size_class, 0, {}, true};
+	// Lowest slots are used first
+	slab->free_slots.reserve (c.slots_per_slab);
+	for (int slot = c.slots_per_slab - 1; slot >= 0; --slot)
+		slab->free_slots.push_back (slot);
+	c.partial_slabs.push_back (slab);
+	++stats_.slabs_allocated;
+	stats_.bytes_reserved += bytes;
+	return slab;
+}
+
+void SlabAllocator::release_slab (Slab * slab) {
+	auto & c = classes_[slab->size_class];
+	if (slab->in_partial_list)
+		c.partial_slabs.erase (std::find (c.partial_slabs.begin (), c.partial_slabs.end (), slab));
+	system_free (slab->memory, c.slot_size * c.slots_per_slab);
+	stats_.bytes_reserved -= c.slot_size * c.slots_per_slab;
+	++stats_.slabs_released;
+	delete slab;
+}
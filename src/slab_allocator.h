@@ -0,0 +1,93 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <vector>
+
+#include <QMutex>
+#include <QtGlobal>
+
+/* Size class allocator for big buffers of varying sizes (compressed renders).
+ *
+ * Sizes are rounded up to a size class (about 19% apart, multiples of the page size).
+ * Buffers of a class are slots of slabs: chunks of about 1MiB obtained from the system.
+ * Freed slots are reused by the next buffers of the same class.
+ * A slab is returned to the system as soon as all its slots are free.
+ * Thus freeing buffers gives memory back, instead of leaving holes in the heap.
+ * Buffers above the biggest class are allocated alone, rounded up to the page size.
+ *
+ * The capacity of a block is the memory it really uses: it should be charged to its owner.
+ * Full slabs are not tracked: all blocks must be freed before the allocator is destroyed.
+ * Thread safe: renders are compressed in worker threads.
+ */
+class SlabAllocator {
+public:
+	struct Block {
+		char * data{nullptr};
+		qint64 capacity{0};
+		int size_class{-1}; // -1 if allocated alone
+		void * slab{nullptr};
+	};
+
+	struct Statistics {
+		qint64 bytes_in_use{0};   // Capacity of live blocks
+		qint64 bytes_reserved{0}; // Slabs and lone blocks obtained from the system
+		qint64 peak_bytes_reserved{0};
+		int slabs_allocated{0};
+		int slabs_released{0};
+		int lone_blocks{0}; // Allocations above the biggest class
+	};
+
+private:
+	static constexpr qint64 page_size = 4096;
+	static constexpr qint64 min_class_size = page_size;
+	static constexpr qint64 max_class_size = 1024 * 1024;
+	static constexpr qint64 slab_size = 1024 * 1024;
+
+	struct Slab {
+		char * memory;
+		int size_class;
+		int nb_used;
+		std::vector<int> free_slots;
+		bool in_partial_list; // Has free slots
+	};
+	struct SizeClass {
+		qint64 slot_size;
+		int slots_per_slab;
+		std::vector<Slab *> partial_slabs; // Slabs with free slots, most recent last
+	};
+
+	mutable QMutex mutex_;
+	std::vector<SizeClass> classes_;
+	Statistics stats_;
+
+public:
+	SlabAllocator ();
+	~SlabAllocator ();
+	SlabAllocator (const SlabAllocator &) = delete;
+	SlabAllocator & operator= (const SlabAllocator &) = delete;
+
+	// Returns a block of at least size bytes (null data if out of memory)
+	Block allocate (qint64 size);
+	void deallocate (const Block & block);
+
+	Statistics statistics () const;
+
+private:
+	Slab * new_slab (int size_class);
+	void release_slab (Slab * slab);
+};
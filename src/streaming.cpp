@@ -0,0 +1,433 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+
+#include <QApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QPainter>
+#include <QPalette>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtDebug>
+
+#include "render_internal.h"
+#include "streaming.h"
+#include "window.h"
+
+namespace Streaming {
+namespace {
+	constexpr int size_field_bytes = sizeof (quint32);
+
+	// Builds a framed message, the payload is written by write_payload (QDataStream &)
+	template <typename WritePayload>
+	QByteArray make_message (MessageType type, WritePayload write_payload) {
+		QByteArray message;
+		QDataStream stream (&message, QIODevice::WriteOnly);
+		stream.setVersion (QDataStream::Qt_5_0);
+		stream << static_cast<quint32> (0) << static_cast<quint8> (type);
+		write_payload (stream);
+		// Patch the size (type and payload)
+		stream.device ()->seek (0);
+		stream << static_cast<quint32> (message.size () - size_field_bytes);
+		return message;
+	}
+
+	QString bandwidth_to_string (qint64 bytes, qint64 elapsed_ms) {
+		return size_in_bytes_to_string (bytes) + " (" +
+		       size_in_bytes_to_string (elapsed_ms > 0 ? bytes * 1000 / elapsed_ms : 0) + "/s)";
+	}
+} // namespace
+
+// MessageReader
+
+void MessageReader::append (const QByteArray & data) {
+	if (!rejected_)
+		buffer_.append (data);
+}
+
+bool MessageReader::next_message (MessageType & type, QByteArray & payload) {
+	if (rejected_ || buffer_.size () < size_field_bytes)
+		return false;
+	quint32 size = 0;
+	{
+		QDataStream stream (buffer_);
+		stream >> size;
+	}
+	if (size > max_message_bytes_) {
+		// Not buffered until complete: the size may be anything
+		rejected_ = true;
+		buffer_.clear ();
+		return false;
+	}
+	if (static_cast<quint32> (buffer_.size () - size_field_bytes) < size)
+		return false;
+	if (size == 0) {
+		// Malformed (no type), skip
+		buffer_.remove (0, size_field_bytes);
+		return false;
+	}
+	type = static_cast<MessageType> (static_cast<quint8> (buffer_[size_field_bytes]));
+	payload = buffer_.mid (size_field_bytes + 1, size - 1);
+	buffer_.remove (0, size_field_bytes + size);
+	return true;
+}
+
+// Tasks
+
+void CompressTask::run () {
+	std::unique_ptr<Render::Compressed> compressed (Render::make_compressed_render (image_));
+	emit finished_compressing (id_, *compressed);
+}
+
+// Leader
+
+Leader::Leader (Render::System & renderer) : renderer_ (renderer) {
+	connect (&server_, &QTcpServer::newConnection, this, &Leader::new_connection);
+}
+Leader::~Leader () {
+	for (const auto & follower : followers_) {
+		qDebug () << QString ("Leader: follower %1 received %2")
+		                 .arg (follower->socket->peerAddress ().toString (),
+		                       bandwidth_to_string (follower->bytes_sent,
+		                                            follower->connected_since.elapsed ()));
+	}
+}
+
+bool Leader::listen (quint16 port, const QHostAddress & address) {
+	auto tr = [](const char * str) { return qApp->translate ("Streaming::Leader", str); };
+	if (!server_.listen (address, port)) {
+		QTextStream (stderr) << tr ("Error: unable to listen for followers on %1 port %2: %3\n")
+		                            .arg (address.toString ())
+		                            .arg (port)
+		                            .arg (server_.errorString ());
+		return false;
+	}
+	qDebug () << "Leader: listening on" << address.toString () << "port" << server_.serverPort ();
+	return true;
+}
+
+void Leader::show_render (const QPixmap & pixmap, const Render::Info & render_info) {
+	current_id_ = render_id (render_info);
+	has_current_render_ = renderer_.find_cached_render (render_info, current_render_);
+	if (has_current_render_) {
+		for (auto & follower : followers_)
+			send_current_render (*follower);
+	} else {
+		// Not in the cache (bigger than the whole cache): compress the shown pixmap
+		auto * task = new CompressTask (current_id_, pixmap.toImage ());
+		connect (task, &CompressTask::finished_compressing, this, &Leader::compression_finished);
+		QThreadPool::globalInstance ()->start (task);
+	}
+}
+
+void Leader::compression_finished (quint64 id, Render::Compressed compressed) {
+	if (id != current_id_)
+		return; // Another render was shown since
+	current_render_ = std::move (compressed);
+	has_current_render_ = true;
+	for (auto & follower : followers_)
+		send_current_render (*follower);
+}
+
+void Leader::change_document () {
+	// Ids reference renders of the old document
+	render_ids_.clear ();
+	current_id_ = 0;
+	has_current_render_ = false;
+	auto reset = make_message (MessageType::Reset, [](QDataStream &) {});
+	for (auto & follower : followers_) {
+		follower->sent_renders.clear ();
+		send (*follower, reset);
+	}
+}
+
+void Leader::new_connection () {
+	while (auto * socket = server_.nextPendingConnection ()) {
+		socket->setSocketOption (QAbstractSocket::LowDelayOption, 1);
+		auto * follower = new Follower;
+		follower->socket = socket;
+		follower->connected_since.start ();
+		followers_.emplace_back (follower);
+		qDebug () << "Leader: new follower" << socket->peerAddress ().toString ();
+		connect (socket, &QTcpSocket::readyRead, this,
+		         [this, follower]() { read_messages (*follower); });
+		connect (socket, &QTcpSocket::disconnected, this, [this, socket]() { disconnected (socket); });
+		send_current_render (*follower);
+	}
+}
+
+void Leader::read_messages (Follower & follower) {
+	follower.reader.append (follower.socket->readAll ());
+	MessageType type;
+	QByteArray payload;
+	while (follower.reader.next_message (type, payload)) {
+		if (type != MessageType::Need)
+			continue;
+		QDataStream stream (payload);
+		stream.setVersion (QDataStream::Qt_5_0);
+		quint64 id = 0;
+		stream >> id;
+		// Only the current render can still be needed, others are outdated
+		if (has_current_render_ && id == current_id_) {
+			follower.sent_renders.remove (id);
+			send_current_render (follower);
+		}
+	}
+	if (follower.reader.rejected ()) {
+		qDebug () << "Leader: follower" << follower.socket->peerAddress ().toString ()
+		          << "sent a message too large, disconnecting";
+		follower.socket->abort (); // Emits disconnected
+	}
+}
+
+quint64 Leader::render_id (const Render::Info & render_info) {
+	auto it = render_ids_.find (render_info);
+	if (it != render_ids_.end ())
+		return it.value ();
+	if (render_ids_.size () >= max_render_ids)
+		forget_old_render_ids ();
+	return render_ids_.insert (render_info, ++last_render_id_).value ();
+}
+
+void Leader::forget_old_render_ids () {
+	// Oldest half, by id. Followers cannot be sent these ids again: forget them too.
+	const quint64 oldest_kept = last_render_id_ - max_render_ids / 2;
+	for (auto it = render_ids_.begin (); it != render_ids_.end ();) {
+		if (it.value () <= oldest_kept && it.value () != current_id_)
+			it = render_ids_.erase (it);
+		else
+			++it;
+	}
+	for (auto & follower : followers_) {
+		for (auto it = follower->sent_renders.begin (); it != follower->sent_renders.end ();) {
+			if (*it <= oldest_kept && *it != current_id_)
+				it = follower->sent_renders.erase (it);
+			else
+				++it;
+		}
+	}
+}
+
+void Leader::disconnected (QTcpSocket * socket) {
+	auto it = std::find_if (
+	    followers_.begin (), followers_.end (),
+	    [socket](const std::unique_ptr<Follower> & follower) { return follower->socket == socket; });
+	if (it != followers_.end ()) {
+		const auto & follower = **it;
+		qDebug () << QString ("Leader: follower %1 disconnected, received %2")
+		                 .arg (socket->peerAddress ().toString (),
+		                       bandwidth_to_string (follower.bytes_sent,
+		                                            follower.connected_since.elapsed ()));
+		followers_.erase (it);
+	}
+	socket->deleteLater ();
+}
+
+void Leader::send_current_render (Follower & follower) {
+	if (!has_current_render_)
+		return;
+	if (!follower.sent_renders.contains (current_id_)) {
+		send (follower, make_message (MessageType::Render, [this](QDataStream & stream) {
+			      stream << current_id_ << current_render_.size
+			             << static_cast<qint32> (current_render_.bytes_per_line)
+			             << static_cast<qint32> (current_render_.image_format)
+			             << current_render_.data.bytes ();
+		      }));
+		follower.sent_renders.insert (current_id_);
+	}
+	send (follower, make_message (MessageType::Show, [this](QDataStream & stream) {
+		      stream << current_id_ << QDateTime::currentMSecsSinceEpoch ();
+	      }));
+}
+
+void Leader::send (Follower & follower, const QByteArray & message) {
+	follower.socket->write (message);
+	follower.bytes_sent += message.size ();
+}
+
+// Follower
+
+Follower::Follower () : cache_ (cache_size_kib) {
+	connect (&socket_, &QTcpSocket::readyRead, this, &Follower::read_messages);
+	connect (&socket_, &QTcpSocket::connected, this, [this]() {
+		socket_.setSocketOption (QAbstractSocket::LowDelayOption, 1);
+		connected_since_.start ();
+		qDebug () << "Follower: connected to" << socket_.peerName ();
+	});
+	connect (&socket_, &QTcpSocket::disconnected, this, &Follower::connection_lost);
+	connect (&socket_,
+	         static_cast<void (QAbstractSocket::*) (QAbstractSocket::SocketError)> (
+	             &QAbstractSocket::error),
+	         this, [this]() { emit connection_lost (); });
+}
+Follower::~Follower () {
+	qDebug () << QString ("Follower: %1 renders shown, received %2")
+	                 .arg (nb_shows_)
+	                 .arg (bandwidth_to_string (bytes_received_, connected_since_.isValid ()
+	                                                                 ? connected_since_.elapsed ()
+	                                                                 : 0));
+	if (nb_shows_ > 0)
+		qDebug () << QString ("Follower: lag %1 ms average, %2 ms max")
+		                 .arg (total_lag_ms_ / nb_shows_)
+		                 .arg (max_lag_ms_);
+}
+
+void Follower::connect_to_leader (const QString & host, quint16 port) {
+	socket_.connectToHost (host, port);
+}
+
+void Follower::read_messages () {
+	auto data = socket_.readAll ();
+	bytes_received_ += data.size ();
+	reader_.append (data);
+	MessageType type;
+	QByteArray payload;
+	while (reader_.next_message (type, payload)) {
+		QDataStream stream (payload);
+		stream.setVersion (QDataStream::Qt_5_0);
+		switch (type) {
+		case MessageType::Render: {
+			quint64 id = 0;
+			QSize size;
+			qint32 bytes_per_line = 0;
+			qint32 image_format = 0;
+			QByteArray data;
+			stream >> id >> size >> bytes_per_line >> image_format >> data;
+			auto * compressed =
+			    new Render::Compressed{Render::CompressedData (data), size, bytes_per_line,
+			                           static_cast<QImage::Format> (image_format)};
+			cache_.insert (id, compressed, Render::cache_cost (*compressed));
+			if (id == pending_show_)
+				show (id, pending_show_time_ms_);
+		} break;
+		case MessageType::Show: {
+			quint64 id = 0;
+			qint64 leader_time_ms = 0;
+			stream >> id >> leader_time_ms;
+			show (id, leader_time_ms);
+		} break;
+		case MessageType::Reset:
+			cache_.clear ();
+			pending_show_ = 0;
+			shown_id_ = 0;
+			break;
+		default:
+			break;
+		}
+	}
+	if (reader_.rejected ()) {
+		qDebug () << "Follower: leader sent a message too large";
+		socket_.abort (); // Emits disconnected: connection lost
+	}
+}
+
+void Follower::show (quint64 id, qint64 leader_time_ms) {
+	const auto * compressed = cache_.object (id);
+	if (compressed == nullptr) {
+		// Evicted, or bigger than the cache: ask again, once
+		if (pending_show_ != id) {
+			pending_show_ = id;
+			pending_show_time_ms_ = leader_time_ms;
+			socket_.write (
+			    make_message (MessageType::Need, [id](QDataStream & stream) { stream << id; }));
+		}
+		return;
+	}
+	pending_show_ = 0;
+	shown_id_ = id;
+	shown_time_ms_ = leader_time_ms;
+	// Renders of the follower have no Info (no document): the id is given to the slot
+	auto * task = new Render::DecompressTask (Render::Info (), *compressed);
+	connect (task, &Render::DecompressTask::finished_decompressing, this,
+	         [this, id](Render::Info, QPixmap pixmap, qint64) {
+		         decompression_finished (id, std::move (pixmap));
+	         });
+	QThreadPool::globalInstance ()->start (task, Render::DecompressTask::priority);
+}
+
+void Follower::decompression_finished (quint64 id, QPixmap pixmap) {
+	if (id != shown_id_)
+		return; // Another render was shown since
+	emit new_frame (pixmap);
+
+	auto lag_ms = QDateTime::currentMSecsSinceEpoch () - shown_time_ms_;
+	++nb_shows_;
+	total_lag_ms_ += lag_ms;
+	max_lag_ms_ = std::max (max_lag_ms_, lag_ms);
+	qDebug () << "Follower: shown with lag" << lag_ms << "ms";
+}
+
+// FollowerView
+
+FollowerView::FollowerView (QWidget * parent) : QWidget (parent) {
+	setWindowTitle (tr ("Follower screen"));
+	QPalette p (palette ());
+	p.setColor (QPalette::Window, Qt::black);
+	setPalette (p);
+	setAutoFillBackground (true);
+}
+
+void FollowerView::paintEvent (QPaintEvent *) {
+	if (pixmap_.isNull ())
+		return;
+	// Scaled to fit if the leader screen size differs, centered
+	auto target_size = pixmap_.size ().scaled (size (), Qt::KeepAspectRatio);
+	QRect target (QPoint ((width () - target_size.width ()) / 2,
+	                      (height () - target_size.height ()) / 2),
+	              target_size);
+	QPainter painter (this);
+	if (target_size != pixmap_.size ())
+		painter.setRenderHint (QPainter::SmoothPixmapTransform);
+	painter.drawPixmap (target, pixmap_);
+}
+
+void FollowerView::show_frame (QPixmap pixmap) {
+	pixmap_ = std::move (pixmap);
+	update ();
+}
+
+// Follower mode
+
+int run_follower (const QString & address) {
+	auto tr = [](const char * str) { return qApp->translate ("Streaming::run_follower", str); };
+	auto separator = address.lastIndexOf (':');
+	bool port_ok = false;
+	auto port = address.mid (separator + 1).toUShort (&port_ok);
+	if (separator <= 0 || !port_ok) {
+		QTextStream (stderr) << tr ("Error: invalid leader address \"%1\" (expected host:port)\n")
+		                            .arg (address);
+		return EXIT_FAILURE;
+	}
+
+	Follower follower;
+	Window window;
+	auto * view = new FollowerView;
+	window.setCentralWidget (view);
+	window.setWindowTitle (view->windowTitle ());
+	QObject::connect (&follower, &Follower::new_frame, view, &FollowerView::show_frame);
+	QObject::connect (&follower, &Follower::connection_lost, [&follower, &address, tr]() {
+		QTextStream (stderr) << tr ("Error: connection to leader \"%1\" lost\n").arg (address);
+		QApplication::exit (EXIT_FAILURE);
+	});
+	follower.connect_to_leader (address.left (separator), port);
+	window.show ();
+	return QApplication::exec ();
+}
+} // namespace Streaming
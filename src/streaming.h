@@ -0,0 +1,216 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QByteArray>
+#include <QCache>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QImage>
+#include <QObject>
+#include <QPixmap>
+#include <QRunnable>
+#include <QSet>
+#include <QString>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QWidget>
+
+#include "render.h"
+class Document;
+
+/* Streaming of the presentation screen to other pdftalk instances (followers), over TCP.
+ * Used to show the slides in overflow rooms, without rasterizing the document again.
+ *
+ * The leader sends the Compressed renders of its presentation screen, taken from its render cache.
+ * Followers keep them in a cache, and only decompress them: they do not use Poppler at all.
+ * Renders are identified by an id, given by the leader to each distinct Render::Info (never 0).
+ * Ids are valid until the next Reset. The leader forgets the oldest ids after a while: a render
+ * shown again after that gets a new id, and is sent again.
+ * The codec never runs in the GUI thread: the leader compresses renders missing from its cache,
+ * and followers decompress renders, in the thread pool.
+ *
+ * Messages are framed by their size (uint32), followed by a type (uint8), in QDataStream format:
+ * - Render (leader): id, size, bytes per line, image format, compressed data,
+ * - Show (leader): id, leader time (ms since epoch) when the render was shown,
+ * - Reset (leader): the document changed, ids are no longer valid,
+ * - Need (follower): id of a render to send again (evicted from the follower cache).
+ * The leader remembers which renders each follower has: a render is only sent once.
+ * A message larger than the maximum of its direction closes the connection.
+ *
+ * Streams are not authenticated: the leader listens on the loopback interface by default.
+ * Lag is measured with the leader time of Show: it assumes synchronized clocks (exact on loopback).
+ */
+namespace Streaming {
+enum class MessageType : quint8 { Render = 1, Show = 2, Reset = 3, Need = 4 };
+
+// Maximum message sizes (type and payload). A raw 8K ARGB32 render is 127 MiB.
+constexpr quint32 max_leader_message_bytes = 128 << 20;
+constexpr quint32 max_follower_message_bytes = 1024;
+
+// Splits the incoming byte stream into messages
+class MessageReader {
+private:
+	const quint32 max_message_bytes_;
+	QByteArray buffer_;
+	bool rejected_{false};
+
+public:
+	explicit MessageReader (quint32 max_message_bytes) : max_message_bytes_ (max_message_bytes) {}
+
+	void append (const QByteArray & data);
+	// Extract the next complete message (type and payload). Returns false if none.
+	bool next_message (MessageType & type, QByteArray & payload);
+	// A message was too large: the stream cannot be read anymore
+	bool rejected () const { return rejected_; }
+};
+
+/* "Compress a shown image" task for QThreadPool (leader, render missing from the cache).
+ * The Compressed is transmitted by value (copies share the data): it is released even if the
+ * Leader is destroyed before the signal is delivered.
+ */
+class CompressTask : public QObject, public QRunnable {
+	Q_OBJECT
+
+private:
+	const quint64 id_;
+	const QImage image_;
+
+public:
+	CompressTask (quint64 id, const QImage & image) : id_ (id), image_ (image) {}
+
+signals:
+	void finished_compressing (quint64 id, Render::Compressed compressed);
+
+public:
+	void run () Q_DECL_FINAL;
+};
+
+class Leader : public QObject {
+	Q_OBJECT
+
+private:
+	struct Follower {
+		QTcpSocket * socket; // Child of the server
+		QSet<quint64> sent_renders;
+		MessageReader reader{max_follower_message_bytes};
+		qint64 bytes_sent{0};
+		QElapsedTimer connected_since;
+	};
+
+	Render::System & renderer_;
+	QTcpServer server_;
+	std::vector<std::unique_ptr<Follower>> followers_;
+
+	// Ids of the last renders shown, cleared by Reset
+	static constexpr int max_render_ids = 1024;
+	QHash<Render::Info, quint64> render_ids_;
+	quint64 last_render_id_{0};
+
+	// Currently shown render (not available while it is compressed)
+	quint64 current_id_{0};
+	Render::Compressed current_render_;
+	bool has_current_render_{false};
+
+public:
+	explicit Leader (Render::System & renderer);
+	~Leader ();
+
+	// Returns false on error. Other addresses than loopback expose the stream to the network.
+	bool listen (quint16 port, const QHostAddress & address = QHostAddress::LocalHost);
+
+public slots:
+	void show_render (const QPixmap & pixmap, const Render::Info & render_info);
+	void change_document ();
+
+private slots:
+	void new_connection ();
+	void compression_finished (quint64 id, Render::Compressed compressed);
+
+private:
+	quint64 render_id (const Render::Info & render_info);
+	void forget_old_render_ids ();
+	void read_messages (Follower & follower);
+	void disconnected (QTcpSocket * socket);
+	void send_current_render (Follower & follower);
+	void send (Follower & follower, const QByteArray & message);
+};
+
+class Follower : public QObject {
+	Q_OBJECT
+
+private:
+	static constexpr int cache_size_kib = 256 * 1024; // Compressed renders
+
+	QTcpSocket socket_;
+	MessageReader reader_{max_leader_message_bytes};
+	QCache<quint64, Render::Compressed> cache_; // Costs in KiB
+	quint64 pending_show_{0};                   // Shown render not received yet, 0 if none
+	qint64 pending_show_time_ms_{0};
+	quint64 shown_id_{0}; // Last shown render, being decompressed or shown, 0 if none
+	qint64 shown_time_ms_{0};
+
+	// Statistics
+	QElapsedTimer connected_since_;
+	qint64 bytes_received_{0};
+	int nb_shows_{0};
+	qint64 total_lag_ms_{0};
+	qint64 max_lag_ms_{0};
+
+public:
+	Follower ();
+	~Follower ();
+
+	void connect_to_leader (const QString & host, quint16 port);
+
+signals:
+	void new_frame (QPixmap pixmap);
+	void connection_lost ();
+
+private slots:
+	void read_messages ();
+
+private:
+	void show (quint64 id, qint64 leader_time_ms);
+	void decompression_finished (quint64 id, QPixmap pixmap);
+};
+
+/* Shows the frames received by a Follower, centered and scaled to fit (black background).
+ */
+class FollowerView : public QWidget {
+	Q_OBJECT
+
+private:
+	QPixmap pixmap_;
+
+public:
+	explicit FollowerView (QWidget * parent = nullptr);
+	void paintEvent (QPaintEvent *) Q_DECL_FINAL;
+
+public slots:
+	void show_frame (QPixmap pixmap);
+};
+
+/* Runs pdftalk as a follower of the leader at address (host:port), until the window is closed.
+ * Returns the exit code.
+ */
+int run_follower (const QString & address);
+} // namespace Streaming
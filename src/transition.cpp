@@ -0,0 +1,177 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+
+#include <QDebug>
+#include <QPainter>
+#include <QRectF>
+#include <QString>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "transition.h"
+
+// Blend kernel
+
+static void blend_bytes (uchar * out, const uchar * from, const uchar * to, int nb_bytes,
+                         int weight) {
+	int i = 0;
+#ifdef __SSE2__
+	// 16 bytes at a time, widened to 16 bit lanes: 255 * 256 fits
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i from_weight = _mm_set1_epi16 (static_cast<short> (256 - weight));
+	const __m128i to_weight = _mm_set1_epi16 (static_cast<short> (weight));
+	for (; i + 16 <= nb_bytes; i += 16) {
+		const __m128i f = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (from + i));
+		const __m128i t = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (to + i));
+		const __m128i low =
+		    _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (f, zero), from_weight),
+		                   _mm_mullo_epi16 (_mm_unpacklo_epi8 (t, zero), to_weight));
+		const __m128i high =
+		    _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (f, zero), from_weight),
+		                   _mm_mullo_epi16 (_mm_unpackhi_epi8 (t, zero), to_weight));
+		_mm_storeu_si128 (reinterpret_cast<__m128i *> (out + i),
+		                  _mm_packus_epi16 (_mm_srli_epi16 (low, 8), _mm_srli_epi16 (high, 8)));
+	}
+#endif
+	for (; i < nb_bytes; ++i)
+		out[i] = static_cast<uchar> ((from[i] * (256 - weight) + to[i] * weight) >> 8);
+}
+
+void blend_images (QImage & result, const QImage & from, const QImage & to, int weight) {
+	Q_ASSERT (from.size () == to.size ());
+	Q_ASSERT (from.format () == to.format ());
+	Q_ASSERT (0 <= weight && weight <= 256);
+	if (result.size () != from.size () || result.format () != from.format ())
+		result = QImage (from.size (), from.format ());
+	const int row_bytes = from.width () * from.depth () / 8;
+	for (int y = 0; y < from.height (); ++y)
+		blend_bytes (result.scanLine (y), from.constScanLine (y), to.constScanLine (y), row_bytes,
+		             weight);
+}
+
+// TransitionCompositor
+
+TransitionCompositor::~TransitionCompositor () {
+	if (nb_frames_ > 0)
+		qDebug () << QString ("Transitions: %1 played, %2 frames, %3 ms compositing per frame "
+		                      "(max %4), %5 over budget")
+		                 .arg (nb_transitions_)
+		                 .arg (nb_frames_)
+		                 .arg (static_cast<double> (compositing_ns_) / (nb_frames_ * 1e6))
+		                 .arg (static_cast<double> (max_compositing_ns_) / 1e6)
+		                 .arg (nb_missed_frames_);
+}
+
+bool TransitionCompositor::start (const PageTransition & transition, const QImage & from,
+                                  const QImage & to) {
+	finish ();
+	if (transition.type == PageTransition::Type::Replace || transition.duration_s <= 0.)
+		return false;
+	// Renders of pages with different sizes, or from different profiles, cannot be blended
+	if (from.isNull () || from.size () != to.size () || from.format () != to.format () ||
+	    from.depth () % 8 != 0)
+		return false;
+	transition_ = transition;
+	from_ = from;
+	to_ = to;
+	clock_.start ();
+	running_ = true;
+	nb_transitions_++;
+	return true;
+}
+
+void TransitionCompositor::paint (QPainter & painter, const QPointF & top_left) {
+	if (!running_)
+		return;
+	QElapsedTimer timer;
+	timer.start ();
+
+	const qreal progress = clock_.nsecsElapsed () / (transition_.duration_s * 1e9);
+	if (progress >= 1.) {
+		finish ();
+		painter.drawImage (top_left, to_);
+		from_ = QImage (); // Release the outgoing render, keep the fade buffer for the next one
+		return;
+	}
+
+	if (transition_.type == PageTransition::Type::Fade) {
+		// frame_ is only reallocated by the first frame, or if the render size changed
+		blend_images (frame_, from_, to_, static_cast<int> (std::lround (progress * 256.)));
+		frame_.setDevicePixelRatio (to_.devicePixelRatio ());
+		painter.drawImage (top_left, frame_);
+	} else {
+		/* Wipe: the incoming render is uncovered from one side.
+		 * Both parts are complementary (in device pixels), so each pixel is painted once.
+		 */
+		const QRectF whole (QPointF (0, 0), to_.size ());
+		QRectF incoming = whole;
+		QRectF outgoing = whole;
+		switch (transition_.angle) {
+		case 90: // Bottom to top
+			incoming.setTop (std::round (whole.height () * (1. - progress)));
+			outgoing.setBottom (incoming.top ());
+			break;
+		case 180: // Right to left
+			incoming.setLeft (std::round (whole.width () * (1. - progress)));
+			outgoing.setRight (incoming.left ());
+			break;
+		case 270: // Top to bottom
+			incoming.setBottom (std::round (whole.height () * progress));
+			outgoing.setTop (incoming.bottom ());
+			break;
+		default: // Left to right
+			incoming.setRight (std::round (whole.width () * progress));
+			outgoing.setLeft (incoming.right ());
+			break;
+		}
+		const qreal ratio = to_.devicePixelRatio ();
+		if (!outgoing.isEmpty ())
+			painter.drawImage (top_left + outgoing.topLeft () / ratio, from_, outgoing);
+		if (!incoming.isEmpty ())
+			painter.drawImage (top_left + incoming.topLeft () / ratio, to_, incoming);
+	}
+
+	const auto ns = timer.nsecsElapsed ();
+	nb_frames_++;
+	compositing_ns_ += ns;
+	max_compositing_ns_ = std::max (max_compositing_ns_, ns);
+	transition_frames_++;
+	transition_max_ns_ = std::max (transition_max_ns_, ns);
+	if (ns > frame_budget_ns) {
+		nb_missed_frames_++;
+		transition_missed_frames_++;
+	}
+}
+
+void TransitionCompositor::finish () {
+	if (running_ && transition_missed_frames_ > 0)
+		qDebug () << QString ("Transition: %1 of %2 frames over the %3 ms budget (max %4 ms), %5x%6")
+		                 .arg (transition_missed_frames_)
+		                 .arg (transition_frames_)
+		                 .arg (static_cast<double> (frame_budget_ns) / 1e6)
+		                 .arg (static_cast<double> (transition_max_ns_) / 1e6)
+		                 .arg (to_.width ())
+		                 .arg (to_.height ());
+	running_ = false;
+	transition_frames_ = 0;
+	transition_missed_frames_ = 0;
+	transition_max_ns_ = 0;
+}
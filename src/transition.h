@@ -0,0 +1,79 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <QElapsedTimer>
+#include <QImage>
+#include <QPointF>
+
+#include "document.h"
+class QPainter;
+
+/* CPU compositing of page transitions (see PageTransition).
+ *
+ * A transition goes from the outgoing frame to the incoming frame, which are renders of equal size.
+ * Frames are composited at painting time, from the time elapsed since the start.
+ * Fades blend both frames into a buffer reused by all frames, with a vectorized kernel.
+ * Wipes need no blending: each frame paints complementary parts of both renders.
+ *
+ * Compositing runs in the GUI thread: the render threads are left to render the next pages.
+ * Frames over the frame budget (60 Hz) are reported at the end of their transition.
+ * Statistics (compositing time per frame) are printed at destruction.
+ */
+class TransitionCompositor {
+private:
+	PageTransition transition_;
+	QImage from_;
+	QImage to_;
+	QImage frame_; // Fade blend buffer
+	QElapsedTimer clock_;
+	bool running_{false};
+
+	// Statistics
+	int nb_transitions_{0};
+	int nb_frames_{0};
+	int nb_missed_frames_{0};
+	qint64 compositing_ns_{0};
+	qint64 max_compositing_ns_{0};
+	// Frames of the running transition
+	int transition_frames_{0};
+	int transition_missed_frames_{0};
+	qint64 transition_max_ns_{0};
+
+public:
+	static constexpr qint64 frame_budget_ns = 16600000; // 60 Hz
+
+	TransitionCompositor () = default;
+	~TransitionCompositor ();
+
+	// Start a transition. Returns false if it cannot be played (instant change instead).
+	bool start (const PageTransition & transition, const QImage & from, const QImage & to);
+	void stop () { finish (); }
+	bool is_running () const { return running_; }
+
+	// Paint the current frame at top_left (device independent pixels). Stops at the end.
+	void paint (QPainter & painter, const QPointF & top_left);
+
+private:
+	void finish (); // Reports missed frames of the transition
+};
+
+/* Fade kernel: result = (from * (256 - weight) + to * weight) / 256, for each byte.
+ * weight is in [0, 256]. Images must have the same size and format, result is reallocated if not.
+ * Uses SSE2 if available (always on x86_64), with a scalar fallback.
+ */
+void blend_images (QImage & result, const QImage & from, const QImage & to, int weight);
@@ -14,85 +14,267 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <cstdlib>
+
 #include <QFont>
 #include <QHBoxLayout>
+#include <QKeyEvent>
+#include <QKeySequence>
 #include <QMouseEvent>
+#include <QPaintEvent>
+#include <QPainter>
 #include <QPalette>
+#include <QPen>
+#include <QResizeEvent>
+#include <QScreen>
+#include <QScrollBar>
+#include <QShortcut>
 #include <QSizeF>
 #include <QSizePolicy>
+#include <QStyle>
+#include <QTextOption>
+#include <QThreadPool>
 #include <QVBoxLayout>
+#include <QWindow>
 
 #include "document.h"
+#include "overlay.h"
+#include "render_backend.h"
+#include "search.h"
+#include "utils.h"
 #include "views.h"
 
 // PageViewer
 
-PageViewer::PageViewer (const ViewRole & role, QWidget * parent) : QLabel (parent), role_ (role) {
-	setScaledContents (false);
-	setAlignment (Qt::AlignCenter);
-	setMinimumSize (1, 1); // To prevent nil QLabel when no pixmap is available
-	QSizePolicy policy{QSizePolicy::Expanding, QSizePolicy::Expanding};
-	policy.setHeightForWidth (true);
-	setSizePolicy (policy);
+PageViewer::PageViewer (const ViewRole & role, QWidget * parent)
+    : QWidget (parent), role_ (role), profile_ (Render::default_profile_for_role (role)) {
+	setMinimumSize (1, 1);
+	// Size is given by the layout only: no size hint, no height for width
+	setSizePolicy (QSizePolicy::Expanding, QSizePolicy::Expanding);
+	setMouseTracking (true); // For link hover detection
+}
+PageViewer::~PageViewer () {
+	if (nb_flips_ > 0)
+		qDebug () << QString ("Flip to paint (%1): %2 flips, %3 ms average (max %4)")
+		                 .arg (objectName ())
+		                 .arg (nb_flips_)
+		                 .arg (static_cast<double> (total_flip_ns_) / (nb_flips_ * 1e6))
+		                 .arg (static_cast<double> (max_flip_ns_) / 1e6);
 }
 
-int PageViewer::heightForWidth (int w) const {
-	if (current_render_.isNull ()) {
-		return QLabel::heightForWidth (w);
-	} else {
-		return current_render_.page ()->height_for_width_ratio () * w;
-	}
+void PageViewer::set_render_profile (Render::Profile profile) {
+	profile_ = profile;
+	update_render (RedrawCause::Resize);
+}
+void PageViewer::set_overlay (Overlay * overlay, bool interactive) {
+	Q_ASSERT (overlay != nullptr);
+	overlay_ = overlay;
+	overlay_input_ = interactive;
+	connect (overlay, &Overlay::changed, this, &PageViewer::overlay_changed);
+	if (interactive)
+		connect (overlay, &Overlay::tool_changed, this, &PageViewer::update_cursor);
 }
-QSize PageViewer::sizeHint () const {
-	return {width (), heightForWidth (width ())};
+
+void PageViewer::set_alignment (Qt::Alignment alignment) {
+	alignment_ = alignment;
+	update ();
 }
 
+void PageViewer::showEvent (QShowEvent *) {
+	// The window handle exists once the window is shown: follow the screen of the window from now
+	auto * window = this->window ()->windowHandle ();
+	if (window == nullptr || window == watched_window_)
+		return;
+	if (watched_window_ != nullptr)
+		disconnect (watched_window_, &QWindow::screenChanged, this, &PageViewer::screen_changed);
+	watched_window_ = window;
+	connect (window, &QWindow::screenChanged, this, &PageViewer::screen_changed);
+	screen_changed (window->screen ());
+}
 void PageViewer::resizeEvent (QResizeEvent *) {
-	update_label (RedrawCause::Resize);
+	update_render (RedrawCause::Resize);
+}
+void PageViewer::paintEvent (QPaintEvent * event) {
+	paint_page (event);
+	if (overlay_ != nullptr && !shown_render_.isNull ()) {
+		QPainter painter (this);
+		overlay_->paint (painter, shown_render_.page (), page_rect (), event->rect ());
+	}
+	if (flip_paint_pending_) {
+		flip_paint_pending_ = false;
+		const auto ns = flip_clock_.nsecsElapsed ();
+		flip_clock_.invalidate ();
+		nb_flips_++;
+		total_flip_ns_ += ns;
+		max_flip_ns_ = std::max (max_flip_ns_, ns);
+	}
+}
+void PageViewer::paint_page (QPaintEvent *) {
+	if (!pixmap_.isNull ()) {
+		QPainter painter (this);
+		painter.drawPixmap (shown_pixmap_rect ().topLeft (), pixmap_);
+	}
+}
+
+void PageViewer::mousePressEvent (QMouseEvent * event) {
+	if (overlay_input_ && overlay_->tool () == Overlay::Tool::Ink &&
+	    event->button () == Qt::LeftButton && !shown_render_.isNull ())
+		overlay_->start_stroke (shown_render_.page (), page_coordinates (event->pos ()));
 }
 void PageViewer::mouseReleaseEvent (QMouseEvent * event) {
-	if (event->button () == Qt::LeftButton && !size ().isEmpty () && !current_render_.isNull ()) {
-		// Determine pixmap position (centered)
-		auto label_size = size ();
-		auto pixmap_size = current_render_.size ();
-		auto pixmap_offset_in_label = (label_size - pixmap_size) / 2;
-		// Click position in pixmap
-		auto click_pos_01 =
-		    QPointF (static_cast<qreal> (event->x () - pixmap_offset_in_label.width ()) /
-		                 static_cast<qreal> (pixmap_size.width ()),
-		             static_cast<qreal> (event->y () - pixmap_offset_in_label.height ()) /
-		                 static_cast<qreal> (pixmap_size.height ()));
-		auto * action = current_render_.page ()->on_click (click_pos_01);
+	if (overlay_input_ && overlay_->tool () != Overlay::Tool::None) {
+		overlay_->end_stroke ();
+		return; // Links are disabled while a tool is selected
+	}
+	if (event->button () == Qt::LeftButton) {
+		auto * action = link_at (event->pos ());
 		if (action != nullptr)
 			emit action_activated (action);
 	}
 }
+void PageViewer::mouseMoveEvent (QMouseEvent * event) {
+	if (overlay_input_ && overlay_->tool () != Overlay::Tool::None) {
+		if (shown_render_.isNull ())
+			return;
+		const auto position = page_coordinates (event->pos ());
+		if (overlay_->tool () == Overlay::Tool::Laser) {
+			if (QRectF (0, 0, 1, 1).contains (position)) {
+				overlay_->move_laser (shown_render_.page (), position);
+			} else {
+				overlay_->hide_laser ();
+			}
+		} else if (event->buttons () & Qt::LeftButton) {
+			overlay_->extend_stroke (position);
+		}
+		return;
+	}
+	set_cursor_over_link (link_at (event->pos ()) != nullptr);
+}
+void PageViewer::leaveEvent (QEvent *) {
+	if (overlay_input_)
+		overlay_->hide_laser ();
+}
 
 void PageViewer::change_current_page (const PageInfo * new_current_page, RedrawCause cause) {
+	// Resizes are not flips: they would measure the render time of a new size
+	if (new_current_page != current_page_ && cause != RedrawCause::Resize)
+		flip_clock_.start ();
 	current_page_ = new_current_page;
-	update_label (cause);
+	update_render (cause);
 }
 void PageViewer::receive_pixmap (const Render::Info & render_info, QPixmap pixmap) {
 	// Filter to only use the requested pixmaps
 	if (requested_a_pixmap_ && render_info == current_render_) {
 		requested_a_pixmap_ = false;
-		setPixmap (pixmap);
+		flip_paint_pending_ = flip_clock_.isValid ();
+		show_pixmap (pixmap, render_info, requested_cause_);
+		emit pixmap_shown (pixmap, render_info);
+		emit render_shown (role_, render_info);
 	}
 }
+void PageViewer::show_pixmap (const QPixmap & pixmap, const Render::Info & render_info,
+                              RedrawCause) {
+	pixmap_ = pixmap;
+	shown_render_ = render_info;
+	set_cursor_over_link (false); // Links changed
+	update ();
+}
+
+QRect PageViewer::shown_pixmap_rect () const {
+	return aligned_rect (pixmap_.size () / pixmap_.devicePixelRatio ());
+}
 
-void PageViewer::update_label (RedrawCause cause) {
-	auto request = Render::Request{current_page_, size (), role_, cause};
+void PageViewer::update_render (RedrawCause cause) {
+	auto request =
+	    Render::Request{current_page_, size (), role_, cause, profile_, devicePixelRatioF ()};
 	auto new_render = request.requested_render ();
-	if (new_render != current_render_) {
-		current_render_ = new_render;
-		clear (); // Remove old pixmap
-		if (!current_render_.isNull ()) {
-			requested_a_pixmap_ = true;
-			emit request_render (request);
-		}
+	if (new_render == current_render_) {
+		// Nothing new will be painted, unless the render is still awaited
+		if (!requested_a_pixmap_)
+			flip_clock_.invalidate ();
+		return;
+	}
+	current_render_ = new_render;
+	// The old pixmap (and its geometry, links, overlay) stays shown until the new one is received
+	if (!current_render_.isNull ()) {
+		requested_a_pixmap_ = true;
+		requested_cause_ = cause;
+		emit request_render (request);
+	} else {
+		requested_a_pixmap_ = false;
+		flip_clock_.invalidate (); // No pixmap to wait for
+		pixmap_ = QPixmap ();
+		shown_render_ = Render::Info ();
+		set_cursor_over_link (false);
+		update ();
+		emit render_shown (role_, shown_render_);
+	}
+}
+
+QRect PageViewer::aligned_rect (const QSize & size) const {
+	return QStyle::alignedRect (Qt::LeftToRight, alignment_, size, rect ());
+}
+QRectF PageViewer::page_rect () const {
+	return aligned_rect (shown_render_.size () / shown_render_.device_pixel_ratio ());
+}
+QPointF PageViewer::page_coordinates (const QPoint & pos) const {
+	auto rect = page_rect ();
+	return QPointF ((pos.x () - rect.x ()) / rect.width (), (pos.y () - rect.y ()) / rect.height ());
+}
+
+const Action::Link * PageViewer::link_at (const QPoint & pos) const {
+	if (size ().isEmpty () || shown_render_.isNull ())
+		return nullptr;
+	return shown_render_.page ()->link_at (page_coordinates (pos));
+}
+
+void PageViewer::set_cursor_over_link (bool over_link) {
+	if (over_link != cursor_over_link_) {
+		cursor_over_link_ = over_link;
+		update_cursor ();
+	}
+}
+void PageViewer::update_cursor () {
+	auto tool = overlay_input_ ? overlay_->tool () : Overlay::Tool::None;
+	if (tool == Overlay::Tool::Laser) {
+		setCursor (Qt::BlankCursor); // The dot replaces the cursor
+	} else if (tool == Overlay::Tool::Ink) {
+		setCursor (Qt::CrossCursor);
+	} else if (cursor_over_link_) {
+		setCursor (Qt::PointingHandCursor);
+	} else {
+		unsetCursor ();
 	}
 }
 
+void PageViewer::screen_changed (QScreen * screen) {
+	watch_screen (screen);
+	update_render (RedrawCause::Resize); // Only re-renders if the device pixel ratio changed
+}
+void PageViewer::watch_screen (QScreen * screen) {
+	if (watched_screen_ != nullptr)
+		disconnect (watched_screen_, nullptr, this, nullptr);
+	watched_screen_ = screen;
+	if (screen == nullptr)
+		return;
+	// The device pixel ratio changes with the resolution settings of the screen
+	auto resolution_changed = [this]() { update_render (RedrawCause::Resize); };
+	connect (screen, &QScreen::logicalDotsPerInchChanged, this, resolution_changed);
+	connect (screen, &QScreen::physicalDotsPerInchChanged, this, resolution_changed);
+}
+
+void PageViewer::overlay_changed (const PageInfo * page, const QRectF & area) {
+	if (shown_render_.isNull () || shown_render_.page () != page)
+		return;
+	// Map to widget coordinates, with a margin for antialiasing
+	auto rect = page_rect ();
+	auto damaged =
+	    QRectF (rect.x () + area.x () * rect.width (), rect.y () + area.y () * rect.height (),
+	            area.width () * rect.width (), area.height () * rect.height ());
+	update (damaged.toAlignedRect ().adjusted (-2, -2, 2, 2));
+}
+
 // PresentationView
 
 PresentationView::PresentationView (QWidget * parent)
@@ -106,12 +288,599 @@ PresentationView::PresentationView (QWidget * parent)
 	setAutoFillBackground (true);
 	// Debug identification
 	setObjectName ("presentation/current");
+	// Transition frames
+	frame_timer_.setInterval (16); // 60 fps
+	frame_timer_.setTimerType (Qt::PreciseTimer);
+	connect (&frame_timer_, &QTimer::timeout, this, [this]() { update (); });
+}
+
+void PresentationView::set_transitions_enabled (bool enabled) {
+	transitions_enabled_ = enabled;
+}
+
+void PresentationView::paint_page (QPaintEvent * event) {
+	if (compositor_.is_running ()) {
+		QPainter painter (this);
+		compositor_.paint (painter, shown_pixmap_rect ().topLeft ());
+		if (!compositor_.is_running ())
+			frame_timer_.stop ();
+	} else {
+		PageViewer::paint_page (event);
+	}
+}
+
+void PresentationView::show_pixmap (const QPixmap & pixmap, const Render::Info & render_info,
+                                    RedrawCause cause) {
+	// Raster pixmaps share their data with the image: no copy
+	const auto outgoing = shown_pixmap ().toImage ();
+	PageViewer::show_pixmap (pixmap, render_info, cause);
+	/* A transition interrupted by the next page is skipped: it starts from its incoming render.
+	 * Transitions are only played when moving forward, backward moves and jumps are instant.
+	 */
+	bool animated = false;
+	if (transitions_enabled_ && cause == RedrawCause::ForwardMove)
+		animated = compositor_.start (render_info.page ()->transition (), outgoing, pixmap.toImage ());
+	else
+		compositor_.stop ();
+	if (animated) {
+		frame_timer_.start ();
+	} else {
+		frame_timer_.stop ();
+	}
+}
+
+// NotesViewer
+
+std::unique_ptr<QTextLayout> make_notes_layout (const QString & text, const QFont & font,
+                                                int width) {
+	// QTextLayout does not break lines on '\n'
+	auto layout_text = text;
+	layout_text.replace ('\n', QChar::LineSeparator);
+
+	auto layout = make_unique<QTextLayout> (layout_text, font);
+	QTextOption option;
+	option.setWrapMode (QTextOption::WrapAtWordBoundaryOrAnywhere);
+	layout->setTextOption (option);
+	layout->setCacheEnabled (true);
+
+	layout->beginLayout ();
+	qreal y = 0;
+	for (auto line = layout->createLine (); line.isValid (); line = layout->createLine ()) {
+		line.setLineWidth (width);
+		line.setPosition (QPointF (0, y));
+		y += line.height ();
+	}
+	layout->endLayout ();
+	return layout;
+}
+
+NotesViewer::NotesViewer (QWidget * parent) : QWidget (parent) {
+	// Size does not depend on the content: no relayout of the presenter view on slide change
+	setSizePolicy (QSizePolicy::Preferred, QSizePolicy::Expanding);
+	setMinimumSize (1, 1);
+}
+
+void NotesViewer::paintEvent (QPaintEvent *) {
+	if (current_layout_) {
+		QPainter painter (this);
+		painter.setPen (palette ().color (QPalette::WindowText));
+		current_layout_->draw (&painter, QPointF (0, 0));
+	}
+}
+
+void NotesViewer::resizeEvent (QResizeEvent * event) {
+	if (event->size ().width () != event->oldSize ().width ()) {
+		invalidate_layouts ();
+		if (current_slide_ != nullptr)
+			change_slide (current_slide_);
+	}
+}
+
+void NotesViewer::change_document () {
+	invalidate_layouts ();
+	current_slide_ = nullptr;
+	current_layout_.reset ();
+	update ();
+}
+
+void NotesViewer::change_slide (const SlideInfo * slide) {
+	Q_ASSERT (slide != nullptr);
+	current_slide_ = slide;
+	auto it = layouts_.find (slide->index ());
+	if (it != layouts_.end ()) {
+		current_layout_ = it.value ();
+	} else {
+		current_layout_ = make_notes_layout (slide->annotations (), font (), width ());
+		layouts_.insert (slide->index (), current_layout_);
+	}
+	update ();
+	prepare_neighbourhood ();
+}
+
+void NotesViewer::layout_finished (int generation, int slide_index, NotesLayout layout) {
+	if (generation != generation_)
+		return; // Outdated
+	being_laid_out_.remove (slide_index);
+	if (!layouts_.contains (slide_index))
+		layouts_.insert (slide_index, std::move (layout));
+}
+
+void NotesViewer::invalidate_layouts () {
+	++generation_;
+	layouts_.clear ();
+	being_laid_out_.clear ();
+}
+
+void NotesViewer::prepare_neighbourhood () {
+	// Drop layouts far from the current slide, then lay out neighbours in background
+	const int current_index = current_slide_->index ();
+	for (auto it = layouts_.begin (); it != layouts_.end ();) {
+		if (std::abs (it.key () - current_index) > neighbourhood) {
+			it = layouts_.erase (it);
+		} else {
+			++it;
+		}
+	}
+	const SlideInfo * next = current_slide_;
+	const SlideInfo * previous = current_slide_;
+	for (int distance = 1; distance <= neighbourhood; ++distance) {
+		if (next != nullptr)
+			next = next->next_slide ();
+		if (previous != nullptr)
+			previous = previous->previous_slide ();
+		start_layout (next);
+		start_layout (previous);
+	}
+}
+
+void NotesViewer::start_layout (const SlideInfo * slide) {
+	if (slide == nullptr || layouts_.contains (slide->index ()) ||
+	    being_laid_out_.contains (slide->index ()))
+		return;
+	being_laid_out_.insert (slide->index ());
+	auto * task =
+	    new NotesLayoutTask (generation_, slide->index (), slide->annotations (), font (), width ());
+	connect (task, &NotesLayoutTask::finished_layout, this, &NotesViewer::layout_finished);
+	// Lower priority than page renders
+	QThreadPool::globalInstance ()->start (task, -1);
+}
+
+// ThumbnailTask
+
+void ThumbnailTask::run () {
+	const QSize cell_size = cell_size_ * device_pixel_ratio_;
+	const QSize thumbnail_box =
+	    QSize (cell_size_.width () - 2 * margin_, cell_size_.height () - 2 * margin_) *
+	    device_pixel_ratio_;
+
+	QImage strip (cell_size.width () * static_cast<int> (pages_.size ()), cell_size.height (),
+	              QImage::Format_RGB32);
+	strip.fill (Qt::black);
+	QPainter painter (&strip);
+	QImage buffer;
+	for (std::size_t i = 0; i < pages_.size (); ++i) {
+		if (*cancelled_)
+			return;
+		const Render::Info render_info{pages_[i], thumbnail_box, Render::Profile::Quality,
+		                               device_pixel_ratio_};
+		auto thumbnail = backend_->render (render_info, buffer);
+		auto offset = (cell_size - thumbnail.size ()) / 2;
+		painter.drawImage (static_cast<int> (i) * cell_size.width () + offset.width (),
+		                   offset.height (), thumbnail);
+	}
+	painter.end ();
+	emit finished_thumbnails (generation_, first_slide_index_, strip);
+}
+
+// SlideOverview
+
+SlideOverview::SlideOverview (QWidget * parent) : QAbstractScrollArea (parent) {
+	setFrameShape (QFrame::NoFrame);
+	setHorizontalScrollBarPolicy (Qt::ScrollBarAlwaysOff);
+	setFocusPolicy (Qt::StrongFocus);
+	viewport ()->setAutoFillBackground (true);
+	hide ();
+}
+
+void SlideOverview::paintEvent (QPaintEvent * event) {
+	if (document_ == nullptr)
+		return;
+	QPainter painter (viewport ());
+	const auto & area = event->rect ();
+	const int columns = nb_columns ();
+	const int scroll = verticalScrollBar ()->value ();
+	const int first_row = std::max (0, (area.top () + scroll) / cell_height);
+	const int last_row = (area.bottom () + scroll) / cell_height;
+	const int last_slide = std::min (nb_slides () - 1, (last_row + 1) * columns - 1);
+
+	for (int slide_index = first_row * columns; slide_index <= last_slide; ++slide_index) {
+		auto cell = cell_rect (slide_index);
+		if (!cell.intersects (area))
+			continue;
+		if (slide_index < nb_thumbnails_) {
+			painter.drawImage (QRectF (cell), atlas_, QRectF (atlas_cell_rect (slide_index)));
+		} else {
+			// Placeholder until the thumbnail is available
+			auto inner = cell.adjusted (cell_margin, cell_margin, -cell_margin, -cell_margin);
+			painter.fillRect (inner, Qt::darkGray);
+			painter.setPen (Qt::white);
+			painter.drawText (inner, Qt::AlignCenter, QString::number (slide_index + 1));
+		}
+		if (slide_index == current_slide_index_) {
+			painter.setPen (QPen (Qt::cyan, cell_margin / 2));
+			painter.setBrush (Qt::NoBrush);
+			painter.drawRect (cell.adjusted (cell_margin / 4, cell_margin / 4, -cell_margin / 4,
+			                                 -cell_margin / 4));
+		}
+	}
+}
+
+void SlideOverview::resizeEvent (QResizeEvent *) {
+	update_scroll_bar ();
+}
+
+void SlideOverview::mouseReleaseEvent (QMouseEvent * event) {
+	if (event->button () != Qt::LeftButton)
+		return;
+	auto slide_index = slide_at (event->pos ());
+	if (slide_index >= 0) {
+		hide ();
+		emit page_activated (document_->slide (slide_index)->first_page ()->index ());
+	}
+}
+
+void SlideOverview::keyPressEvent (QKeyEvent * event) {
+	if (event->key () == Qt::Key_Escape) {
+		hide ();
+	} else {
+		QAbstractScrollArea::keyPressEvent (event);
+	}
+}
+
+void SlideOverview::scrollContentsBy (int dx, int dy) {
+	// Only the exposed area will be repainted
+	viewport ()->scroll (dx, dy);
+}
+
+void SlideOverview::set_render_backend (std::shared_ptr<const Render::Backend> backend) {
+	render_backend_ = std::move (backend);
+}
+
+void SlideOverview::change_document (const Document * new_document) {
+	Q_ASSERT (new_document != nullptr);
+	// The old document may be released after this: stop using it
+	thumbnail_tasks_.cancel ();
+	++generation_;
+	document_ = new_document;
+	current_slide_index_ = 0;
+	nb_thumbnails_ = 0;
+	atlas_ = QImage ();
+	if (!document_->is_partial ()) {
+		Q_ASSERT (render_backend_);
+		atlas_device_pixel_ratio_ = devicePixelRatioF ();
+		const int atlas_rows = (nb_slides () + atlas_columns - 1) / atlas_columns;
+		const auto atlas_size =
+		    QSize (atlas_columns * cell_width, atlas_rows * cell_height) * atlas_device_pixel_ratio_;
+		atlas_ = QImage (atlas_size, QImage::Format_RGB32);
+		atlas_.fill (Qt::black);
+		start_thumbnail_task ();
+	}
+	update_scroll_bar ();
+	viewport ()->update ();
+}
+
+void SlideOverview::change_current_page (const PageInfo * new_current_page) {
+	Q_ASSERT (new_current_page != nullptr);
+	auto new_slide_index = new_current_page->slide ()->index ();
+	if (new_slide_index != current_slide_index_) {
+		auto old_cell = cell_rect (current_slide_index_);
+		current_slide_index_ = new_slide_index;
+		if (isVisible ()) {
+			viewport ()->update (old_cell);
+			viewport ()->update (cell_rect (current_slide_index_));
+		}
+	}
+}
+
+void SlideOverview::toggle () {
+	if (isVisible ()) {
+		hide ();
+	} else {
+		show ();
+		raise ();
+		setFocus ();
+		update_scroll_bar ();
+		scroll_to_current_slide ();
+	}
+}
+
+void SlideOverview::thumbnails_finished (int generation, int first_slide_index, QImage strip) {
+	if (generation != generation_)
+		return; // Outdated
+	// Same generation: the strip was made at the device pixel ratio of the atlas
+	const auto strip_cell_size = atlas_cell_rect (0).size ();
+	const int nb_new_thumbnails = strip.width () / strip_cell_size.width ();
+	{
+		QPainter painter (&atlas_);
+		for (int i = 0; i < nb_new_thumbnails; ++i) {
+			painter.drawImage (atlas_cell_rect (first_slide_index + i).topLeft (), strip,
+			                   QRect (QPoint (i * strip_cell_size.width (), 0), strip_cell_size));
+		}
+	}
+	nb_thumbnails_ = first_slide_index + nb_new_thumbnails;
+	if (isVisible ()) {
+		for (int i = 0; i < nb_new_thumbnails; ++i)
+			viewport ()->update (cell_rect (first_slide_index + i));
+	}
+	start_thumbnail_task ();
+}
+
+int SlideOverview::nb_slides () const {
+	return document_ != nullptr ? document_->nb_slides () : 0;
+}
+
+int SlideOverview::nb_columns () const {
+	return std::max (1, viewport ()->width () / cell_width);
+}
+
+QRect SlideOverview::cell_rect (int slide_index) const {
+	// Grid is centered horizontally
+	const int columns = nb_columns ();
+	const int left = std::max (0, (viewport ()->width () - columns * cell_width) / 2);
+	return {left + (slide_index % columns) * cell_width,
+	        (slide_index / columns) * cell_height - verticalScrollBar ()->value (), cell_width,
+	        cell_height};
+}
+
+QRect SlideOverview::atlas_cell_rect (int slide_index) const {
+	const auto size = QSize (cell_width, cell_height) * atlas_device_pixel_ratio_;
+	return {QPoint ((slide_index % atlas_columns) * size.width (),
+	                (slide_index / atlas_columns) * size.height ()),
+	        size};
+}
+
+int SlideOverview::slide_at (const QPoint & pos) const {
+	const int columns = nb_columns ();
+	const int left = std::max (0, (viewport ()->width () - columns * cell_width) / 2);
+	const int x = pos.x () - left;
+	const int y = pos.y () + verticalScrollBar ()->value ();
+	if (x < 0 || x >= columns * cell_width || y < 0)
+		return -1;
+	const int slide_index = (y / cell_height) * columns + x / cell_width;
+	return slide_index < nb_slides () ? slide_index : -1;
+}
+
+void SlideOverview::update_scroll_bar () {
+	const int nb_rows = (nb_slides () + nb_columns () - 1) / nb_columns ();
+	auto * bar = verticalScrollBar ();
+	bar->setRange (0, std::max (0, nb_rows * cell_height - viewport ()->height ()));
+	bar->setPageStep (viewport ()->height ());
+	bar->setSingleStep (cell_height / 4);
+}
+
+void SlideOverview::scroll_to_current_slide () {
+	auto cell = cell_rect (current_slide_index_);
+	auto * bar = verticalScrollBar ();
+	if (cell.top () < 0) {
+		bar->setValue (bar->value () + cell.top ());
+	} else if (cell.bottom () > viewport ()->height ()) {
+		bar->setValue (bar->value () + cell.bottom () - viewport ()->height ());
+	}
+}
+
+void SlideOverview::start_thumbnail_task () {
+	if (nb_thumbnails_ >= nb_slides ())
+		return;
+	std::vector<const PageInfo *> pages;
+	const int end = std::min (nb_slides (), nb_thumbnails_ + thumbnails_per_task);
+	for (int i = nb_thumbnails_; i < end; ++i)
+		pages.push_back (document_->slide (i)->last_page ());
+	auto * task = new ThumbnailTask (generation_, nb_thumbnails_, std::move (pages),
+	                                 QSize (cell_width, cell_height), cell_margin,
+	                                 atlas_device_pixel_ratio_, render_backend_,
+	                                 thumbnail_tasks_.cancel_flag ());
+	connect (task, &ThumbnailTask::finished_thumbnails, this, &SlideOverview::thumbnails_finished);
+	thumbnail_tasks_.start (task);
+}
+
+// GoToPrompt
+
+GoToPrompt::GoToPrompt (QWidget * parent) : QLineEdit (parent) {
+	setAlignment (Qt::AlignCenter);
+	setPlaceholderText (tr ("Slide number or label"));
+	connect (this, &QLineEdit::textEdited, this, &GoToPrompt::update_target);
+	connect (this, &QLineEdit::returnPressed, this, &GoToPrompt::go_to_target);
+	hide ();
+}
+
+void GoToPrompt::keyPressEvent (QKeyEvent * event) {
+	if (event->key () == Qt::Key_Escape) {
+		hide ();
+	} else {
+		QLineEdit::keyPressEvent (event);
+	}
+}
+void GoToPrompt::focusOutEvent (QFocusEvent * event) {
+	QLineEdit::focusOutEvent (event);
+	hide ();
+}
+
+void GoToPrompt::change_document (const Document * new_document) {
+	Q_ASSERT (new_document != nullptr);
+	document_ = new_document;
+	update_target (text ()); // Pages of the old document must not be used
+}
+
+void GoToPrompt::open () {
+	clear ();
+	update_target (QString ());
+	show ();
+	raise ();
+	setFocus ();
+}
+
+void GoToPrompt::update_target (const QString & text) {
+	const SlideInfo * slide = nullptr;
+	if (document_ != nullptr)
+		slide = document_->find_slide (text);
+	const PageInfo * new_target = slide != nullptr ? slide->first_page () : nullptr;
+
+	QPalette p (palette ());
+	p.setColor (QPalette::Text, new_target != nullptr || text.isEmpty () ? Qt::black : Qt::red);
+	setPalette (p);
+
+	if (new_target != target_) {
+		target_ = new_target;
+		if (target_ != nullptr)
+			emit candidate_changed (target_);
+	}
+}
+
+void GoToPrompt::go_to_target () {
+	if (target_ == nullptr)
+		return;
+	auto page_index = target_->index ();
+	hide ();
+	emit page_activated (page_index);
+}
+
+// SearchPrompt
+
+SearchPrompt::SearchPrompt (QWidget * parent) : QWidget (parent) {
+	QPalette p (palette ());
+	p.setColor (QPalette::Window, Qt::white);
+	setPalette (p);
+	setAutoFillBackground (true);
+
+	auto * layout = new QVBoxLayout;
+	layout->setContentsMargins (0, 0, 0, 0);
+	setLayout (layout);
+	edit_ = new QLineEdit;
+	edit_->setAlignment (Qt::AlignCenter);
+	edit_->setPlaceholderText (tr ("Search slide text"));
+	edit_->installEventFilter (this);
+	layout->addWidget (edit_);
+	result_label_ = new QLabel;
+	result_label_->setAlignment (Qt::AlignCenter);
+	result_label_->setTextFormat (Qt::PlainText);
+	layout->addWidget (result_label_);
+
+	connect (edit_, &QLineEdit::textEdited, this, &SearchPrompt::update_results);
+	connect (edit_, &QLineEdit::returnPressed, this, &SearchPrompt::go_to_selected_result);
+	hide ();
+}
+SearchPrompt::~SearchPrompt () = default; // SearchIndex is complete here
+
+bool SearchPrompt::eventFilter (QObject * watched, QEvent * event) {
+	if (watched == edit_ && event->type () == QEvent::KeyPress) {
+		switch (static_cast<QKeyEvent *> (event)->key ()) {
+		case Qt::Key_Escape:
+			hide ();
+			return true;
+		case Qt::Key_Down:
+			select_result (selected_result_ + 1);
+			return true;
+		case Qt::Key_Up:
+			select_result (selected_result_ - 1);
+			return true;
+		default:
+			break;
+		}
+	} else if (watched == edit_ && event->type () == QEvent::FocusOut) {
+		hide ();
+	}
+	return QWidget::eventFilter (watched, event);
+}
+
+void SearchPrompt::change_document (const Document * new_document) {
+	Q_ASSERT (new_document != nullptr);
+	// The old document may be released after this: stop using it
+	index_task_.cancel ();
+	++generation_;
+	document_ = new_document;
+	candidate_ = nullptr; // Pages of the old document must not be used
+	index_.reset ();
+	if (!document_->is_partial ()) {
+		auto * task = new SearchIndexTask (generation_, document_, index_task_.cancel_flag ());
+		connect (task, &SearchIndexTask::finished_index, this, &SearchPrompt::index_finished);
+		index_task_.start (task);
+	}
+	update_results ();
+}
+
+void SearchPrompt::open () {
+	edit_->clear ();
+	update_results ();
+	show ();
+	raise ();
+	edit_->setFocus ();
+}
+
+void SearchPrompt::index_finished (int generation, SearchIndex * index) {
+	std::unique_ptr<SearchIndex> new_index (index);
+	if (generation != generation_)
+		return; // Outdated
+	index_ = std::move (new_index);
+	update_results ();
+}
+
+void SearchPrompt::update_results () {
+	results_.clear ();
+	if (index_)
+		results_ = index_->search (edit_->text ());
+	select_result (0);
+}
+
+void SearchPrompt::go_to_selected_result () {
+	if (results_.empty ())
+		return;
+	auto page_index = document_->slide (results_[selected_result_])->first_page ()->index ();
+	hide ();
+	emit page_activated (page_index);
+}
+
+void SearchPrompt::select_result (int result) {
+	const auto nb_results = static_cast<int> (results_.size ());
+	QPalette p (result_label_->palette ());
+	p.setColor (QPalette::WindowText, Qt::black);
+	if (edit_->text ().trimmed ().isEmpty ()) {
+		result_label_->setText (index_ ? tr ("Type words of the slide") : tr ("Indexing slides..."));
+	} else if (!index_) {
+		result_label_->setText (tr ("Indexing slides..."));
+	} else if (nb_results == 0) {
+		p.setColor (QPalette::WindowText, Qt::red);
+		result_label_->setText (tr ("No matching slide"));
+	} else {
+		// Wrap around
+		selected_result_ = (result % nb_results + nb_results) % nb_results;
+		const auto slide_index = results_[selected_result_];
+
+		// Excerpt around the first occurrence of the last word, on one line
+		const auto & text = index_->slide_text (slide_index);
+		const auto words = edit_->text ().split (' ', QString::SkipEmptyParts);
+		auto position = words.isEmpty () ? -1 : text.indexOf (words.last (), 0, Qt::CaseInsensitive);
+		auto start = std::max (0, position - excerpt_context_chars);
+		auto excerpt = text.mid (start, 2 * excerpt_context_chars).simplified ();
+
+		result_label_->setText (tr ("Slide %1 (%2/%3): %4")
+		                            .arg (slide_index + 1)
+		                            .arg (selected_result_ + 1)
+		                            .arg (nb_results)
+		                            .arg (excerpt));
+		const auto * candidate = document_->slide (slide_index)->first_page ();
+		if (candidate != candidate_) {
+			candidate_ = candidate;
+			emit candidate_changed (candidate_);
+		}
+	}
+	result_label_->setPalette (p);
+	if (nb_results == 0)
+		selected_result_ = 0;
 }
 
 // PresenterView
 
-PresenterView::PresenterView (int nb_slides, QWidget * parent)
-    : QWidget (parent), nb_slides_ (nb_slides) {
+PresenterView::PresenterView (QWidget * parent) : QWidget (parent) {
 	// Title
 	setWindowTitle (tr ("Presenter screen"));
 	// Black background, white text in childrens
@@ -139,14 +908,15 @@ PresenterView::PresenterView (int nb_slides, QWidget * parent)
 			auto * transition_box = new QHBoxLayout;
 			current_slide_panel->addLayout (transition_box, 3); // 30% screen height
 			{
+				// Each one takes half of the width, pages are aligned to the sides
 				previous_transition_page_ = new PageViewer (ViewRole::PrevTransition);
 				previous_transition_page_->setObjectName ("presenter/prev_transition");
+				previous_transition_page_->set_alignment (Qt::AlignLeft | Qt::AlignVCenter);
 				transition_box->addWidget (previous_transition_page_);
 
-				transition_box->addStretch ();
-
 				next_transition_page_ = new PageViewer (ViewRole::NextTransition);
 				next_transition_page_->setObjectName ("presenter/next_transition");
+				next_transition_page_->set_alignment (Qt::AlignRight | Qt::AlignVCenter);
 				transition_box->addWidget (next_transition_page_);
 			}
 
@@ -157,19 +927,17 @@ PresenterView::PresenterView (int nb_slides, QWidget * parent)
 			auto * next_slide_and_comment_panel = new QVBoxLayout;
 			slide_panels->addLayout (next_slide_and_comment_panel, 4); // 40% screen width
 
+			// Page viewers have no size hint: share the height with the notes
 			next_slide_first_page_ = new PageViewer (ViewRole::NextSlide);
 			next_slide_first_page_->setObjectName ("presenter/next_slide");
-			next_slide_and_comment_panel->addWidget (next_slide_first_page_);
+			next_slide_first_page_->set_alignment (Qt::AlignHCenter | Qt::AlignTop);
+			next_slide_and_comment_panel->addWidget (next_slide_first_page_, 1);
 
-			annotations_ = new QLabel;
-			annotations_->setWordWrap (true);
-			annotations_->setTextFormat (Qt::PlainText);
+			annotations_ = new NotesViewer;
 			// TODO Possible improvements:
 			// - font size a bit larger
 			// - margins between lines (non-wordwrapped ones)
-			next_slide_and_comment_panel->addWidget (annotations_);
-
-			next_slide_and_comment_panel->addStretch (); // Pad
+			next_slide_and_comment_panel->addWidget (annotations_, 1); // Half of the height
 		}
 	}
 	{
@@ -196,8 +964,56 @@ PresenterView::PresenterView (int nb_slides, QWidget * parent)
 			bottom_bar->addWidget (timer_label_);
 		}
 	}
+	{
+		// Slide overview, over all other widgets (not in the layout)
+		overview_ = new SlideOverview (this);
+		overview_->setPalette (p);
+		auto * sc = new QShortcut (QKeySequence (tr ("o", "slide overview key")), this);
+		sc->setAutoRepeat (false);
+		connect (sc, &QShortcut::activated, overview_, &SlideOverview::toggle);
+	}
+	{
+		// Go to slide prompt, over the bottom bar (not in the layout)
+		go_to_prompt_ = new GoToPrompt (this);
+		QFont f (go_to_prompt_->font ());
+		f.setPointSizeF (bottom_bar_text_point_size_factor * f.pointSizeF ());
+		go_to_prompt_->setFont (f);
+		auto * sc = new QShortcut (QKeySequence (tr ("g", "go to slide key")), this);
+		sc->setAutoRepeat (false);
+		connect (sc, &QShortcut::activated, go_to_prompt_, &GoToPrompt::open);
+	}
+	{
+		// Search prompt, over the bottom bar (not in the layout)
+		search_prompt_ = new SearchPrompt (this);
+		auto * sc = new QShortcut (QKeySequence (tr ("/", "search key")), this);
+		sc->setAutoRepeat (false);
+		connect (sc, &QShortcut::activated, search_prompt_, &SearchPrompt::open);
+	}
+}
+
+void PresenterView::resizeEvent (QResizeEvent *) {
+	overview_->setGeometry (rect ());
+	// Prompt centered at the bottom, a third of the width
+	auto prompt_size = QSize (width () / 3, go_to_prompt_->sizeHint ().height ());
+	go_to_prompt_->setGeometry (QRect (QPoint ((width () - prompt_size.width ()) / 2,
+	                                           height () - prompt_size.height ()),
+	                                   prompt_size));
+	// Search prompt centered at the bottom, two thirds of the width (room for excerpts)
+	auto search_size = QSize (2 * width () / 3, search_prompt_->sizeHint ().height ());
+	search_prompt_->setGeometry (QRect (QPoint ((width () - search_size.width ()) / 2,
+	                                            height () - search_size.height ()),
+	                                    search_size));
 }
 
+void PresenterView::change_document (const Document * new_document) {
+	Q_ASSERT (new_document != nullptr);
+	nb_slides_ = new_document->nb_slides ();
+	partial_document_ = new_document->is_partial ();
+	annotations_->change_document ();
+	overview_->change_document (new_document);
+	go_to_prompt_->change_document (new_document);
+	search_prompt_->change_document (new_document);
+}
 void PresenterView::change_time (bool paused, const QString & new_time_text) {
 	// Set text as colored if paused
 	auto color = Qt::white;
@@ -211,6 +1027,11 @@ void PresenterView::change_time (bool paused, const QString & new_time_text) {
 void PresenterView::change_slide_info (const PageInfo * new_current_page) {
 	Q_ASSERT (new_current_page != nullptr);
 	auto * slide = new_current_page->slide ();
-	slide_number_label_->setText (tr ("%1/%2").arg (slide->index () + 1).arg (nb_slides_));
-	annotations_->setText (slide->annotations ());
+	if (partial_document_) {
+		slide_number_label_->setText (tr ("%1/...").arg (slide->index () + 1));
+	} else {
+		slide_number_label_->setText (tr ("%1/%2").arg (slide->index () + 1).arg (nb_slides_));
+	}
+	annotations_->change_slide (slide);
+	overview_->change_current_page (new_current_page);
 }
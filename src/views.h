@@ -16,75 +16,455 @@
  */
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <QAbstractScrollArea>
+#include <QElapsedTimer>
+#include <QFont>
+#include <QHash>
+#include <QImage>
 #include <QLabel>
+#include <QLineEdit>
+#include <QObject>
 #include <QPixmap>
+#include <QPointF>
+#include <QPointer>
+#include <QRectF>
+#include <QRunnable>
+#include <QSet>
+#include <QString>
+#include <QTextLayout>
+#include <QTimer>
 #include <QWidget>
 
+#include "background_tasks.h"
 #include "controller.h"
+#include "overlay.h"
 #include "render.h"
+#include "transition.h"
+class QScreen;
+class QWindow;
+class Document;
+class SearchIndex;
 class PageInfo;
+class SlideInfo;
 namespace Action {
-class Base;
+class Link;
+}
+namespace Render {
+class Backend;
 }
 
-/* This widget will show a PDF page (using a QLabel).
- * It is shown maximized (keeping aspect ratio), and centered.
+/* This widget will show a PDF page.
+ * It is shown maximized (keeping aspect ratio), and centered (or with the selected alignment).
  *
- * The current pixmap is indicated by a Render::Info structure.
- * This struct indicates which page is shown, and at which rendered size.
+ * The pixmap is painted directly, without QLabel: content updates only repaint the widget.
+ * The size of the widget only depends on the layout, never on the shown page.
+ * The previous pixmap stays shown until the pixmap of the new page arrives (no empty frame).
+ *
+ * The last requested render and the shown render are indicated by Render::Info structures.
+ * They indicate which page is requested or shown, and at which rendered size.
+ * Links, page geometry and the overlay follow the shown render, until the new pixmap arrives.
+ * Renders use a profile (quality / speed tradeoff), which defaults to the one of the role.
+ * Renders are requested at the device pixel ratio of the screen showing the viewer.
+ * Moving the window to a screen with another ratio triggers a new request.
  *
  * Changes of current presentation page by the controller will trigger change_current_page ().
  * A request for a render is then sent to the rendering system.
  * The rendering system may never answer (size too small, etc).
- * The viewer will not display anything until the current page is changed.
  *
  * Requests for Pixmaps will go through the Rendering system.
  * The rendering system will broadcast request answers: receive_pixmap must filter incoming pixmaps.
  *
+ * The time from a page change to the first paint of its pixmap (flip to paint) is measured.
+ * Statistics are printed at destruction.
+ *
  * This widget also catches click events and will activate the page actions accordingly.
+ * Mouse moves are tracked to show a pointing hand cursor over links.
+ *
+ * An Overlay (laser dot, ink) can be painted over the render, repainting only damaged areas.
+ * If the viewer is interactive, mouse input is sent to the overlay when a tool is selected.
+ * Links are not activated while a tool is selected.
  */
-class PageViewer : public QLabel {
+class PageViewer : public QWidget {
 	Q_OBJECT
 
 private:
-	ViewRole role_;                          // Selected role of this viewer
-	const PageInfo * current_page_{nullptr}; // Current page of presentation
-	Render::Info current_render_{};          // Current rendered page (requested or shown).
-	bool requested_a_pixmap_{false};         // Did we request a render ?
+	ViewRole role_;                                     // Selected role of this viewer
+	Render::Profile profile_;                           // Render profile used for requests
+	const PageInfo * current_page_{nullptr};            // Current page of presentation
+	Render::Info current_render_{};                     // Last requested render (filters pixmaps)
+	Render::Info shown_render_{};                       // Render of the shown pixmap (geometry, links)
+	bool requested_a_pixmap_{false};                    // Did we request a render ?
+	RedrawCause requested_cause_{RedrawCause::Unknown}; // Cause of the requested render
+	QPixmap pixmap_;                                    // Shown pixmap (may be an older render)
+	Qt::Alignment alignment_{Qt::AlignCenter};          // Placement of the pixmap
+	bool cursor_over_link_{false};                      // Is the pointing hand cursor shown ?
+	Overlay * overlay_{nullptr};                        // Annotations painted over the render
+	bool overlay_input_{false};                         // Does mouse input draw on the overlay ?
+	QPointer<QWindow> watched_window_;                  // Window whose screen changes are followed
+	QPointer<QScreen> watched_screen_;                  // Screen whose resolution changes are followed
+
+	// Flip to paint latency
+	QElapsedTimer flip_clock_;       // Started by page changes, invalid once measured or dropped
+	bool flip_paint_pending_{false}; // Pixmap of the new page received, not painted yet
+	int nb_flips_{0};
+	qint64 total_flip_ns_{0};
+	qint64 max_flip_ns_{0};
 
 public:
 	explicit PageViewer (const ViewRole & role, QWidget * parent = nullptr);
+	~PageViewer ();
 
-	// Layouting info
-	int heightForWidth (int w) const Q_DECL_FINAL;
-	QSize sizeHint () const Q_DECL_FINAL;
+	void set_render_profile (Render::Profile profile);
+	void set_overlay (Overlay * overlay, bool interactive);
+	void set_alignment (Qt::Alignment alignment);
 
+	void showEvent (QShowEvent *) Q_DECL_FINAL;
 	void resizeEvent (QResizeEvent *) Q_DECL_FINAL;
+	void paintEvent (QPaintEvent * event) Q_DECL_FINAL;
+	void mousePressEvent (QMouseEvent * event) Q_DECL_FINAL;
 	void mouseReleaseEvent (QMouseEvent * event) Q_DECL_FINAL;
+	void mouseMoveEvent (QMouseEvent * event) Q_DECL_FINAL;
+	void leaveEvent (QEvent *) Q_DECL_FINAL;
 
 signals:
-	void action_activated (const Action::Base * action);
+	void action_activated (const Action::Link * action);
 	void request_render (Render::Request request);
+	// A new pixmap is shown (recording, streaming)
+	void pixmap_shown (const QPixmap & pixmap, const Render::Info & render_info);
+	// The shown render changed (null Info if none), to pin it in the render cache
+	void render_shown (ViewRole role, const Render::Info & render_info);
 
 public slots:
 	void change_current_page (const PageInfo * new_current_page, RedrawCause cause);
 	void receive_pixmap (const Render::Info & render_info, QPixmap pixmap);
 
+protected:
+	// Show a requested pixmap. cause is the one of the request. Default: store it and repaint.
+	virtual void show_pixmap (const QPixmap & pixmap, const Render::Info & render_info,
+	                          RedrawCause cause);
+	// Paint the render, before the overlay. Default: paint the shown pixmap.
+	virtual void paint_page (QPaintEvent * event);
+
+	const QPixmap & shown_pixmap () const { return pixmap_; }
+	QRect shown_pixmap_rect () const; // In widget coordinates
+
 private:
-	void update_label (RedrawCause cause);
+	void update_render (RedrawCause cause);
+	QRect aligned_rect (const QSize & size) const;           // size in device independent pixels
+	QRectF page_rect () const;                               // Current render rect
+	QPointF page_coordinates (const QPoint & pos) const;     // pos in widget coordinates
+	const Action::Link * link_at (const QPoint & pos) const; // pos in widget coordinates
+	void set_cursor_over_link (bool over_link);
+	void update_cursor ();
+	void overlay_changed (const PageInfo * page, const QRectF & area);
+	void screen_changed (QScreen * screen);
+	void watch_screen (QScreen * screen);
 };
 
-// Just one PageViewer, but also set a black background.
+/* Just one PageViewer, but also set a black background.
+ *
+ * Plays the PDF page transitions (see TransitionCompositor) when moving forward.
+ * When the incoming render is available, frames are painted at 60 fps until the end of the
+ * transition, instead of the shown pixmap. Other moves are instant.
+ */
 class PresentationView : public PageViewer {
 	Q_OBJECT
 
+private:
+	bool transitions_enabled_{true};
+	TransitionCompositor compositor_;
+	QTimer frame_timer_;
+
 public:
 	explicit PresentationView (QWidget * parent = nullptr);
+
+	void set_transitions_enabled (bool enabled);
+
+protected:
+	void show_pixmap (const QPixmap & pixmap, const Render::Info & render_info,
+	                  RedrawCause cause) Q_DECL_FINAL;
+	void paint_page (QPaintEvent * event) Q_DECL_FINAL;
+};
+
+/* Lays out notes text in a QTextLayout, wrapping lines at the given width.
+ * Can be used in any thread.
+ */
+std::unique_ptr<QTextLayout> make_notes_layout (const QString & text, const QFont & font,
+                                                int width);
+
+// Notes layouts are shared by the cache and the shown layout. Freed even if a signal is dropped.
+using NotesLayout = std::shared_ptr<const QTextLayout>;
+
+// "Layout notes text" task for QThreadPool.
+class NotesLayoutTask : public QObject, public QRunnable {
+	Q_OBJECT
+
+private:
+	const int generation_;
+	const int slide_index_;
+	const QString text_;
+	const QFont font_;
+	const int width_;
+
+public:
+	NotesLayoutTask (int generation, int slide_index, const QString & text, const QFont & font,
+	                 int width)
+	    : generation_ (generation),
+	      slide_index_ (slide_index),
+	      text_ (text),
+	      font_ (font),
+	      width_ (width) {}
+
+signals:
+	void finished_layout (int generation, int slide_index, NotesLayout layout);
+
+public:
+	void run () Q_DECL_FINAL {
+		emit finished_layout (generation_, slide_index_,
+		                      NotesLayout (make_notes_layout (text_, font_, width_)));
+	}
+};
+
+/* Shows the annotations (notes) of the current slide.
+ *
+ * Word wrapping long notes is costly, and a QLabel would do it on the page flip path.
+ * Instead, notes of the current and neighbouring slides are laid out in background.
+ * Layouts are cached by slide index, for the current widget width.
+ * A slide change then only swaps the shown layout (laid out synchronously on a cache miss).
+ * The cache is rebuilt when the width changes, or when the document changes.
+ * A generation number discards layouts made for an outdated width or document.
+ */
+class NotesViewer : public QWidget {
+	Q_OBJECT
+
+private:
+	static constexpr int neighbourhood = 2; // Cached layouts around the current slide
+
+	const SlideInfo * current_slide_{nullptr};
+	NotesLayout current_layout_;
+	int generation_{0};
+	QHash<int, NotesLayout> layouts_; // By slide index
+	QSet<int> being_laid_out_;        // By slide index
+
+public:
+	explicit NotesViewer (QWidget * parent = nullptr);
+
+	void paintEvent (QPaintEvent *) Q_DECL_FINAL;
+	void resizeEvent (QResizeEvent * event) Q_DECL_FINAL;
+
+public slots:
+	void change_document ();
+	void change_slide (const SlideInfo * slide);
+
+private slots:
+	void layout_finished (int generation, int slide_index, NotesLayout layout);
+
+private:
+	void invalidate_layouts ();
+	void prepare_neighbourhood ();
+	void start_layout (const SlideInfo * slide);
+};
+
+/* "Render slide thumbnails" task, for the slide overview.
+ * Renders thumbnails of consecutive slides, each centered in a cell of a strip image.
+ * The last page of each slide is used, as it shows all the slide content.
+ * Thumbnails are made by the render backend, with the Quality profile, at the device pixel ratio
+ * of the overview: cells of the strip are in device pixels.
+ * Can be cancelled between thumbnails (the strip is then not emitted).
+ */
+class ThumbnailTask : public QObject, public QRunnable {
+	Q_OBJECT
+
+private:
+	const int generation_;
+	const int first_slide_index_;
+	const std::vector<const PageInfo *> pages_;
+	const QSize cell_size_; // Device independent pixels
+	const int margin_;
+	const qreal device_pixel_ratio_;
+	const std::shared_ptr<const Render::Backend> backend_;
+	const std::shared_ptr<const std::atomic<bool>> cancelled_;
+
+public:
+	ThumbnailTask (int generation, int first_slide_index, std::vector<const PageInfo *> pages,
+	               const QSize & cell_size, int margin, qreal device_pixel_ratio,
+	               std::shared_ptr<const Render::Backend> backend,
+	               std::shared_ptr<const std::atomic<bool>> cancelled)
+	    : generation_ (generation),
+	      first_slide_index_ (first_slide_index),
+	      pages_ (std::move (pages)),
+	      cell_size_ (cell_size),
+	      margin_ (margin),
+	      device_pixel_ratio_ (device_pixel_ratio),
+	      backend_ (std::move (backend)),
+	      cancelled_ (std::move (cancelled)) {}
+
+signals:
+	void finished_thumbnails (int generation, int first_slide_index, QImage strip);
+
+public:
+	void run () Q_DECL_FINAL;
+};
+
+/* Overview of all slides as a grid of thumbnails, to quickly jump to a slide.
+ * Shown over the presenter view (toggled with 'o'); clicking a slide goes to it.
+ *
+ * Thumbnails are stored in a single atlas image with fixed size cells (atlas_columns per row).
+ * The atlas is in device pixels, at the device pixel ratio of the overview at document change.
+ * The atlas is filled in background once the full document is loaded, a few slides at a time.
+ * Thumbnails are made by the render backend of the render system (set_render_backend).
+ * ThumbnailTasks are background tasks (see background_tasks.h), started one chunk at a time.
+ * On document change, the running task is cancelled and waited for (at most one thumbnail).
+ *
+ * Painting only draws the visible cells, copied from the atlas without scaling.
+ * Scrolling moves the already painted area, only the exposed rows are painted.
+ */
+class SlideOverview : public QAbstractScrollArea {
+	Q_OBJECT
+
+private:
+	static constexpr int cell_width = 176;
+	static constexpr int cell_height = 132;
+	static constexpr int cell_margin = 8;
+	static constexpr int atlas_columns = 16;
+	static constexpr int thumbnails_per_task = 4;
+
+	const Document * document_{nullptr};
+	int current_slide_index_{0};
+	std::shared_ptr<const Render::Backend> render_backend_;
+
+	QImage atlas_;
+	qreal atlas_device_pixel_ratio_{1.};
+	int nb_thumbnails_{0}; // Thumbnails in the atlas, for slides [0, nb_thumbnails_)
+	int generation_{0};
+	BackgroundTasks thumbnail_tasks_;
+
+public:
+	explicit SlideOverview (QWidget * parent = nullptr);
+
+	void paintEvent (QPaintEvent * event) Q_DECL_FINAL;
+	void resizeEvent (QResizeEvent * event) Q_DECL_FINAL;
+	void mouseReleaseEvent (QMouseEvent * event) Q_DECL_FINAL;
+	void keyPressEvent (QKeyEvent * event) Q_DECL_FINAL;
+	void scrollContentsBy (int dx, int dy) Q_DECL_FINAL;
+
+	// Required before the first document change
+	void set_render_backend (std::shared_ptr<const Render::Backend> backend);
+
+signals:
+	void page_activated (int page_index);
+
+public slots:
+	void change_document (const Document * new_document);
+	void change_current_page (const PageInfo * new_current_page);
+	void toggle ();
+
+private slots:
+	void thumbnails_finished (int generation, int first_slide_index, QImage strip);
+
+private:
+	int nb_slides () const;
+	int nb_columns () const;
+	QRect cell_rect (int slide_index) const; // In viewport coordinates
+	int slide_at (const QPoint & pos) const; // -1 if none
+	QRect atlas_cell_rect (int slide_index) const; // In atlas device pixels
+	void update_scroll_bar ();
+	void scroll_to_current_slide ();
+	void start_thumbnail_task ();
+};
+
+/* Prompt to go to a slide, by slide number or page label (see Document::find_slide).
+ * Shown at the bottom of the presenter view with 'g'. Enter jumps, Escape cancels.
+ *
+ * While typing, the first page of the matching slide is emitted as a candidate.
+ * The render system prerenders it for all views: the jump is then served from the cache.
+ * Text is shown in red if there is no matching slide.
+ */
+class GoToPrompt : public QLineEdit {
+	Q_OBJECT
+
+private:
+	const Document * document_{nullptr};
+	const PageInfo * target_{nullptr};
+
+public:
+	explicit GoToPrompt (QWidget * parent = nullptr);
+
+	void keyPressEvent (QKeyEvent * event) Q_DECL_FINAL;
+	void focusOutEvent (QFocusEvent * event) Q_DECL_FINAL;
+
+signals:
+	void candidate_changed (const PageInfo * page);
+	void page_activated (int page_index);
+
+public slots:
+	void change_document (const Document * new_document);
+	void open ();
+
+private slots:
+	void update_target (const QString & text);
+	void go_to_target ();
+};
+
+/* Full-text search prompt (see search.h), shown at the bottom of the presenter view with '/'.
+ *
+ * The search index is built in background once the full document is loaded.
+ * The SearchIndexTask is a background task (see background_tasks.h).
+ * On document change, the running task is cancelled and waited for (at most one page).
+ *
+ * Results are updated while typing: the selected result is shown with an excerpt of its text.
+ * Up / Down select other results. Enter jumps to the selected slide, Escape cancels.
+ * Like GoToPrompt, the selected slide is emitted as a candidate, to be prerendered.
+ */
+class SearchPrompt : public QWidget {
+	Q_OBJECT
+
+private:
+	static constexpr int excerpt_context_chars = 40;
+
+	QLineEdit * edit_;
+	QLabel * result_label_;
+
+	const Document * document_{nullptr};
+	std::unique_ptr<SearchIndex> index_;
+	std::vector<int> results_; // Slide indexes, best first
+	int selected_result_{0};
+	const PageInfo * candidate_{nullptr};
+
+	int generation_{0}; // Incremented on document change, identifies index tasks
+	BackgroundTasks index_task_;
+
+public:
+	explicit SearchPrompt (QWidget * parent = nullptr);
+	~SearchPrompt ();
+
+	bool eventFilter (QObject * watched, QEvent * event) Q_DECL_FINAL;
+
+signals:
+	void candidate_changed (const PageInfo * page);
+	void page_activated (int page_index);
+
+public slots:
+	void change_document (const Document * new_document);
+	void open ();
+
+private slots:
+	void index_finished (int generation, SearchIndex * index);
+	void update_results ();
+	void go_to_selected_result ();
+
+private:
+	void select_result (int result);
 };
 
 /* Presenter view.
  * Contains multiple PageViewers: current page, next slide, transitions if applicable.
  * Also show the timer, annotations, slide numbering.
+ * The slide overview, go to prompt and search prompt are shown over the other widgets when opened.
  */
 class PresenterView : public QWidget {
 	Q_OBJECT
@@ -92,24 +472,36 @@ class PresenterView : public QWidget {
 private:
 	static constexpr qreal bottom_bar_text_point_size_factor = 2.0;
 
-	const int nb_slides_;
+	int nb_slides_{0};
+	bool partial_document_{false}; // Slide count is not known yet
 	PageViewer * current_page_;
 	PageViewer * previous_transition_page_;
 	PageViewer * next_transition_page_;
 	PageViewer * next_slide_first_page_;
-	QLabel * annotations_;
+	NotesViewer * annotations_;
 	QLabel * slide_number_label_;
 	QLabel * timer_label_;
+	SlideOverview * overview_;
+	GoToPrompt * go_to_prompt_;
+	SearchPrompt * search_prompt_;
 
 public:
-	explicit PresenterView (int nb_slides, QWidget * parent = nullptr);
+	explicit PresenterView (QWidget * parent = nullptr);
+
+	void resizeEvent (QResizeEvent * event) Q_DECL_FINAL;
 
 	PageViewer * current_page_viewer () const { return current_page_; }
 	PageViewer * next_slide_first_page_viewer () const { return next_slide_first_page_; }
 	PageViewer * next_transition_page_viewer () const { return next_transition_page_; }
 	PageViewer * previous_transition_page_viewer () const { return previous_transition_page_; }
+	SlideOverview * slide_overview () const { return overview_; }
+	GoToPrompt * go_to_prompt () const { return go_to_prompt_; }
+	SearchPrompt * search_prompt () const { return search_prompt_; }
 
 public slots:
+	void change_document (const Document * new_document);
 	void change_time (bool paused, const QString & new_time_text);
 	void change_slide_info (const PageInfo * new_current_page);
 };
+
+Q_DECLARE_METATYPE (NotesLayout);
@@ -0,0 +1,41 @@
+### Render system tests ###
+# Scheduling and caching of the render system, with synthetic documents and renders.
+# Built and run by "make check" in the main project.
+
+TEMPLATE = app
+TARGET = tst_render
+CONFIG += c++11 testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../../src/
+
+QT += core network widgets testlib
+HEADERS += \
+	../../src/action.h \
+	../../src/background_tasks.h \
+	../../src/controller.h \
+	../../src/document.h \
+	../../src/render.h \
+	../../src/render_backend.h \
+	../../src/render_cache.h \
+	../../src/render_internal.h \
+	../../src/slab_allocator.h \
+	../../src/utils.h
+SOURCES += \
+	../../src/action.cpp \
+	../../src/background_tasks.cpp \
+	../../src/controller.cpp \
+	../../src/document.cpp \
+	../../src/prefetch_strategies.cpp \
+	../../src/render.cpp \
+	../../src/render_backend.cpp \
+	../../src/render_cache.cpp \
+	../../src/slab_allocator.cpp \
+	tst_render.cpp
+
+# Poppler (document.cpp), as in the main project
+macx: {
+	QT_CONFIG -= no-pkg-config
+}
+CONFIG += link_pkgconfig
+PKGCONFIG += poppler-qt5
@@ -0,0 +1,446 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <array>
+#include <memory>
+#include <random>
+
+#include <QByteArray>
+#include <QImage>
+#include <QSet>
+#include <QSignalSpy>
+#include <QSize>
+#include <QSizeF>
+#include <QThreadPool>
+#include <QtTest>
+
+#include "controller.h"
+#include "document.h"
+#include "render.h"
+#include "render_backend.h"
+#include "render_cache.h"
+
+Q_DECLARE_METATYPE (Render::CachePolicy);
+Q_DECLARE_METATYPE (Render::SyntheticBackend::Content);
+
+/* Render system tests, with synthetic documents and renders (no Poppler).
+ * Renders of synthetic pages fill the box exactly: page size in dots, box in pixels.
+ * Synthetic pages with the same index are unchanged pages across a document change.
+ */
+class TestRender : public QObject {
+	Q_OBJECT
+
+private slots:
+	void initTestCase ();
+
+	// RenderCache
+	void cache_distance_eviction ();
+	void cache_lru_eviction ();
+	void cache_batch_eviction ();
+	void cache_shown_render_pinned ();
+	void cache_document_change ();
+
+	// System
+	void request_is_rendered_once ();
+	void prefetch_neighbour_pages ();
+	void prefetch_current_page ();
+	void reload_keeps_cached_renders ();
+	void reload_renames_running_render ();
+	void reload_twice_during_render ();
+
+	// Scheduler stress (benchmarked)
+	void scheduler_random_walk_data ();
+	void scheduler_random_walk ();
+};
+
+namespace {
+const QSizeF page_size_dots (364., 273.);
+const QSize box (364, 273);
+const qint64 cache_size_bytes = 64 << 20;
+const int nb_pages = 10;
+
+Render::Info info_for (const Document & document, int page_index) {
+	return {document.page (page_index), box, Render::Profile::Quality};
+}
+Render::Request request_for (const Document & document, int page_index, RedrawCause cause) {
+	return {document.page (page_index), box, ViewRole::CurrentPublic, cause,
+	        Render::Profile::Quality};
+}
+// Cache contents are not looked at: a small block, of cost 1
+Render::Compressed * make_compressed () {
+	return new Render::Compressed{Render::CompressedData (QByteArray (16, 'x')), box,
+	                              4 * box.width (), QImage::Format_ARGB32_Premultiplied};
+}
+std::shared_ptr<Render::SyntheticBackend> make_backend (int latency_us) {
+	return std::make_shared<Render::SyntheticBackend> (latency_us,
+	                                                   Render::SyntheticBackend::Content::Flat);
+}
+} // namespace
+
+void TestRender::initTestCase () {
+	qRegisterMetaType<Render::Info> ();
+	qRegisterMetaType<Render::Request> ();
+	qRegisterMetaType<ViewRole> ();
+}
+
+void TestRender::cache_distance_eviction () {
+	// Renders ahead of the shown page are kept first, backward distances count double
+	auto document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	Render::ViewRequests views;
+	views[static_cast<int> (ViewRole::CurrentPublic)] =
+	    request_for (*document, 5, RedrawCause::RandomMove);
+	Render::RenderCache cache (4, views);
+	cache.set_policy (Render::CachePolicy::Distance);
+	for (int i = 0; i < nb_pages; ++i)
+		cache.insert (info_for (*document, i), make_compressed (), 1);
+
+	for (int i : {4, 5, 6, 7})
+		QVERIFY (cache.object (info_for (*document, i)) != nullptr);
+	QCOMPARE (cache.total_cost (), qint64 (4));
+	QCOMPARE (cache.statistics ().capacity_evictions, 6);
+
+	// The shown render is pinned, even if it is the only render left
+	cache.set_max_cost (0);
+	QVERIFY (cache.object (info_for (*document, 5)) != nullptr);
+	QCOMPARE (cache.total_cost (), qint64 (1));
+	QCOMPARE (cache.statistics ().shrink_evictions, 3);
+
+	// Made again after eviction
+	cache.note_miss (info_for (*document, 0), false);
+	cache.note_miss (info_for (*document, 6), true);
+	QCOMPARE (cache.statistics ().prefetched_after_eviction, 1);
+	QCOMPARE (cache.statistics ().requested_after_eviction, 1);
+}
+
+void TestRender::cache_lru_eviction () {
+	// Least recently used first, without pinning
+	auto document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	Render::ViewRequests views;
+	views[static_cast<int> (ViewRole::CurrentPublic)] =
+	    request_for (*document, 0, RedrawCause::RandomMove);
+	Render::RenderCache cache (4, views);
+	cache.set_policy (Render::CachePolicy::Lru);
+	for (int i = 0; i < nb_pages; ++i) {
+		cache.insert (info_for (*document, i), make_compressed (), 1);
+		cache.object (info_for (*document, 1)); // Kept by use
+	}
+
+	for (int i : {1, 7, 8, 9})
+		QVERIFY (cache.object (info_for (*document, i)) != nullptr);
+	QVERIFY (cache.object (info_for (*document, 0)) == nullptr);
+	QCOMPARE (cache.statistics ().capacity_evictions, 6);
+
+	// Larger than the whole cache
+	cache.insert (info_for (*document, 0), make_compressed (), 5);
+	QVERIFY (cache.object (info_for (*document, 0)) == nullptr);
+	QCOMPARE (cache.statistics ().rejected_renders, 1);
+}
+
+void TestRender::cache_batch_eviction () {
+	// A full cache evicts down to its low water mark (1/16 below its size), not one by one
+	const int nb_renders = 40;
+	auto document = Document::make_synthetic (nb_renders, 1, page_size_dots);
+	Render::ViewRequests views;
+	views[static_cast<int> (ViewRole::CurrentPublic)] =
+	    request_for (*document, 0, RedrawCause::RandomMove);
+	Render::RenderCache cache (32, views);
+	for (int i = 0; i < 32; ++i)
+		cache.insert (info_for (*document, i), make_compressed (), 1);
+	QCOMPARE (cache.statistics ().capacity_evictions, 0);
+
+	cache.insert (info_for (*document, 32), make_compressed (), 1);
+	QCOMPARE (cache.total_cost (), qint64 (30));
+	QCOMPARE (cache.statistics ().capacity_evictions, 3);
+	for (int i = 33; i < 35; ++i)
+		cache.insert (info_for (*document, i), make_compressed (), 1);
+	QCOMPARE (cache.statistics ().capacity_evictions, 3);
+	QVERIFY (cache.object (info_for (*document, 0)) != nullptr); // Shown
+}
+
+void TestRender::cache_shown_render_pinned () {
+	// The render on screen while the requested one is being made is pinned too
+	auto document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	Render::ViewRequests views;
+	views[static_cast<int> (ViewRole::CurrentPublic)] =
+	    request_for (*document, 5, RedrawCause::RandomMove);
+	Render::RenderCache cache (4, views);
+	cache.set_shown (ViewRole::CurrentPublic, info_for (*document, 9));
+	for (int i = 0; i < nb_pages; ++i)
+		cache.insert (info_for (*document, i), make_compressed (), 1);
+
+	for (int i : {5, 6, 7, 9})
+		QVERIFY (cache.object (info_for (*document, i)) != nullptr);
+	cache.set_max_cost (0);
+	QCOMPARE (cache.total_cost (), qint64 (2));
+
+	// Nothing shown anymore: only the requested render stays
+	cache.set_shown (ViewRole::CurrentPublic, Render::Info ());
+	cache.set_max_cost (0);
+	QCOMPARE (cache.total_cost (), qint64 (1));
+}
+
+void TestRender::cache_document_change () {
+	auto old_document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	auto new_document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	Render::ViewRequests views;
+	Render::RenderCache cache (nb_pages, views);
+	for (int i = 0; i < nb_pages; ++i)
+		cache.insert (info_for (*old_document, i), make_compressed (), 1);
+
+	// Even pages are kept
+	const int kept = cache.change_document ([&](const Render::Info & old_info) -> Render::Info {
+		const int index = old_info.page ()->index ();
+		return index % 2 == 0 ? info_for (*new_document, index) : Render::Info ();
+	});
+	QCOMPARE (kept, nb_pages / 2);
+	QCOMPARE (cache.statistics ().document_evictions, nb_pages / 2);
+	QCOMPARE (cache.total_cost (), qint64 (nb_pages / 2));
+	for (int i = 0; i < nb_pages; ++i) {
+		QVERIFY (cache.object (info_for (*old_document, i)) == nullptr);
+		QCOMPARE (cache.object (info_for (*new_document, i)) != nullptr, i % 2 == 0);
+	}
+}
+
+void TestRender::request_is_rendered_once () {
+	auto document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	auto backend = make_backend (0);
+	Render::System renderer (cache_size_bytes, nullptr, backend);
+	QSignalSpy rendered (&renderer, &Render::System::new_render);
+	QSignalSpy finished (&renderer, &Render::System::all_renders_finished);
+
+	// Views requesting the same render in a batch share it
+	renderer.request_render (request_for (*document, 3, RedrawCause::RandomMove));
+	renderer.request_render (Render::Request{document->page (3), box, ViewRole::CurrentPresenter,
+	                                         RedrawCause::RandomMove, Render::Profile::Quality});
+	QVERIFY (finished.wait ());
+	QCOMPARE (rendered.count (), 1);
+	const auto render_info = rendered.at (0).at (0).value<Render::Info> ();
+	QCOMPARE (render_info, info_for (*document, 3));
+	QCOMPARE (rendered.at (0).at (1).value<QPixmap> ().size (), box);
+
+	// Served from the cache (decompressed), not rendered again
+	renderer.request_render (request_for (*document, 3, RedrawCause::Resize));
+	QVERIFY (finished.wait ());
+	QCOMPARE (rendered.count (), 2);
+	QCOMPARE (backend->statistics ().renders, 1);
+}
+
+void TestRender::prefetch_neighbour_pages () {
+	auto document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	auto backend = make_backend (0);
+	Render::System renderer (cache_size_bytes, Render::default_prefetch_strategy (), backend);
+	QSignalSpy finished (&renderer, &Render::System::all_renders_finished);
+
+	// Moving forward: the previous page, and a few pages ahead
+	renderer.request_render (request_for (*document, 4, RedrawCause::ForwardMove));
+	QVERIFY (finished.wait ());
+	Render::Compressed compressed;
+	for (int i : {3, 4, 5, 6, 7})
+		QVERIFY (renderer.find_cached_render (info_for (*document, i), compressed));
+	QVERIFY (!renderer.find_cached_render (info_for (*document, 2), compressed));
+	QCOMPARE (backend->statistics ().renders, 5);
+	QCOMPARE (backend->statistics ().duplicate_renders, 0);
+
+	// Flipping to a prefetched page does not render it again
+	QSignalSpy rendered (&renderer, &Render::System::new_render);
+	renderer.request_render (request_for (*document, 5, RedrawCause::ForwardMove));
+	QVERIFY (finished.wait ());
+	QCOMPARE (rendered.count (), 1);
+	QCOMPARE (backend->statistics ().duplicate_renders, 0);
+}
+
+void TestRender::prefetch_current_page () {
+	// Renders what the views would show after a jump, at the size of their last request
+	auto document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	auto backend = make_backend (0);
+	Render::System renderer (cache_size_bytes, nullptr, backend);
+	QSignalSpy finished (&renderer, &Render::System::all_renders_finished);
+
+	renderer.request_render (request_for (*document, 0, RedrawCause::RandomMove));
+	QVERIFY (finished.wait ());
+	renderer.prefetch_current_page (document->page (8));
+	QVERIFY (finished.wait ());
+	Render::Compressed compressed;
+	QVERIFY (renderer.find_cached_render (info_for (*document, 8), compressed));
+	QCOMPARE (backend->statistics ().renders, 2);
+}
+
+void TestRender::reload_keeps_cached_renders () {
+	auto old_document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	auto backend = make_backend (0);
+	Render::System renderer (cache_size_bytes, nullptr, backend);
+	QSignalSpy finished (&renderer, &Render::System::all_renders_finished);
+	renderer.request_render (request_for (*old_document, 2, RedrawCause::RandomMove));
+	QVERIFY (finished.wait ());
+
+	// Same page, moved to the new document
+	auto new_document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	renderer.change_document (new_document.get (), old_document.get ());
+	Render::Compressed compressed;
+	QVERIFY (renderer.find_cached_render (info_for (*new_document, 2), compressed));
+	QVERIFY (!renderer.find_cached_render (info_for (*old_document, 2), compressed));
+
+	// Page shape changed: the render is dropped
+	auto resized_document = Document::make_synthetic (nb_pages, 1, QSizeF (364., 364.));
+	renderer.change_document (resized_document.get (), new_document.get ());
+	QVERIFY (!renderer.find_cached_render (info_for (*resized_document, 2), compressed));
+	QCOMPARE (renderer.cache_statistics ().document_evictions, 1);
+}
+
+void TestRender::reload_renames_running_render () {
+	// The render started for the old document answers the request for the new one
+	auto old_document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	auto backend = make_backend (200000);
+	Render::System renderer (cache_size_bytes, nullptr, backend);
+	QSignalSpy rendered (&renderer, &Render::System::new_render);
+	QSignalSpy finished (&renderer, &Render::System::all_renders_finished);
+	renderer.request_render (request_for (*old_document, 2, RedrawCause::RandomMove));
+	QTRY_COMPARE (backend->statistics ().renders, 1); // Running
+
+	auto new_document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	renderer.change_document (new_document.get (), old_document.get ());
+	renderer.request_render (request_for (*new_document, 2, RedrawCause::Resize));
+	QVERIFY (finished.wait ());
+	QCOMPARE (rendered.count (), 1);
+	QCOMPARE (rendered.at (0).at (0).value<Render::Info> (), info_for (*new_document, 2));
+	QCOMPARE (backend->statistics ().renders, 1);
+}
+
+void TestRender::reload_twice_during_render () {
+	// Renames of the running render are chained: it answers for the last document
+	auto first_document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	auto backend = make_backend (200000);
+	Render::System renderer (cache_size_bytes, nullptr, backend);
+	QSignalSpy rendered (&renderer, &Render::System::new_render);
+	QSignalSpy finished (&renderer, &Render::System::all_renders_finished);
+	renderer.request_render (request_for (*first_document, 2, RedrawCause::RandomMove));
+	renderer.request_render (Render::Request{first_document->page (5), box,
+	                                         ViewRole::CurrentPresenter, RedrawCause::RandomMove,
+	                                         Render::Profile::Quality});
+	QTRY_VERIFY (backend->statistics ().renders > 0); // Batch processed, renders launched
+
+	// Page 5 is removed by the second reload: its render is dropped
+	auto second_document = Document::make_synthetic (nb_pages, 1, page_size_dots);
+	renderer.change_document (second_document.get (), first_document.get ());
+	auto third_document = Document::make_synthetic (4, 1, page_size_dots);
+	renderer.change_document (third_document.get (), second_document.get ());
+	renderer.request_render (request_for (*third_document, 2, RedrawCause::Resize));
+	QVERIFY (finished.wait ());
+	QCOMPARE (rendered.count (), 1);
+	QCOMPARE (rendered.at (0).at (0).value<Render::Info> (), info_for (*third_document, 2));
+	Render::Compressed compressed;
+	QVERIFY (renderer.find_cached_render (info_for (*third_document, 2), compressed));
+	QVERIFY (!renderer.find_cached_render (info_for (*second_document, 2), compressed));
+	QCOMPARE (backend->statistics ().renders, 2);
+}
+
+void TestRender::scheduler_random_walk_data () {
+	QTest::addColumn<Render::SyntheticBackend::Content> ("content");
+	QTest::addColumn<qint64> ("cache_size");
+	QTest::addColumn<qreal> ("box_scale");
+	QTest::addColumn<Render::CachePolicy> ("cache_policy");
+	QTest::addColumn<bool> ("expect_no_duplicates");
+
+	// Everything fits in the cache: nothing is ever rendered twice
+	QTest::newRow ("no-eviction") << Render::SyntheticBackend::Content::Flat << qint64 (1 << 30)
+	                              << qreal (1.) << Render::CachePolicy::Distance << true;
+	// Small cache, incompressible renders: renders made again are expected
+	QTest::newRow ("eviction-lru") << Render::SyntheticBackend::Content::Noise << qint64 (16 << 20)
+	                               << qreal (0.25) << Render::CachePolicy::Lru << false;
+	QTest::newRow ("eviction-distance") << Render::SyntheticBackend::Content::Noise
+	                                    << qint64 (16 << 20) << qreal (0.25)
+	                                    << Render::CachePolicy::Distance << false;
+}
+
+void TestRender::scheduler_random_walk () {
+	/* Scheduler scenarios of "--benchmark scheduler", shortened.
+	 * All views request at each flip of a random walk (mostly forward, some backward moves, jumps and
+	 * resizes). Every fourth flip waits for the requested renders.
+	 */
+	QFETCH (Render::SyntheticBackend::Content, content);
+	QFETCH (qint64, cache_size);
+	QFETCH (qreal, box_scale);
+	QFETCH (Render::CachePolicy, cache_policy);
+	QFETCH (bool, expect_no_duplicates);
+	const int nb_walk_pages = 120;
+	const int nb_flips = 200;
+	const std::array<QSize, nb_view_roles> full_boxes{{QSize (1920, 1080), QSize (1280, 720),
+	                                                   QSize (640, 360), QSize (320, 180),
+	                                                   QSize (320, 180)}};
+	auto document = Document::make_synthetic (nb_walk_pages, 3, page_size_dots);
+
+	QBENCHMARK {
+		auto backend = std::make_shared<Render::SyntheticBackend> (200, content);
+		Render::System renderer (cache_size, Render::default_prefetch_strategy (), backend);
+		renderer.set_cache_policy (cache_policy);
+		QSet<Render::Info> waited_renders;
+		int nb_wrong_sizes = 0;
+		connect (&renderer, &Render::System::new_render,
+		         [&](const Render::Info & render_info, QPixmap pixmap) {
+			         if (pixmap.size () != render_info.size ())
+				         ++nb_wrong_sizes;
+			         waited_renders.remove (render_info);
+		         });
+
+		std::mt19937 random (42);
+		int page_index = 0;
+		qreal resize_factor = 1.;
+		for (int flip = 0; flip < nb_flips; ++flip) {
+			auto cause = RedrawCause::ForwardMove;
+			auto draw = random () % 100;
+			if (draw < 80) {
+				page_index = (page_index + 1) % nb_walk_pages;
+			} else if (draw < 92) {
+				cause = RedrawCause::BackwardMove;
+				page_index = (page_index + nb_walk_pages - 1) % nb_walk_pages;
+			} else if (draw < 97) {
+				cause = RedrawCause::RandomMove;
+				page_index = static_cast<int> (random () % nb_walk_pages);
+			} else {
+				cause = RedrawCause::Resize;
+				resize_factor = resize_factor == 1. ? 0.75 : 1.;
+			}
+			const bool wait = flip % 4 == 0;
+
+			waited_renders.clear ();
+			for (int role = 0; role < nb_view_roles; ++role) {
+				const auto view_role = static_cast<ViewRole> (role);
+				Render::Request request{document->page (page_index),
+				                        full_boxes[role] * (box_scale * resize_factor), view_role,
+				                        cause, Render::default_profile_for_role (view_role)};
+				auto render_info = request.requested_render ();
+				if (wait && !render_info.isNull ())
+					waited_renders.insert (render_info);
+				renderer.request_render (request);
+			}
+			QCoreApplication::processEvents (); // Batch processing
+			if (wait)
+				QTRY_VERIFY_WITH_TIMEOUT (waited_renders.isEmpty (), 10000);
+		}
+		// Let prefetch renders finish
+		do {
+			QThreadPool::globalInstance ()->waitForDone ();
+			QCoreApplication::processEvents ();
+		} while (QThreadPool::globalInstance ()->activeThreadCount () > 0);
+
+		QCOMPARE (nb_wrong_sizes, 0);
+		if (expect_no_duplicates)
+			QCOMPARE (backend->statistics ().duplicate_renders, 0);
+	}
+}
+
+QTEST_MAIN (TestRender)
+#include "tst_render.moc"